@@ -0,0 +1,338 @@
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "./hdl-simulator.hpp"
+#include "./test-script.hpp"
+
+using namespace std;
+
+// Runs the hardware simulator test scripts of projects 01 to 05 against
+// ChipSimulator. A chip's parts are read from the script's directory first
+// and then from the library directories given with --lib, so the chips of
+// earlier projects can be used as parts.
+//
+// --events simulates event-driven, --threads N sweeps large levels on N
+// threads, and --gate-level flattens RAM chips rather than replacing them by
+// builtin memories. --vcd writes the output-list pins to Script.vcd as they
+// change. --cache <directory> keeps flattened netlists there, keyed by the
+// contents of the chips' .hdl files. --bench N runs each script N times,
+// sweeping and event-driven, reporting the evaluations and time spent
+// simulating per run. With --threads N as well, the sweep is then timed on
+// 1, 2, 4 and so on up to N threads, with the speedup over one thread and
+// how many of the wires read across the levels' parts the partition cuts.
+
+class ChipTestScript : public TestScript
+{
+private:
+    HDLLibrary m_library;
+    ChipSimulator m_simulator;
+    bool m_loaded = false;
+    bool m_eventDriven;
+    chrono::duration<double> m_simulated{0};
+
+public:
+    struct Options
+    {
+        vector<string> libraries;
+        bool eventDriven = false;
+        int threads = 1;
+        bool gateLevel = false;
+        bool waveform = false;
+        string cache;
+    };
+
+    ChipTestScript(const string &scriptPath, const Options &options) : TestScript(scriptPath, "ticktock"), m_eventDriven(options.eventDriven)
+    {
+        m_library.addDirectory(m_directory.empty() ? "." : m_directory);
+        for (const auto &library : options.libraries)
+        {
+            m_library.addDirectory(library);
+        }
+        m_library.setMemoryModels(!options.gateLevel);
+        m_simulator.setThreads(options.threads);
+        m_waveform = options.waveform;
+        if (!options.cache.empty())
+        {
+            m_simulator.setCacheDirectory(options.cache);
+        }
+    }
+
+protected:
+    bool load(const string &filename) override
+    {
+        filesystem::path path(filename);
+        if (path.extension() != ".hdl")
+        {
+            m_error = filename.empty() ? "load needs a chip" : filename + " is not a chip";
+            return false;
+        }
+
+        if (!m_simulator.load(m_library, path.stem().string()))
+        {
+            m_error = "cannot load " + filename + " (" + m_simulator.error() + ")";
+            return false;
+        }
+
+        m_simulator.setEventDriven(m_eventDriven);
+        m_loaded = true;
+        return true;
+    }
+
+    bool step(uint64_t cycles) override
+    {
+        if (!m_loaded)
+        {
+            m_error = "no chip loaded";
+            return false;
+        }
+
+        auto start = chrono::steady_clock::now();
+        for (uint64_t i = 0; i < cycles; i++)
+        {
+            m_simulator.tick();
+            m_simulator.tock();
+        }
+        m_simulated += chrono::steady_clock::now() - start;
+        return true;
+    }
+
+    bool executeCommand(const vector<string> &args) override
+    {
+        if (!m_loaded)
+        {
+            m_error = "no chip loaded";
+            return false;
+        }
+
+        if (args[0] == "eval" || args[0] == "tick" || args[0] == "tock")
+        {
+            auto start = chrono::steady_clock::now();
+            if (args[0] == "eval")
+            {
+                m_simulator.eval();
+            }
+            else if (args[0] == "tick")
+            {
+                m_tickPhase = true;
+                m_simulator.tick();
+            }
+            else
+            {
+                m_tickPhase = false;
+                m_time++;
+                m_simulator.tock();
+            }
+            m_simulated += chrono::steady_clock::now() - start;
+            return true;
+        }
+
+        if (args[0] == "ROM32K" && args.size() == 3 && args[1] == "load")
+        {
+            if (!m_simulator.loadROM((m_directory / args[2]).string()))
+            {
+                m_error = m_simulator.error();
+                return false;
+            }
+            return true;
+        }
+
+        return TestScript::executeCommand(args);
+    }
+
+    bool get(const string &name, int16_t &value) override
+    {
+        if (!m_loaded)
+        {
+            m_error = "no chip loaded";
+            return false;
+        }
+
+        if (!m_simulator.get(name, value))
+        {
+            m_error = m_simulator.error();
+            return false;
+        }
+        return true;
+    }
+
+    bool set(const string &name, int16_t value) override
+    {
+        if (!m_loaded)
+        {
+            m_error = "no chip loaded";
+            return false;
+        }
+
+        if (!m_simulator.set(name, value))
+        {
+            m_error = m_simulator.error();
+            return false;
+        }
+        return true;
+    }
+
+    int width(const string &name) override
+    {
+        const auto &pins = m_simulator.netlist().pins();
+        auto pin = pins.find(name);
+        return pin == pins.end() ? 16 : pin->second.wires.size();
+    }
+
+public:
+    double simulatedSeconds() const
+    {
+        return m_simulated.count();
+    }
+
+    uint64_t evaluations() const
+    {
+        return m_simulator.evaluations();
+    }
+
+    const LevelPool::Partition &levelPartition() const
+    {
+        return m_simulator.levelPartition();
+    }
+};
+
+// Runs a script repeatedly, returning the mean time spent simulating per
+// run, or a negative time if the script fails.
+double benchRuns(const string &scriptPath, const ChipTestScript::Options &options, int runs, uint64_t &evaluations,
+                 LevelPool::Partition &partition)
+{
+    double seconds = 0;
+    evaluations = 0;
+    for (int run = 0; run < runs; run++)
+    {
+        ChipTestScript script(scriptPath, options);
+        if (!script.run(scriptPath))
+        {
+            cout << endl
+                 << "FAIL " << scriptPath << ": " << script.error() << endl;
+            return -1;
+        }
+        seconds += script.simulatedSeconds();
+        evaluations += script.evaluations();
+        partition = script.levelPartition();
+    }
+    evaluations /= runs;
+    return seconds / runs;
+}
+
+// Runs each script repeatedly with the levelized sweep and event-driven,
+// and then sweeping on each thread count up to options.threads.
+int bench(const vector<string> &scriptPaths, ChipTestScript::Options options, int runs)
+{
+    int maxThreads = options.threads;
+    for (const auto &scriptPath : scriptPaths)
+    {
+        uint64_t evaluations = 0;
+        LevelPool::Partition partition;
+        cout << "BENCH " << scriptPath << ":";
+        for (bool eventDriven : {false, true})
+        {
+            options.eventDriven = eventDriven;
+            options.threads = 1;
+            double seconds = benchRuns(scriptPath, options, runs, evaluations, partition);
+            if (seconds < 0)
+            {
+                return -1;
+            }
+            cout << (eventDriven ? "  events " : "  sweep ") << evaluations << " evaluations in " << seconds * 1000 << " ms";
+        }
+        cout << endl;
+
+        // Powers of two up to the thread count, and the thread count.
+        vector<int> threadCounts;
+        for (int threads = 1; threads < maxThreads; threads *= 2)
+        {
+            threadCounts.push_back(threads);
+        }
+        if (maxThreads > 1)
+        {
+            threadCounts.push_back(maxThreads);
+        }
+
+        options.eventDriven = false;
+        double oneThread = 0;
+        for (int threads : threadCounts)
+        {
+            options.threads = threads;
+            double seconds = benchRuns(scriptPath, options, runs, evaluations, partition);
+            if (seconds < 0)
+            {
+                return -1;
+            }
+            oneThread = threads == 1 ? seconds : oneThread;
+            cout << "BENCH " << scriptPath << ":  " << threads << " threads " << seconds * 1000 << " ms, "
+                 << oneThread / seconds << "x";
+            if (threads > 1)
+            {
+                cout << ", " << partition.cut << " wires read across parts (" << partition.consecutiveCut
+                     << " cutting levels into consecutive runs)";
+            }
+            cout << endl;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    ChipTestScript::Options options;
+    vector<string> scriptPaths;
+    int benchRuns = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+
+        if (arg == "--lib" && i + 1 < argc)
+        {
+            options.libraries.push_back(argv[++i]);
+        }
+        else if (arg == "--events")
+        {
+            options.eventDriven = true;
+        }
+        else if (arg == "--threads" && i + 1 < argc)
+        {
+            options.threads = max(stoi(argv[++i]), 1);
+        }
+        else if (arg == "--gate-level")
+        {
+            options.gateLevel = true;
+        }
+        else if (arg == "--vcd")
+        {
+            options.waveform = true;
+        }
+        else if (arg == "--cache" && i + 1 < argc)
+        {
+            options.cache = argv[++i];
+        }
+        else if (arg == "--bench" && i + 1 < argc)
+        {
+            benchRuns = max(stoi(argv[++i]), 1);
+        }
+        else
+        {
+            scriptPaths.push_back(arg);
+        }
+    }
+
+    if (scriptPaths.empty())
+    {
+        cout << "Invalid argument: specify path to .tst file" << endl
+             << "Usage: chip-test [--lib <directory>]... [--events] [--threads N] [--gate-level] [--vcd] [--cache <directory>] [--bench N] <file.tst>..." << endl;
+        return -1;
+    }
+
+    if (benchRuns > 0)
+    {
+        return bench(scriptPaths, options, benchRuns);
+    }
+
+    return runScripts<ChipTestScript>(scriptPaths, options);
+}
@@ -0,0 +1,416 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include "./hdl-simulator.hpp"
+
+using namespace std;
+
+// Checks combinational chips of projects 01 and 02 against reference models
+// with LaneSimulator. A chip with at most --bits input bits is checked on
+// every input combination, a wider one on --samples random inputs. Parts
+// are read from the chip's directory, then from the --lib directories.
+
+struct Model
+{
+    vector<string> inputs;
+    vector<string> outputs;
+    void (*compute)(const int *in, int *out);
+};
+
+int alu(int x, int y, int zx, int nx, int zy, int ny, int f, int no)
+{
+    x = zx ? 0 : x;
+    x = nx ? ~x : x;
+    y = zy ? 0 : y;
+    y = ny ? ~y : y;
+    int out = f ? x + y : x & y;
+    return (no ? ~out : out) & 0xFFFF;
+}
+
+const map<string, Model> models = {
+    {"Nand", {{"a", "b"}, {"out"}, [](const int *in, int *out)
+              { out[0] = !(in[0] & in[1]); }}},
+    {"Not", {{"in"}, {"out"}, [](const int *in, int *out)
+             { out[0] = !in[0]; }}},
+    {"And", {{"a", "b"}, {"out"}, [](const int *in, int *out)
+             { out[0] = in[0] & in[1]; }}},
+    {"Or", {{"a", "b"}, {"out"}, [](const int *in, int *out)
+            { out[0] = in[0] | in[1]; }}},
+    {"Xor", {{"a", "b"}, {"out"}, [](const int *in, int *out)
+             { out[0] = in[0] ^ in[1]; }}},
+    {"Mux", {{"a", "b", "sel"}, {"out"}, [](const int *in, int *out)
+             { out[0] = in[2] ? in[1] : in[0]; }}},
+    {"DMux", {{"in", "sel"}, {"a", "b"}, [](const int *in, int *out)
+              {
+                  out[0] = in[1] ? 0 : in[0];
+                  out[1] = in[1] ? in[0] : 0;
+              }}},
+    {"Not16", {{"in"}, {"out"}, [](const int *in, int *out)
+               { out[0] = ~in[0] & 0xFFFF; }}},
+    {"And16", {{"a", "b"}, {"out"}, [](const int *in, int *out)
+               { out[0] = in[0] & in[1]; }}},
+    {"Or16", {{"a", "b"}, {"out"}, [](const int *in, int *out)
+              { out[0] = in[0] | in[1]; }}},
+    {"Mux16", {{"a", "b", "sel"}, {"out"}, [](const int *in, int *out)
+               { out[0] = in[2] ? in[1] : in[0]; }}},
+    {"Or8Way", {{"in"}, {"out"}, [](const int *in, int *out)
+                { out[0] = in[0] != 0; }}},
+    {"Mux4Way16", {{"a", "b", "c", "d", "sel"}, {"out"}, [](const int *in, int *out)
+                   { out[0] = in[in[4]]; }}},
+    {"Mux8Way16", {{"a", "b", "c", "d", "e", "f", "g", "h", "sel"}, {"out"}, [](const int *in, int *out)
+                   { out[0] = in[in[8]]; }}},
+    {"DMux4Way", {{"in", "sel"}, {"a", "b", "c", "d"}, [](const int *in, int *out)
+                  {
+                      for (int i = 0; i < 4; i++)
+                      {
+                          out[i] = in[1] == i ? in[0] : 0;
+                      }
+                  }}},
+    {"DMux8Way", {{"in", "sel"}, {"a", "b", "c", "d", "e", "f", "g", "h"}, [](const int *in, int *out)
+                  {
+                      for (int i = 0; i < 8; i++)
+                      {
+                          out[i] = in[1] == i ? in[0] : 0;
+                      }
+                  }}},
+    {"HalfAdder", {{"a", "b"}, {"sum", "carry"}, [](const int *in, int *out)
+                   {
+                       out[0] = in[0] ^ in[1];
+                       out[1] = in[0] & in[1];
+                   }}},
+    {"FullAdder", {{"a", "b", "c"}, {"sum", "carry"}, [](const int *in, int *out)
+                   {
+                       out[0] = in[0] ^ in[1] ^ in[2];
+                       out[1] = (in[0] + in[1] + in[2]) >> 1;
+                   }}},
+    {"Add16", {{"a", "b"}, {"out"}, [](const int *in, int *out)
+               { out[0] = (in[0] + in[1]) & 0xFFFF; }}},
+    {"Inc16", {{"in"}, {"out"}, [](const int *in, int *out)
+               { out[0] = (in[0] + 1) & 0xFFFF; }}},
+    {"ALU", {{"x", "y", "zx", "nx", "zy", "ny", "f", "no"}, {"out", "zr", "ng"}, [](const int *in, int *out)
+             {
+                 out[0] = alu(in[0], in[1], in[2], in[3], in[4], in[5], in[6], in[7]);
+                 out[1] = out[0] == 0;
+                 out[2] = out[0] >> 15;
+             }}},
+};
+
+// A model pin and the chip wires carrying it, bit 0 first. In an
+// exhaustive check the pin takes bits shift.. of the input number.
+struct Port
+{
+    string name;
+    int shift;
+    Netlist::Bus wires;
+
+    int mask() const
+    {
+        return (1 << wires.size()) - 1;
+    }
+};
+
+class ChipVerifier
+{
+private:
+    static const int MAX_PINS = 16;
+
+    const Model &m_model;
+    const Netlist &m_netlist;
+    LaneSimulator m_simulator;
+    vector<Port> m_inputs;
+    vector<Port> m_outputs;
+    int m_inputBits = 0;
+    int m_in[LaneSimulator::LANES][MAX_PINS];
+    int m_out[LaneSimulator::LANES][MAX_PINS];
+    string m_error;
+
+public:
+    ChipVerifier(const Model &model, const Netlist &netlist) : m_model(model), m_netlist(netlist)
+    {
+    }
+
+    bool init()
+    {
+        if (!m_simulator.load(m_netlist))
+        {
+            m_error = m_simulator.error();
+            return false;
+        }
+
+        int outputBits = 0;
+        return ports(m_model.inputs, Netlist::INPUT, m_inputs, m_inputBits) &&
+               ports(m_model.outputs, Netlist::OUTPUT, m_outputs, outputBits);
+    }
+
+    int inputBits() const
+    {
+        return m_inputBits;
+    }
+
+    // Checks count inputs: the numbers 0 to count - 1 if exhaustive, and
+    // values drawn from the random generator otherwise.
+    bool verify(uint64_t count, bool exhaustive, uint64_t &random)
+    {
+        uint64_t block[64];
+
+        for (uint64_t batch = 0; batch < count; batch += LaneSimulator::LANES)
+        {
+            for (int lane = 0; lane < LaneSimulator::LANES; lane++)
+            {
+                uint64_t number = batch + lane;
+                for (size_t pin = 0; pin < m_inputs.size(); pin++)
+                {
+                    if (!exhaustive)
+                    {
+                        random ^= random << 13;
+                        random ^= random >> 7;
+                        random ^= random << 17;
+                    }
+                    m_in[lane][pin] = (exhaustive ? number >> m_inputs[pin].shift : random) & m_inputs[pin].mask();
+                }
+            }
+
+            if (exhaustive)
+            {
+                setCounter(batch);
+            }
+            else
+            {
+                setRandom(block);
+            }
+
+            m_simulator.eval();
+
+            for (int word = 0; word < LaneSimulator::WORDS; word++)
+            {
+                for (size_t pin = 0; pin < m_outputs.size(); pin++)
+                {
+                    fill(block, block + 64, 0);
+                    for (size_t bit = 0; bit < m_outputs[pin].wires.size(); bit++)
+                    {
+                        block[bit] = m_simulator.wire(m_outputs[pin].wires[bit])[word];
+                    }
+                    LaneSimulator::transpose(block);
+                    for (int lane = 0; lane < 64; lane++)
+                    {
+                        m_out[word * 64 + lane][pin] = block[lane];
+                    }
+                }
+            }
+
+            for (int lane = 0; lane < (int)min<uint64_t>(LaneSimulator::LANES, count - batch); lane++)
+            {
+                if (!check(m_in[lane], m_out[lane]))
+                {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    const string &error() const
+    {
+        return m_error;
+    }
+
+private:
+    bool ports(const vector<string> &names, Netlist::PinKind kind, vector<Port> &result, int &bits)
+    {
+        const auto &pins = m_netlist.pins();
+        for (const auto &name : names)
+        {
+            auto pin = pins.find(name);
+            if (pin == pins.end() || pin->second.kind != kind)
+            {
+                m_error = "the chip has no " + string(kind == Netlist::INPUT ? "input" : "output") + " pin " + name;
+                return false;
+            }
+            result.push_back({name, bits, pin->second.wires});
+            bits += pin->second.wires.size();
+        }
+
+        int chipPins = 0;
+        for (const auto &[name, pin] : pins)
+        {
+            chipPins += pin.kind == kind;
+        }
+        if (chipPins != (int)names.size())
+        {
+            m_error = "the chip has more pins than its reference model";
+            return false;
+        }
+        return true;
+    }
+
+    // Sets the inputs of lane i to the number first + i: bits below 6 select
+    // the bit within a word, the next ones the word and the rest come from
+    // first, which is a multiple of LANES.
+    void setCounter(uint64_t first)
+    {
+        static const uint64_t patterns[6] = {0xAAAAAAAAAAAAAAAAull, 0xCCCCCCCCCCCCCCCCull, 0xF0F0F0F0F0F0F0F0ull,
+                                             0xFF00FF00FF00FF00ull, 0xFFFF0000FFFF0000ull, 0xFFFFFFFF00000000ull};
+
+        for (const auto &port : m_inputs)
+        {
+            for (size_t bit = 0; bit < port.wires.size(); bit++)
+            {
+                int position = port.shift + bit;
+                LaneSimulator::Lanes &lanes = m_simulator.wire(port.wires[bit]);
+                for (int word = 0; word < LaneSimulator::WORDS; word++)
+                {
+                    uint64_t number = first + word * 64;
+                    lanes[word] = position < 6 ? patterns[position] : (number >> position) & 1 ? ~0ull : 0;
+                }
+            }
+        }
+    }
+
+    // Sets the inputs from the per-lane values in m_in.
+    void setRandom(uint64_t block[64])
+    {
+        for (int word = 0; word < LaneSimulator::WORDS; word++)
+        {
+            for (size_t pin = 0; pin < m_inputs.size(); pin++)
+            {
+                for (int lane = 0; lane < 64; lane++)
+                {
+                    block[lane] = m_in[word * 64 + lane][pin];
+                }
+                LaneSimulator::transpose(block);
+                for (size_t bit = 0; bit < m_inputs[pin].wires.size(); bit++)
+                {
+                    m_simulator.wire(m_inputs[pin].wires[bit])[word] = block[bit];
+                }
+            }
+        }
+    }
+
+    bool check(const int *in, const int *actual)
+    {
+        int expected[MAX_PINS];
+        m_model.compute(in, expected);
+
+        bool matches = true;
+        for (size_t pin = 0; pin < m_outputs.size(); pin++)
+        {
+            expected[pin] &= m_outputs[pin].mask();
+            matches = matches && expected[pin] == actual[pin];
+        }
+        if (matches)
+        {
+            return true;
+        }
+
+        m_error = "for";
+        for (size_t pin = 0; pin < m_inputs.size(); pin++)
+        {
+            m_error += " " + m_inputs[pin].name + "=" + to_string(in[pin]);
+        }
+        m_error += " expected";
+        for (size_t pin = 0; pin < m_outputs.size(); pin++)
+        {
+            m_error += " " + m_outputs[pin].name + "=" + to_string(expected[pin]);
+        }
+        m_error += " but got";
+        for (size_t pin = 0; pin < m_outputs.size(); pin++)
+        {
+            m_error += " " + m_outputs[pin].name + "=" + to_string(actual[pin]);
+        }
+        return false;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    int maxExhaustiveBits = 24;
+    uint64_t samples = 1 << 24;
+    vector<string> libraries;
+    vector<string> chipPaths;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+
+        if (arg == "--bits" && i + 1 < argc)
+        {
+            maxExhaustiveBits = min(48, stoi(argv[++i]));
+        }
+        else if (arg == "--samples" && i + 1 < argc)
+        {
+            samples = max(1ull, stoull(argv[++i]));
+        }
+        else if (arg == "--lib" && i + 1 < argc)
+        {
+            libraries.push_back(argv[++i]);
+        }
+        else
+        {
+            chipPaths.push_back(arg);
+        }
+    }
+
+    if (chipPaths.empty())
+    {
+        cout << "Invalid argument: specify path to .hdl file" << endl
+             << "Usage: chip-verify [--bits N] [--samples N] [--lib <directory>]... <file.hdl>..." << endl;
+        return -1;
+    }
+
+    int failures = 0;
+    for (const auto &chipPath : chipPaths)
+    {
+        filesystem::path path(chipPath);
+        string chipName = path.stem().string();
+        auto start = chrono::steady_clock::now();
+
+        HDLLibrary library;
+        library.addDirectory(path.parent_path().empty() ? "." : path.parent_path());
+        for (const auto &directory : libraries)
+        {
+            library.addDirectory(directory);
+        }
+
+        Netlist netlist;
+        auto model = models.find(chipName);
+        if (model == models.end())
+        {
+            cout << "FAIL " << chipPath << ": no reference model for " << chipName << endl;
+            failures++;
+            continue;
+        }
+        if (!netlist.build(library, chipName))
+        {
+            cout << "FAIL " << chipPath << ": " << netlist.error() << endl;
+            failures++;
+            continue;
+        }
+
+        ChipVerifier verifier(model->second, netlist);
+        if (!verifier.init())
+        {
+            cout << "FAIL " << chipPath << ": " << verifier.error() << endl;
+            failures++;
+            continue;
+        }
+
+        bool exhaustive = verifier.inputBits() <= maxExhaustiveBits;
+        uint64_t count = exhaustive ? 1ull << verifier.inputBits() : samples;
+        uint64_t random = 0x9E3779B97F4A7C15ull;
+        if (!verifier.verify(count, exhaustive, random))
+        {
+            cout << "FAIL " << chipPath << ": " << verifier.error() << endl;
+            failures++;
+            continue;
+        }
+
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        cout << "PASS " << chipPath << " (" << count << (exhaustive ? " inputs, all " : " random inputs of ")
+             << "2^" << verifier.inputBits() << ", in " << elapsed.count() * 1000 << " ms)" << endl;
+    }
+
+    return failures == 0 ? 0 : -1;
+}
@@ -0,0 +1,263 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <string>
+#include <map>
+#include <vector>
+#include "./hack-emulator.hpp"
+#include "./test-script.hpp"
+#include "../06/hack-code.hpp"
+
+using namespace std;
+
+// Runs the CPU emulator test scripts of projects 04 to 08 (and the Computer
+// chip tests of project 05, whose chip is the same Hack computer) against
+// HackCPU. --vcd writes the output-list variables to Script.vcd as they
+// change.
+
+class CPUTestScript : public TestScript
+{
+private:
+    HackCPU m_cpu;
+    bool m_loaded = false;
+    bool m_reset = false;
+
+public:
+    CPUTestScript(const string &scriptPath, bool waveform) : TestScript(scriptPath, "ticktock")
+    {
+        m_waveform = waveform;
+        m_cpu.reset();
+    }
+
+protected:
+    bool load(const string &filename) override
+    {
+        filesystem::path path = m_directory / filename;
+        string extension = path.extension().string();
+
+        if (extension == ".hdl" && path.stem() == "Computer")
+        {
+            return true;
+        }
+
+        if (filename.empty() || extension == ".vm" || filesystem::is_directory(path))
+        {
+            m_error = "VM emulator scripts are not supported";
+            return false;
+        }
+
+        if (extension == ".hdl")
+        {
+            m_error = "chip " + filename + " is not the Hack computer";
+            return false;
+        }
+
+        if (extension == ".asm")
+        {
+            vector<uint16_t> words;
+            if (!assemble(path.string(), words))
+            {
+                m_error = "cannot assemble " + filename;
+                return false;
+            }
+            m_cpu.load(words);
+        }
+        else if (!m_cpu.load(path.string()))
+        {
+            m_error = "cannot load " + filename;
+            return false;
+        }
+
+        m_loaded = true;
+        m_cpu.setPc(0);
+        m_cpu.setA(0);
+        m_cpu.setD(0);
+        return true;
+    }
+
+    // Executes instructions, one per clock cycle. A halted program keeps
+    // spinning in its end loop, which is accounted for without running it.
+    bool step(uint64_t cycles) override
+    {
+        if (!m_loaded)
+        {
+            m_error = "no program loaded";
+            return false;
+        }
+
+        // With reset set the instruction still executes, but the PC loads 0.
+        for (uint64_t done = 0; done < cycles;)
+        {
+            uint64_t stretch = m_reset ? 1 : cycles - done;
+            uint64_t steps = m_cpu.run(stretch);
+            if (steps < stretch && m_cpu.halted())
+            {
+                m_cpu.idle(stretch - steps);
+            }
+
+            if (m_reset)
+            {
+                m_cpu.setPc(0);
+            }
+            done += stretch;
+        }
+
+        return true;
+    }
+
+    // The Computer chip tests clock the CPU with tick and tock; the
+    // instruction executes on tick.
+    bool executeCommand(const vector<string> &args) override
+    {
+        if (args[0] == "ROM32K" && args.size() == 3 && args[1] == "load")
+        {
+            return load(args[2]);
+        }
+
+        if (args[0] == "tick")
+        {
+            m_tickPhase = true;
+            return step(1);
+        }
+
+        if (args[0] == "tock")
+        {
+            m_tickPhase = false;
+            m_time++;
+            return true;
+        }
+
+        return TestScript::executeCommand(args);
+    }
+
+    bool get(const string &name, int16_t &value) override
+    {
+        if (registerName(name) == "A")
+        {
+            value = m_cpu.a();
+        }
+        else if (registerName(name) == "D")
+        {
+            value = m_cpu.d();
+        }
+        else if (registerName(name) == "PC")
+        {
+            value = m_cpu.pc();
+        }
+        else if (name == "reset")
+        {
+            value = m_reset;
+        }
+        else if (address(name) >= 0)
+        {
+            value = m_cpu.ram()[address(name)];
+        }
+        else
+        {
+            m_error = "unknown variable " + name;
+            return false;
+        }
+
+        return true;
+    }
+
+    bool set(const string &name, int16_t value) override
+    {
+        if (registerName(name) == "A")
+        {
+            m_cpu.setA(value);
+        }
+        else if (registerName(name) == "D")
+        {
+            m_cpu.setD(value);
+        }
+        else if (registerName(name) == "PC")
+        {
+            m_cpu.setPc(value);
+        }
+        else if (name == "reset")
+        {
+            m_reset = value != 0;
+        }
+        else if (address(name) >= 0)
+        {
+            m_cpu.ram()[address(name)] = value;
+        }
+        else
+        {
+            m_error = "unknown variable " + name;
+            return false;
+        }
+
+        return true;
+    }
+
+private:
+    // Parses RAM[i] and RAM16K[i] addresses; returns -1 for other names.
+    static int address(const string &name)
+    {
+        for (const string prefix : {"RAM[", "RAM16K["})
+        {
+            if (name.compare(0, prefix.size(), prefix) == 0 && name.back() == ']')
+            {
+                string digits = name.substr(prefix.size(), name.size() - prefix.size() - 1);
+                if (!digits.empty() && digits.find_first_not_of("0123456789") == string::npos)
+                {
+                    return stoi(digits) & (HackCPU::RAM_SIZE - 1);
+                }
+            }
+        }
+
+        return -1;
+    }
+
+    // The Computer chip names its registers ARegister[], DRegister[] and
+    // PC[], with any index; the CPU emulator calls them A, D and PC.
+    static string registerName(const string &name)
+    {
+        string base = name.substr(0, name.find("["));
+        if (base != name && name.back() != ']')
+        {
+            return name;
+        }
+
+        if (base == "ARegister")
+        {
+            return "A";
+        }
+        if (base == "DRegister")
+        {
+            return "D";
+        }
+        return base;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    vector<string> scriptPaths;
+    bool waveform = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+
+        if (arg == "--vcd")
+        {
+            waveform = true;
+        }
+        else
+        {
+            scriptPaths.push_back(arg);
+        }
+    }
+
+    if (scriptPaths.empty())
+    {
+        cout << "Invalid argument: specify path to .tst file" << endl
+             << "Usage: cpu-test [--vcd] <file.tst>..." << endl;
+        return -1;
+    }
+
+    return runScripts<CPUTestScript>(scriptPaths, waveform);
+}
@@ -0,0 +1,114 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "./hack-emulator.hpp"
+
+using namespace std;
+
+void saveScreen(int16_t *ram, const string &filename)
+{
+    ofstream file(filename);
+    file << "P1" << endl
+         << "512 256" << endl;
+
+    for (int row = 0; row < 256; row++)
+    {
+        for (int col = 0; col < 512; col++)
+        {
+            int16_t word = ram[HackCPU::SCREEN + row * 32 + col / 16];
+            file << ((word >> (col % 16)) & 1);
+        }
+        file << endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t maxSteps = 100000000;
+    bool fusion = true;
+    string screenFilePath;
+    vector<pair<int, int>> ranges;
+    vector<pair<int, int>> values;
+    vector<string> paths;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+
+        if (arg == "--steps" && i + 1 < argc)
+        {
+            maxSteps = stoull(argv[++i]);
+        }
+        else if (arg == "--no-fuse")
+        {
+            fusion = false;
+        }
+        else if (arg == "--screen" && i + 1 < argc)
+        {
+            screenFilePath = argv[++i];
+        }
+        else if (arg == "--set" && i + 1 < argc)
+        {
+            string value = argv[++i];
+            auto equalsPos = value.find("=");
+            values.push_back({stoi(value.substr(0, equalsPos)), stoi(value.substr(equalsPos + 1))});
+        }
+        else if (arg == "--print" && i + 1 < argc)
+        {
+            string range = argv[++i];
+            auto dashPos = range.find("-");
+            int first = stoi(range.substr(0, dashPos));
+            int last = dashPos == string::npos ? first : stoi(range.substr(dashPos + 1));
+            ranges.push_back({first, last});
+        }
+        else
+        {
+            paths.push_back(arg);
+        }
+    }
+
+    if (paths.size() != 1)
+    {
+        cout << "Invalid argument: specify path to .hack file" << endl
+             << "Usage: hack-emulator [--steps N] [--no-fuse] [--set addr=value]... [--print addr[-addr]]... [--screen out.pbm] <file.hack>" << endl;
+        return -1;
+    }
+
+    HackCPU cpu;
+    if (!cpu.load(paths[0]))
+    {
+        return -1;
+    }
+
+    cpu.enableFusion(fusion);
+    cpu.reset();
+    int16_t *ram = cpu.ram();
+    for (const auto &[address, value] : values)
+    {
+        ram[address & (HackCPU::RAM_SIZE - 1)] = value;
+    }
+
+    auto start = chrono::steady_clock::now();
+    uint64_t steps = cpu.run(maxSteps);
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    cout << (cpu.halted() ? "Halted" : "Stopped") << " after " << steps << " instructions in "
+         << elapsed.count() * 1000 << " ms (" << steps / elapsed.count() / 1e6 << " M instructions/s)" << endl;
+
+    for (const auto &[first, last] : ranges)
+    {
+        for (int address = first; address <= last && address < HackCPU::RAM_SIZE; address++)
+        {
+            cout << "RAM[" << address << "] = " << ram[address] << endl;
+        }
+    }
+
+    if (!screenFilePath.empty())
+    {
+        saveScreen(ram, screenFilePath);
+    }
+
+    return 0;
+}
@@ -0,0 +1,768 @@
+#ifndef HACK_EMULATOR_HPP
+#define HACK_EMULATOR_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Micro-op kinds. A C-instruction's comp bits are decoded to the one handler
+// computing that ALU function, with separate handlers for the A and M forms,
+// so executing it needs no further decoding. Comp bits outside the standard
+// table fall back to evaluating the ALU control bits. H_WRAP sits after the
+// last ROM word and sends the program counter back to 0.
+//
+// The kinds after H_WRAP are superinstructions: each executes a whole
+// straight-line idiom of the VM translator's output, named after the VM
+// operation it implements, in one dispatch.
+enum HackOp : uint8_t
+{
+    H_LOAD,
+    H_HALT,
+    H_ZERO,
+    H_ONE,
+    H_MINUS_ONE,
+    H_D,
+    H_NOT_D,
+    H_NEG_D,
+    H_D_PLUS_ONE,
+    H_D_MINUS_ONE,
+    H_A,
+    H_NOT_A,
+    H_NEG_A,
+    H_A_PLUS_ONE,
+    H_A_MINUS_ONE,
+    H_D_PLUS_A,
+    H_D_MINUS_A,
+    H_A_MINUS_D,
+    H_D_AND_A,
+    H_D_OR_A,
+    H_M,
+    H_NOT_M,
+    H_NEG_M,
+    H_M_PLUS_ONE,
+    H_M_MINUS_ONE,
+    H_D_PLUS_M,
+    H_D_MINUS_M,
+    H_M_MINUS_D,
+    H_D_AND_M,
+    H_D_OR_M,
+    H_ALU_A,
+    H_ALU_M,
+    H_WRAP,
+    H_PUSH_D,
+    H_POP_D,
+    H_CONST_D,
+    H_LOAD_D,
+    H_PUSH_CONST,
+    H_PUSH_LOAD,
+    H_PUSH_SEGMENT,
+    H_POP_STORE,
+    H_POP_SEGMENT,
+    H_ADD,
+    H_SUB,
+    H_AND,
+    H_OR,
+    H_NOT,
+    H_NEG,
+    H_COMPARE,
+    H_IF_GOTO,
+    H_GOTO,
+    H_SET_ADDRESS_PLUS,
+    H_SET_ADDRESS_MINUS,
+    H_SET_DATA_PLUS,
+    H_SET_DATA_MINUS,
+    H_JUMP_INDIRECT
+};
+
+// One pre-decoded ROM word. `dest` and `jump` are the instruction's dest and
+// jump fields; `value` is the constant of an A-instruction or the raw comp
+// bits for the generic ALU handlers.
+struct MicroOp
+{
+    HackOp op;
+    uint8_t dest;
+    uint8_t jump;
+    uint16_t value;
+};
+
+// Executes .hack programs on a Hack computer: 32K words of ROM, and RAM with
+// the screen memory map at SCREEN and the keyboard register at KBD. Every ROM
+// word is decoded once when the program is loaded.
+//
+// Loading also builds a second, fused copy of the decoded ROM in which every
+// address starting one of the translator's idioms holds the matching
+// superinstruction instead. Only the kind of that first micro-op changes: the
+// handlers read their constants from the plain micro-ops that follow, and a
+// jump into the middle of an idiom simply runs those plain micro-ops.
+class HackCPU
+{
+public:
+    static const int ROM_SIZE = 32768;
+    static const int RAM_SIZE = 32768;
+    static const int SCREEN = 16384;
+    static const int KBD = 24576;
+
+    enum Dest
+    {
+        DEST_M = 1,
+        DEST_D = 2,
+        DEST_A = 4
+    };
+
+private:
+    // Longest idiom, in instructions. Fused code runs while at least this
+    // many steps remain, so a superinstruction never overshoots maxSteps.
+    static const int MAX_FUSED = 12;
+
+    vector<MicroOp> m_rom = vector<MicroOp>(ROM_SIZE + 1, {H_LOAD, 0, 0, 0});
+    vector<MicroOp> m_fused = vector<MicroOp>(ROM_SIZE + 1, {H_LOAD, 0, 0, 0});
+    bool m_fusion = true;
+    vector<int16_t> m_ram = vector<int16_t>(RAM_SIZE);
+    int16_t m_a = 0;
+    int16_t m_d = 0;
+    uint16_t m_pc = 0;
+
+public:
+    // Loads a .hack file of 16-character binary words. Unused ROM holds
+    // zeros, i.e. @0, as on the real computer.
+    bool load(const string &filename)
+    {
+        ifstream file(filename);
+        if (!file)
+        {
+            cerr << "Error: cannot open " << filename << endl;
+            return false;
+        }
+
+        vector<uint16_t> words;
+        string line;
+        int lineNumber = 0;
+
+        while (getline(file, line))
+        {
+            lineNumber++;
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (line.empty())
+            {
+                continue;
+            }
+
+            if (line.size() != 16 || line.find_first_not_of("01") != string::npos)
+            {
+                cerr << "Error: invalid instruction " << line << " at line " << lineNumber << " of " << filename << endl;
+                return false;
+            }
+
+            if (words.size() == ROM_SIZE)
+            {
+                cerr << "Error: " << filename << " does not fit in ROM" << endl;
+                return false;
+            }
+
+            words.push_back(stoi(line, nullptr, 2));
+        }
+
+        load(words);
+        return true;
+    }
+
+    // Loads already assembled words, at most ROM_SIZE of them.
+    void load(const vector<uint16_t> &words)
+    {
+        fill(m_rom.begin(), m_rom.end(), MicroOp{H_LOAD, 0, 0, 0});
+        m_rom[ROM_SIZE].op = H_WRAP;
+        for (size_t i = 0; i < words.size(); i++)
+        {
+            m_rom[i] = decode(words[i]);
+
+            // `@i` followed by `0;JMP` is the idiom for ending a program.
+            if (i + 1 < words.size() && words[i] == i && words[i + 1] == 0b1110101010000111)
+            {
+                m_rom[i].op = H_HALT;
+            }
+        }
+
+        fuse(words);
+    }
+
+    // Superinstructions are on by default; running without them gives the
+    // same results one instruction per dispatch.
+    void enableFusion(bool enabled)
+    {
+        m_fusion = enabled;
+    }
+
+    void reset()
+    {
+        fill(m_ram.begin(), m_ram.end(), 0);
+        m_a = 0;
+        m_d = 0;
+        m_pc = 0;
+    }
+
+    // Runs until the program reaches its end loop or maxSteps instructions
+    // have been executed, and returns the number of instructions executed.
+    // Dispatch is a computed goto over the micro-op kind; every ALU handler
+    // then shares the code writing the result and taking the jump. Each
+    // handler counts the instructions it executed. Once fewer than MAX_FUSED
+    // steps remain, execution moves over to the plain ROM at the same
+    // address to finish exactly on maxSteps.
+    uint64_t run(uint64_t maxSteps)
+    {
+        static const void *dispatch[] = {
+            &&load, &&halt, &&zero, &&one, &&minus_one, &&d_, &&not_d, &&neg_d, &&d_plus_one, &&d_minus_one,
+            &&a_, &&not_a, &&neg_a, &&a_plus_one, &&a_minus_one, &&d_plus_a, &&d_minus_a, &&a_minus_d, &&d_and_a, &&d_or_a,
+            &&m_, &&not_m, &&neg_m, &&m_plus_one, &&m_minus_one, &&d_plus_m, &&d_minus_m, &&m_minus_d, &&d_and_m, &&d_or_m,
+            &&alu_a, &&alu_m, &&wrap,
+            &&push_d, &&pop_d, &&const_d, &&load_d, &&push_const, &&push_load, &&push_segment, &&pop_store, &&pop_segment,
+            &&add, &&sub, &&and_, &&or_, &&not_, &&neg, &&compare, &&if_goto, &&goto_,
+            &&set_address_plus, &&set_address_minus, &&set_data_plus, &&set_data_minus, &&jump_indirect};
+
+        const MicroOp *rom = m_fusion ? m_fused.data() : m_rom.data();
+        int16_t *ram = m_ram.data();
+        const MicroOp *op = rom + m_pc;
+        int16_t a = m_a;
+        int16_t d = m_d;
+        int16_t out = 0;
+        uint64_t steps = 0;
+        uint64_t limit = !m_fusion ? maxSteps : maxSteps > MAX_FUSED ? maxSteps - MAX_FUSED : 0;
+
+#define RAM(address) ram[(uint16_t)(address) & 0x7FFF]
+#define M RAM(a)
+#define CONDITION(value) ((value) < 0 ? 4 : (value) == 0 ? 2 : 1)
+#define DISPATCH()              \
+    do                          \
+    {                           \
+        if (steps >= limit)     \
+            goto budget;        \
+        goto *dispatch[op->op]; \
+    } while (0)
+#define NEXT(count)      \
+    op += count;         \
+    steps += count;      \
+    DISPATCH()
+#define COMPUTE(expr)        \
+    out = (int16_t)(expr);   \
+    goto writeback
+#define PUSH_D()                           \
+    a = ram[0] = (int16_t)(ram[0] + 1);    \
+    a = (int16_t)(a - 1);                  \
+    M = d
+#define POP_D()                            \
+    a = ram[0] = (int16_t)(ram[0] - 1);    \
+    d = M
+
+        DISPATCH();
+
+    load:
+        a = op->value;
+        NEXT(1);
+
+    zero:
+        COMPUTE(0);
+    one:
+        COMPUTE(1);
+    minus_one:
+        COMPUTE(-1);
+    d_:
+        COMPUTE(d);
+    not_d:
+        COMPUTE(~d);
+    neg_d:
+        COMPUTE(-d);
+    d_plus_one:
+        COMPUTE(d + 1);
+    d_minus_one:
+        COMPUTE(d - 1);
+    a_:
+        COMPUTE(a);
+    not_a:
+        COMPUTE(~a);
+    neg_a:
+        COMPUTE(-a);
+    a_plus_one:
+        COMPUTE(a + 1);
+    a_minus_one:
+        COMPUTE(a - 1);
+    d_plus_a:
+        COMPUTE(d + a);
+    d_minus_a:
+        COMPUTE(d - a);
+    a_minus_d:
+        COMPUTE(a - d);
+    d_and_a:
+        COMPUTE(d & a);
+    d_or_a:
+        COMPUTE(d | a);
+    m_:
+        COMPUTE(M);
+    not_m:
+        COMPUTE(~M);
+    neg_m:
+        COMPUTE(-M);
+    m_plus_one:
+        COMPUTE(M + 1);
+    m_minus_one:
+        COMPUTE(M - 1);
+    d_plus_m:
+        COMPUTE(d + M);
+    d_minus_m:
+        COMPUTE(d - M);
+    m_minus_d:
+        COMPUTE(M - d);
+    d_and_m:
+        COMPUTE(d & M);
+    d_or_m:
+        COMPUTE(d | M);
+    alu_a:
+        COMPUTE(alu(op->value, d, a));
+    alu_m:
+        COMPUTE(alu(op->value, d, M));
+
+    writeback:
+    {
+        // M and the jump target use A from before this instruction.
+        int16_t target = a;
+        if (op->dest & DEST_M)
+        {
+            M = out;
+        }
+        if (op->dest & DEST_D)
+        {
+            d = out;
+        }
+        if (op->dest & DEST_A)
+        {
+            a = out;
+        }
+
+        steps++;
+        if (op->jump & CONDITION(out))
+        {
+            op = rom + ((uint16_t)target & 0x7FFF);
+        }
+        else
+        {
+            op++;
+        }
+        DISPATCH();
+    }
+
+    wrap:
+        op = rom;
+        DISPATCH();
+
+        // @SP, AM=M+1, A=A-1, M=D
+    push_d:
+        PUSH_D();
+        NEXT(4);
+
+        // @SP, AM=M-1, D=M
+    pop_d:
+        POP_D();
+        NEXT(3);
+
+        // @n, D=A
+    const_d:
+        a = d = op->value;
+        NEXT(2);
+
+        // @n, D=M
+    load_d:
+        a = op->value;
+        d = M;
+        NEXT(2);
+
+        // @n, D=A, push D
+    push_const:
+        a = d = op->value;
+        PUSH_D();
+        NEXT(6);
+
+        // @n, D=M, push D
+    push_load:
+        a = op->value;
+        d = M;
+        PUSH_D();
+        NEXT(6);
+
+        // @i, D=A, @segment, A=D+M, D=M, push D
+    push_segment:
+        a = d = op[0].value;
+        a = op[2].value;
+        a = (int16_t)(d + M);
+        d = M;
+        PUSH_D();
+        NEXT(9);
+
+        // pop D, @n, M=D
+    pop_store:
+        POP_D();
+        a = op[3].value;
+        M = d;
+        NEXT(5);
+
+        // @i, D=A, @segment, D=D+M, @t, M=D, pop D, @t, A=M, M=D
+    pop_segment:
+        a = d = op[0].value;
+        a = op[2].value;
+        d = (int16_t)(d + M);
+        a = op[4].value;
+        M = d;
+        POP_D();
+        a = op[9].value;
+        a = M;
+        M = d;
+        NEXT(12);
+
+        // pop D, A=A-1, M=D+M (and likewise M=M-D, M=D&M, M=D|M)
+    add:
+        POP_D();
+        a = (int16_t)(a - 1);
+        M = (int16_t)(d + M);
+        NEXT(5);
+    sub:
+        POP_D();
+        a = (int16_t)(a - 1);
+        M = (int16_t)(M - d);
+        NEXT(5);
+    and_:
+        POP_D();
+        a = (int16_t)(a - 1);
+        M = d & M;
+        NEXT(5);
+    or_:
+        POP_D();
+        a = (int16_t)(a - 1);
+        M = d | M;
+        NEXT(5);
+
+        // @SP, A=M-1, M=!M (and likewise M=-M)
+    not_:
+        a = (int16_t)(ram[0] - 1);
+        M = ~M;
+        NEXT(3);
+    neg:
+        a = (int16_t)(ram[0] - 1);
+        M = (int16_t)-M;
+        NEXT(3);
+
+        // pop D, A=A-1, D=M-D, M=0, @label, D;Jxx, @SP, A=M-1, M=-1
+    compare:
+        POP_D();
+        a = (int16_t)(a - 1);
+        d = (int16_t)(M - d);
+        M = 0;
+        a = op[6].value;
+        if (op[7].jump & CONDITION(d))
+        {
+            op = rom + a;
+            steps += 8;
+            DISPATCH();
+        }
+        a = (int16_t)(ram[0] - 1);
+        M = -1;
+        NEXT(11);
+
+        // pop D, @label, D;JNE
+    if_goto:
+        POP_D();
+        a = op[3].value;
+        if (op[4].jump & CONDITION(d))
+        {
+            op = rom + a;
+            steps += 5;
+            DISPATCH();
+        }
+        NEXT(5);
+
+        // @label, 0;JMP
+    goto_:
+        a = op->value;
+        op = rom + a;
+        steps += 2;
+        DISPATCH();
+
+        // @k, D=A, @address, D=D+M, @dest, M=D (and likewise D=M-D)
+    set_address_plus:
+        a = d = op[0].value;
+        a = op[2].value;
+        d = (int16_t)(d + M);
+        a = op[4].value;
+        M = d;
+        NEXT(6);
+    set_address_minus:
+        a = d = op[0].value;
+        a = op[2].value;
+        d = (int16_t)(M - d);
+        a = op[4].value;
+        M = d;
+        NEXT(6);
+
+        // @k, D=A, @address, A=D+M, D=M, @dest, M=D (and likewise A=M-D)
+    set_data_plus:
+        a = d = op[0].value;
+        a = op[2].value;
+        a = (int16_t)(d + M);
+        d = M;
+        a = op[5].value;
+        M = d;
+        NEXT(7);
+    set_data_minus:
+        a = d = op[0].value;
+        a = op[2].value;
+        a = (int16_t)(M - d);
+        d = M;
+        a = op[5].value;
+        M = d;
+        NEXT(7);
+
+        // @n, A=M, 0;JMP
+    jump_indirect:
+        a = op->value;
+        a = M;
+        op = rom + ((uint16_t)a & 0x7FFF);
+        steps += 3;
+        DISPATCH();
+
+    budget:
+        if (rom != m_rom.data())
+        {
+            op = m_rom.data() + (op - rom);
+            rom = m_rom.data();
+            limit = maxSteps;
+            DISPATCH();
+        }
+        goto stop;
+
+    halt:
+    stop:
+#undef POP_D
+#undef PUSH_D
+#undef COMPUTE
+#undef NEXT
+#undef DISPATCH
+#undef CONDITION
+#undef M
+#undef RAM
+        m_pc = op - rom;
+        m_a = a;
+        m_d = d;
+        return steps;
+    }
+
+    bool halted() const
+    {
+        return m_rom[m_pc].op == H_HALT;
+    }
+
+    // Advances a halted program by the given number of instructions of its
+    // `@i`, `0;JMP` end loop without executing them.
+    void idle(uint64_t steps)
+    {
+        if (steps > 0)
+        {
+            m_a = m_pc;
+            m_pc += steps % 2;
+        }
+    }
+
+    int16_t *ram()
+    {
+        return m_ram.data();
+    }
+
+    uint16_t pc() const
+    {
+        return m_pc;
+    }
+
+    int16_t a() const
+    {
+        return m_a;
+    }
+
+    int16_t d() const
+    {
+        return m_d;
+    }
+
+    void setPc(uint16_t pc)
+    {
+        m_pc = pc & (ROM_SIZE - 1);
+    }
+
+    void setA(int16_t a)
+    {
+        m_a = a;
+    }
+
+    void setD(int16_t d)
+    {
+        m_d = d;
+    }
+
+private:
+    // C-instructions appearing in the translator's idioms.
+    static const uint16_t D_A = 0b1110110000010000;
+    static const uint16_t D_M = 0b1111110000010000;
+    static const uint16_t A_M = 0b1111110000100000;
+    static const uint16_t M_D = 0b1110001100001000;
+    static const uint16_t AM_M_PLUS_ONE = 0b1111110111101000;
+    static const uint16_t AM_M_MINUS_ONE = 0b1111110010101000;
+    static const uint16_t A_A_MINUS_ONE = 0b1110110010100000;
+    static const uint16_t A_M_MINUS_ONE = 0b1111110010100000;
+    static const uint16_t A_D_PLUS_M = 0b1111000010100000;
+    static const uint16_t A_M_MINUS_D = 0b1111000111100000;
+    static const uint16_t D_D_PLUS_M = 0b1111000010010000;
+    static const uint16_t D_M_MINUS_D = 0b1111000111010000;
+    static const uint16_t M_D_PLUS_M = 0b1111000010001000;
+    static const uint16_t M_M_MINUS_D = 0b1111000111001000;
+    static const uint16_t M_D_AND_M = 0b1111000000001000;
+    static const uint16_t M_D_OR_M = 0b1111010101001000;
+    static const uint16_t M_NOT_M = 0b1111110001001000;
+    static const uint16_t M_NEG_M = 0b1111110011001000;
+    static const uint16_t M_ZERO = 0b1110101010001000;
+    static const uint16_t M_MINUS_ONE = 0b1110111010001000;
+    static const uint16_t D_JNE = 0b1110001100000101;
+    static const uint16_t D_JLE = 0b1110001100000110;
+    static const uint16_t D_JGE = 0b1110001100000011;
+    static const uint16_t JMP = 0b1110101010000111;
+
+    // Marks a pattern position matching any A-instruction.
+    static const int ANY_A = -1;
+
+    // Fills m_fused from the decoded ROM, trying the longest idioms first at
+    // every address. Idioms may overlap; a superinstruction only replaces the
+    // kind of the micro-op its idiom starts at.
+    void fuse(const vector<uint16_t> &words)
+    {
+        static const vector<pair<HackOp, vector<int>>> patterns = [] {
+            vector<pair<HackOp, vector<int>>> result = {
+                {H_PUSH_D, {0, AM_M_PLUS_ONE, A_A_MINUS_ONE, M_D}},
+                {H_POP_D, {0, AM_M_MINUS_ONE, D_M}},
+                {H_CONST_D, {ANY_A, D_A}},
+                {H_LOAD_D, {ANY_A, D_M}},
+                {H_PUSH_CONST, {ANY_A, D_A, 0, AM_M_PLUS_ONE, A_A_MINUS_ONE, M_D}},
+                {H_PUSH_LOAD, {ANY_A, D_M, 0, AM_M_PLUS_ONE, A_A_MINUS_ONE, M_D}},
+                {H_PUSH_SEGMENT, {ANY_A, D_A, ANY_A, A_D_PLUS_M, D_M, 0, AM_M_PLUS_ONE, A_A_MINUS_ONE, M_D}},
+                {H_POP_STORE, {0, AM_M_MINUS_ONE, D_M, ANY_A, M_D}},
+                {H_POP_SEGMENT, {ANY_A, D_A, ANY_A, D_D_PLUS_M, ANY_A, M_D, 0, AM_M_MINUS_ONE, D_M, ANY_A, A_M, M_D}},
+                {H_ADD, {0, AM_M_MINUS_ONE, D_M, A_A_MINUS_ONE, M_D_PLUS_M}},
+                {H_SUB, {0, AM_M_MINUS_ONE, D_M, A_A_MINUS_ONE, M_M_MINUS_D}},
+                {H_AND, {0, AM_M_MINUS_ONE, D_M, A_A_MINUS_ONE, M_D_AND_M}},
+                {H_OR, {0, AM_M_MINUS_ONE, D_M, A_A_MINUS_ONE, M_D_OR_M}},
+                {H_NOT, {0, A_M_MINUS_ONE, M_NOT_M}},
+                {H_NEG, {0, A_M_MINUS_ONE, M_NEG_M}},
+                {H_IF_GOTO, {0, AM_M_MINUS_ONE, D_M, ANY_A, D_JNE}},
+                {H_GOTO, {ANY_A, JMP}},
+                {H_SET_ADDRESS_PLUS, {ANY_A, D_A, ANY_A, D_D_PLUS_M, ANY_A, M_D}},
+                {H_SET_ADDRESS_MINUS, {ANY_A, D_A, ANY_A, D_M_MINUS_D, ANY_A, M_D}},
+                {H_SET_DATA_PLUS, {ANY_A, D_A, ANY_A, A_D_PLUS_M, D_M, ANY_A, M_D}},
+                {H_SET_DATA_MINUS, {ANY_A, D_A, ANY_A, A_M_MINUS_D, D_M, ANY_A, M_D}},
+                {H_JUMP_INDIRECT, {ANY_A, A_M, JMP}}};
+
+            // eq, gt and lt differ only in the jump skipping the true case.
+            for (int jump : {D_JNE, D_JLE, D_JGE})
+            {
+                result.push_back({H_COMPARE, {0, AM_M_MINUS_ONE, D_M, A_A_MINUS_ONE, D_M_MINUS_D, M_ZERO, ANY_A, jump, 0, A_M_MINUS_ONE, M_MINUS_ONE}});
+            }
+
+            stable_sort(result.begin(), result.end(), [](const auto &x, const auto &y)
+                        { return x.second.size() > y.second.size(); });
+            return result;
+        }();
+
+        m_fused = m_rom;
+        for (size_t i = 0; i < words.size(); i++)
+        {
+            if (m_rom[i].op == H_HALT)
+            {
+                continue;
+            }
+
+            for (const auto &[kind, pattern] : patterns)
+            {
+                if (matches(words, i, pattern))
+                {
+                    m_fused[i].op = kind;
+                    break;
+                }
+            }
+        }
+    }
+
+    static bool matches(const vector<uint16_t> &words, size_t start, const vector<int> &pattern)
+    {
+        if (start + pattern.size() > words.size())
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < pattern.size(); i++)
+        {
+            uint16_t word = words[start + i];
+            if (pattern[i] == ANY_A ? (word & 0x8000) != 0 : word != pattern[i])
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    static MicroOp decode(uint16_t word)
+    {
+        if ((word & 0x8000) == 0)
+        {
+            return {H_LOAD, 0, 0, word};
+        }
+
+        // Handlers for comps that do not depend on A or M, and for those
+        // that do, in the order of the A forms.
+        static const vector<pair<uint16_t, HackOp>> constant = {
+            {0b101010, H_ZERO}, {0b111111, H_ONE}, {0b111010, H_MINUS_ONE}, {0b001100, H_D}, {0b001101, H_NOT_D}, {0b001111, H_NEG_D}, {0b011111, H_D_PLUS_ONE}, {0b001110, H_D_MINUS_ONE}};
+        static const vector<uint16_t> operand = {
+            0b110000, 0b110001, 0b110011, 0b110111, 0b110010, 0b000010, 0b010011, 0b000111, 0b000000, 0b010101};
+
+        uint16_t comp = (word >> 6) & 0x3F;
+        bool useM = word & 0x1000;
+        MicroOp op = {useM ? H_ALU_M : H_ALU_A, (uint8_t)((word >> 3) & 7), (uint8_t)(word & 7), comp};
+
+        for (const auto &[bits, kind] : constant)
+        {
+            if (comp == bits)
+            {
+                op.op = kind;
+            }
+        }
+
+        for (size_t i = 0; i < operand.size(); i++)
+        {
+            if (comp == operand[i])
+            {
+                op.op = (HackOp)((useM ? H_M : H_A) + i);
+            }
+        }
+
+        return op;
+    }
+
+    // The Hack ALU for arbitrary control bits zx, nx, zy, ny, f and no.
+    static int16_t alu(uint16_t comp, int16_t x, int16_t y)
+    {
+        x = comp & 0x20 ? 0 : x;
+        x = comp & 0x10 ? ~x : x;
+        y = comp & 0x08 ? 0 : y;
+        y = comp & 0x04 ? ~y : y;
+        int16_t out = comp & 0x02 ? x + y : x & y;
+        return comp & 0x01 ? ~out : out;
+    }
+};
+
+#endif
@@ -0,0 +1,417 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include "./hdl-simulator.hpp"
+
+using namespace std;
+
+// Flattens a chip to Nand gates and reports what it costs: the Nand and DFF
+// counts, the logic depth of every output in Nands, the critical
+// combinational path with the parts it runs through, and the share of each
+// part. A path starts at an input pin, a DFF, a memory or a constant and
+// ends at an output pin or at the inputs a DFF or memory samples on the
+// clock; a builtin memory's read adds no depth.
+//
+// --depth N lists parts N levels deep in the part table, 1 by default, and
+// shows the critical path through parts one level deeper.
+
+class ChipAnalyzer
+{
+private:
+    const Netlist &m_netlist;
+    vector<uint32_t> m_depth;
+    vector<int64_t> m_cause;
+    vector<int32_t> m_gate;
+    vector<string> m_sourceNames;
+
+    vector<uint64_t> m_partGates;
+    vector<uint64_t> m_partFlops;
+    vector<uint64_t> m_partPathGates;
+    vector<vector<uint32_t>> m_children;
+
+public:
+    ChipAnalyzer(const Netlist &netlist) : m_netlist(netlist)
+    {
+        m_depth.assign(netlist.wireCount(), 0);
+        m_cause.assign(netlist.wireCount(), -1);
+        m_gate.assign(netlist.wireCount(), -1);
+        m_sourceNames.assign(netlist.wireCount(), "");
+    }
+
+    void analyze()
+    {
+        nameSources();
+        computeDepths();
+        countParts();
+    }
+
+    void report(int tableDepth)
+    {
+        const auto &parts = m_netlist.parts();
+        cout << parts[0].chip << ": " << m_netlist.gates().size() << " Nands, " << m_netlist.flops().size() << " DFFs";
+        if (!m_netlist.memories().empty())
+        {
+            cout << ", memories";
+            for (const auto &memory : m_netlist.memories())
+            {
+                cout << " " << memory.name;
+            }
+        }
+        cout << endl;
+
+        reportOutputs();
+        reportCriticalPath(tableDepth + 1);
+        reportParts(tableDepth);
+    }
+
+private:
+    static string bitName(const string &name, size_t width, size_t bit)
+    {
+        return width == 1 ? name : name + "[" + to_string(bit) + "]";
+    }
+
+    void nameSources()
+    {
+        m_sourceNames[Netlist::FALSE_WIRE] = "false";
+        m_sourceNames[Netlist::TRUE_WIRE] = "true";
+        for (const auto &[name, pin] : m_netlist.pins())
+        {
+            if (pin.kind == Netlist::INPUT)
+            {
+                for (size_t bit = 0; bit < pin.wires.size(); bit++)
+                {
+                    m_sourceNames[pin.wires[bit]] = bitName(name, pin.wires.size(), bit);
+                }
+            }
+        }
+        for (size_t i = 0; i < m_netlist.flops().size(); i++)
+        {
+            m_sourceNames[m_netlist.flops()[i].out] = "DFF out " + partPath(m_netlist.flopParts()[i]);
+        }
+    }
+
+    // The longest path to each wire, in the order the simulator evaluates:
+    // a level's gates, then its memory reads.
+    void computeDepths()
+    {
+        const auto &gates = m_netlist.gates();
+        const auto &levelStart = m_netlist.levelStart();
+        const auto &memories = m_netlist.memories();
+        const auto &memoryLevelStart = m_netlist.memoryLevelStart();
+
+        for (size_t level = 0; level < m_netlist.levelCount(); level++)
+        {
+            for (uint32_t i = levelStart[level]; i < levelStart[level + 1]; i++)
+            {
+                const auto &gate = gates[i];
+                uint32_t deeper = m_depth[gate.a] >= m_depth[gate.b] ? gate.a : gate.b;
+                m_depth[gate.out] = m_depth[deeper] + 1;
+                m_cause[gate.out] = deeper;
+                m_gate[gate.out] = i;
+            }
+
+            for (uint32_t i = memoryLevelStart[level]; i < memoryLevelStart[level + 1]; i++)
+            {
+                int64_t deepest = -1;
+                for (auto wire : memories[i].address)
+                {
+                    deepest = deepest < 0 || m_depth[wire] > m_depth[deepest] ? wire : deepest;
+                }
+                for (auto wire : memories[i].out)
+                {
+                    m_depth[wire] = deepest < 0 ? 0 : m_depth[deepest];
+                    m_cause[wire] = deepest;
+                    m_sourceNames[wire] = memories[i].name + " out";
+                }
+            }
+        }
+    }
+
+    // Nands, DFFs and critical path Nands per part, including its own parts.
+    // A part comes after its parent, so a reverse pass accumulates them.
+    void countParts()
+    {
+        const auto &parts = m_netlist.parts();
+        m_partGates.assign(parts.size(), 0);
+        m_partFlops.assign(parts.size(), 0);
+        m_partPathGates.assign(parts.size(), 0);
+        m_children.assign(parts.size(), {});
+
+        for (auto part : m_netlist.gateParts())
+        {
+            m_partGates[part]++;
+        }
+        for (auto part : m_netlist.flopParts())
+        {
+            m_partFlops[part]++;
+        }
+        for (auto wire : criticalPath())
+        {
+            if (m_gate[wire] >= 0)
+            {
+                m_partPathGates[m_netlist.gateParts()[m_gate[wire]]]++;
+            }
+        }
+
+        for (size_t part = parts.size(); part-- > 1;)
+        {
+            uint32_t parent = parts[part].parent;
+            m_partGates[parent] += m_partGates[part];
+            m_partFlops[parent] += m_partFlops[part];
+            m_partPathGates[parent] += m_partPathGates[part];
+        }
+        for (size_t part = 1; part < parts.size(); part++)
+        {
+            m_children[parts[part].parent].push_back(part);
+        }
+    }
+
+    // The ends of combinational paths, named.
+    vector<pair<uint32_t, string>> sinks() const
+    {
+        vector<pair<uint32_t, string>> result;
+        for (const auto &[name, pin] : m_netlist.pins())
+        {
+            if (pin.kind == Netlist::OUTPUT)
+            {
+                for (size_t bit = 0; bit < pin.wires.size(); bit++)
+                {
+                    result.push_back({pin.wires[bit], bitName(name, pin.wires.size(), bit)});
+                }
+            }
+        }
+        for (size_t i = 0; i < m_netlist.flops().size(); i++)
+        {
+            result.push_back({m_netlist.flops()[i].in, "DFF in " + partPath(m_netlist.flopParts()[i])});
+        }
+        for (const auto &memory : m_netlist.memories())
+        {
+            for (const auto &[pinName, bus] : {make_pair("in", memory.in), make_pair("address", memory.address)})
+            {
+                for (size_t bit = 0; bit < bus.size(); bit++)
+                {
+                    result.push_back({bus[bit], memory.name + " " + bitName(pinName, bus.size(), bit)});
+                }
+            }
+            if (memory.kind == HDLChip::RAM)
+            {
+                result.push_back({memory.load, memory.name + " load"});
+            }
+        }
+        return result;
+    }
+
+    pair<uint32_t, string> deepestSink() const
+    {
+        pair<uint32_t, string> deepest = {Netlist::FALSE_WIRE, "nothing"};
+        for (const auto &sink : sinks())
+        {
+            if (m_depth[sink.first] > m_depth[deepest.first] || deepest.second == "nothing")
+            {
+                deepest = sink;
+            }
+        }
+        return deepest;
+    }
+
+    // The wires of the critical path, from its source to its end.
+    vector<uint32_t> criticalPath() const
+    {
+        vector<uint32_t> path;
+        for (int64_t wire = deepestSink().first; wire >= 0; wire = m_cause[wire])
+        {
+            path.push_back(wire);
+        }
+        reverse(path.begin(), path.end());
+        return path;
+    }
+
+    // Chip > Part > ... > Part, each part with the line declaring it.
+    string partPath(uint32_t part) const
+    {
+        const auto &parts = m_netlist.parts();
+        string path;
+        for (; parts[part].parent != Netlist::NO_PART; part = parts[part].parent)
+        {
+            path = " > " + parts[part].chip + ":" + to_string(parts[part].line) + path;
+        }
+        return parts[part].chip + path;
+    }
+
+    void reportOutputs()
+    {
+        cout << endl
+             << "Depth in Nands:" << endl;
+        for (const auto &[name, pin] : m_netlist.pins())
+        {
+            if (pin.kind != Netlist::OUTPUT)
+            {
+                continue;
+            }
+
+            size_t deepest = 0;
+            for (size_t bit = 1; bit < pin.wires.size(); bit++)
+            {
+                deepest = m_depth[pin.wires[bit]] > m_depth[pin.wires[deepest]] ? bit : deepest;
+            }
+            cout << "  " << left << setw(16) << name << right << setw(6) << m_depth[pin.wires[deepest]];
+            if (pin.wires.size() > 1)
+            {
+                cout << "  at bit " << deepest;
+            }
+            cout << endl;
+        }
+
+        uint32_t registered = 0;
+        for (const auto &flop : m_netlist.flops())
+        {
+            registered = max(registered, m_depth[flop.in]);
+        }
+        if (!m_netlist.flops().empty())
+        {
+            cout << "  " << left << setw(16) << "DFF inputs" << right << setw(6) << registered << endl;
+        }
+    }
+
+    // The part, or its ancestor at the given depth below the chip.
+    uint32_t ancestor(uint32_t part, int depth) const
+    {
+        const auto &parts = m_netlist.parts();
+        vector<uint32_t> chain;
+        for (; part != Netlist::NO_PART; part = parts[part].parent)
+        {
+            chain.push_back(part);
+        }
+        return chain[chain.size() - 1 - min<size_t>(depth, chain.size() - 1)];
+    }
+
+    void reportCriticalPath(int pathDepth)
+    {
+        auto [end, endName] = deepestSink();
+        vector<uint32_t> path = criticalPath();
+        cout << endl
+             << "Critical path: " << m_depth[end] << " Nands from " << m_sourceNames[path[0]] << " to " << endName << endl;
+
+        // Runs of consecutive gates in the same part are shown once.
+        auto partOf = [&](uint32_t wire)
+        {
+            return ancestor(m_netlist.gateParts()[m_gate[wire]], pathDepth);
+        };
+        for (size_t i = 1; i < path.size();)
+        {
+            if (m_gate[path[i]] < 0)
+            {
+                cout << "  " << setw(6) << 0 << "  " << m_sourceNames[path[i]] << endl;
+                i++;
+                continue;
+            }
+
+            uint32_t part = partOf(path[i]);
+            size_t run = 0;
+            for (; i < path.size() && m_gate[path[i]] >= 0 && partOf(path[i]) == part; i++)
+            {
+                run++;
+            }
+            cout << "  " << setw(6) << run << "  " << partPath(part) << endl;
+        }
+    }
+
+    void reportParts(int tableDepth)
+    {
+        cout << endl
+             << "  " << left << setw(48) << "Part" << right << setw(10) << "Nands" << setw(8) << "%" << setw(8) << "DFFs"
+             << setw(10) << "On path" << endl;
+        reportPart(0, 0, tableDepth);
+
+        // Totals per chip over every part using it, at any depth.
+        map<string, pair<uint64_t, uint64_t>> chips;
+        for (size_t part = 1; part < m_netlist.parts().size(); part++)
+        {
+            auto &chip = chips[m_netlist.parts()[part].chip];
+            chip.first++;
+            chip.second += m_partGates[part];
+        }
+        vector<pair<string, pair<uint64_t, uint64_t>>> sorted(chips.begin(), chips.end());
+        stable_sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b)
+                    { return a.second.second > b.second.second; });
+
+        cout << endl
+             << "  " << left << setw(24) << "Chip" << right << setw(10) << "Parts" << setw(14) << "Nands each" << endl;
+        for (const auto &[name, counts] : sorted)
+        {
+            cout << "  " << left << setw(24) << name << right << setw(10) << counts.first << setw(14)
+                 << counts.second / counts.first << endl;
+        }
+    }
+
+    void reportPart(uint32_t part, int depth, int tableDepth)
+    {
+        const auto &info = m_netlist.parts()[part];
+        string label = string(2 * depth, ' ') + info.chip + (part == 0 ? "" : ":" + to_string(info.line));
+        double share = m_netlist.gates().empty() ? 0 : 100.0 * m_partGates[part] / m_netlist.gates().size();
+        cout << "  " << left << setw(48) << label << right << setw(10) << m_partGates[part] << setw(8) << fixed
+             << setprecision(1) << share << setw(8) << m_partFlops[part] << setw(10) << m_partPathGates[part] << endl;
+
+        if (depth < tableDepth)
+        {
+            for (auto child : m_children[part])
+            {
+                reportPart(child, depth + 1, tableDepth);
+            }
+        }
+    }
+};
+
+int main(int argc, char **argv)
+{
+    vector<string> libraries;
+    string chipPath;
+    int tableDepth = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+
+        if (arg == "--lib" && i + 1 < argc)
+        {
+            libraries.push_back(argv[++i]);
+        }
+        else if (arg == "--depth" && i + 1 < argc)
+        {
+            tableDepth = max(stoi(argv[++i]), 0);
+        }
+        else
+        {
+            chipPath = arg;
+        }
+    }
+
+    if (chipPath.empty())
+    {
+        cout << "Invalid argument: specify path to .hdl file" << endl
+             << "Usage: hdl-analyze [--lib <directory>]... [--depth N] <file.hdl>" << endl;
+        return -1;
+    }
+
+    filesystem::path path(chipPath);
+    HDLLibrary library;
+    library.addDirectory(path.parent_path().empty() ? "." : path.parent_path());
+    for (const auto &directory : libraries)
+    {
+        library.addDirectory(directory);
+    }
+
+    Netlist netlist;
+    if (!netlist.build(library, path.stem().string(), {}, true))
+    {
+        cerr << "Error: " << netlist.error() << endl;
+        return -1;
+    }
+
+    ChipAnalyzer analyzer(netlist);
+    analyzer.analyze();
+    analyzer.report(tableDepth);
+    return 0;
+}
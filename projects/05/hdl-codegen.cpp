@@ -0,0 +1,622 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include "./hdl-simulator.hpp"
+
+using namespace std;
+
+// Compiles a chip's levelized netlist into a C++ function, one statement per
+// gate, which ChipSimulator runs in place of its gate sweep once the output
+// is compiled into a simulator:
+//
+//   hdl-codegen --lib 01 --lib 02 --lib 03/a 05/CPU.hdl
+//   g++ -O2 -I 05 05/chip-test.cpp 05/CPU.compiled.cpp -o chip-test
+//
+// Not16, And16, Or16 and Mux16 parts are fused into one 16-bit operation,
+// provided each output bit of the part is computed from the same bit of its
+// buses by the same function. Buses stay packed in words between fused
+// operations and memories, and bits are extracted only where gates use them.
+
+// A chip computing every output bit from the same bit of each 16-bit input
+// and from its 1-bit inputs. The expression computes all bits at once from
+// $0, $1, ... standing for the inputs in order.
+struct BusOperation
+{
+    vector<string> inputs;
+    int (*bit)(const int *in);
+    string expression;
+};
+
+int notBit(const int *in)
+{
+    return !in[0];
+}
+
+int andBit(const int *in)
+{
+    return in[0] & in[1];
+}
+
+int orBit(const int *in)
+{
+    return in[0] | in[1];
+}
+
+int muxBit(const int *in)
+{
+    return in[2] ? in[1] : in[0];
+}
+
+const map<string, BusOperation> busOperations = {
+    {"Not16", {{"in"}, notBit, "(uint16_t)~$0"}},
+    {"And16", {{"a", "b"}, andBit, "$0 & $1"}},
+    {"Or16", {{"a", "b"}, orBit, "$0 | $1"}},
+    {"Mux16", {{"a", "b", "sel"}, muxBit, "$2 ? $1 : $0"}},
+};
+
+class CodeGenerator
+{
+private:
+    // A gate, fused operation or memory read, in evaluation order.
+    struct Node
+    {
+        enum Kind
+        {
+            GATE,
+            FUSED,
+            MEMORY
+        };
+
+        Kind kind;
+        size_t index;
+    };
+
+    struct Fused
+    {
+        const BusOperation *operation;
+        vector<Netlist::Bus> inputs;
+        Netlist::Bus out;
+    };
+
+    const Netlist &m_netlist;
+    vector<int32_t> m_producer;
+    vector<uint32_t> m_consumers;
+    vector<uint8_t> m_fusedGate;
+    vector<Fused> m_fused;
+    size_t m_fusedGates = 0;
+
+    stringstream m_code;
+    vector<string> m_scalar;
+    vector<pair<int, int>> m_wordBit;
+    map<Netlist::Bus, string> m_packed;
+    int m_words = 0;
+
+public:
+    CodeGenerator(const Netlist &netlist) : m_netlist(netlist)
+    {
+        const auto &gates = netlist.gates();
+        m_producer.assign(netlist.wireCount(), -1);
+        m_consumers.assign(netlist.wireCount(), 0);
+        for (size_t i = 0; i < gates.size(); i++)
+        {
+            m_producer[gates[i].out] = i;
+            m_consumers[gates[i].a]++;
+            m_consumers[gates[i].b]++;
+        }
+        m_fusedGate.assign(gates.size(), false);
+    }
+
+    size_t fusedOperations() const
+    {
+        return m_fused.size();
+    }
+
+    size_t fusedGates() const
+    {
+        return m_fusedGates;
+    }
+
+    // Fuses every recorded bus chip part whose gates pass the check.
+    void fuse()
+    {
+        for (const auto &instance : m_netlist.instances())
+        {
+            const BusOperation &operation = busOperations.at(instance.chip);
+            Fused fused = {&operation, {}, instance.pins.at("out")};
+            for (const auto &input : operation.inputs)
+            {
+                fused.inputs.push_back(instance.pins.at(input));
+            }
+
+            vector<uint32_t> cone;
+            if (fusable(fused, cone))
+            {
+                for (auto gate : cone)
+                {
+                    m_fusedGate[gate] = true;
+                }
+                m_fusedGates += cone.size();
+                m_fused.push_back(move(fused));
+            }
+        }
+    }
+
+    string generate(const string &chipName)
+    {
+        m_code.str("");
+        m_scalar.assign(m_netlist.wireCount(), "");
+        m_wordBit.assign(m_netlist.wireCount(), {-1, 0});
+        m_packed.clear();
+        m_words = 0;
+
+        const auto &gates = m_netlist.gates();
+        // Everything the simulator reads after eval() goes back to the array,
+        // and only the nodes it depends on are emitted.
+        vector<uint8_t> observed(m_netlist.wireCount(), false);
+        for (const auto &[name, pin] : m_netlist.pins())
+        {
+            for (auto wire : pin.wires)
+            {
+                observed[wire] = true;
+            }
+        }
+        for (const auto &flop : m_netlist.flops())
+        {
+            observed[flop.in] = true;
+        }
+        for (const auto &memory : m_netlist.memories())
+        {
+            observed[memory.load] = true;
+            for (const auto &bus : {memory.in, memory.address})
+            {
+                for (auto wire : bus)
+                {
+                    observed[wire] = true;
+                }
+            }
+        }
+
+        vector<uint8_t> produced(m_netlist.wireCount(), false);
+        for (const auto &node : order(observed))
+        {
+            if (node.kind == Node::GATE)
+            {
+                const auto &gate = gates[node.index];
+                string a = scalar(gate.a);
+                string b = scalar(gate.b);
+                string name = "b" + to_string(gate.out);
+                m_code << "    const uint8_t " << name << " = " << (a == b ? a : "(" + a + " & " + b + ")") << " ^ 1;\n";
+                m_scalar[gate.out] = name;
+                produced[gate.out] = true;
+            }
+            else if (node.kind == Node::FUSED)
+            {
+                const Fused &fused = m_fused[node.index];
+                string expression = fused.operation->expression;
+                for (size_t i = fused.inputs.size(); i-- > 0;)
+                {
+                    const auto &input = fused.inputs[i];
+                    string operand = input.size() == 1 ? scalar(input[0]) : word(input);
+                    expression = replace(expression, "$" + to_string(i), operand);
+                }
+                defineWord(fused.out, expression);
+                for (auto wire : fused.out)
+                {
+                    produced[wire] = true;
+                }
+            }
+            else
+            {
+                const auto &memory = m_netlist.memories()[node.index];
+                string address = memory.address.empty() ? "0" : word(memory.address);
+                defineWord(memory.out, "memories[" + to_string(node.index) + "][" + address + "]");
+                for (auto wire : memory.out)
+                {
+                    produced[wire] = true;
+                }
+            }
+        }
+
+        for (uint32_t wire = 0; wire < m_netlist.wireCount(); wire++)
+        {
+            if (observed[wire] && produced[wire])
+            {
+                string value = scalar(wire);
+                m_code << "    w[" << wire << "] = " << value << ";\n";
+            }
+        }
+
+        stringstream file;
+        file << "// Generated by hdl-codegen from " << chipName << ".hdl; do not edit.\n"
+             << "// " << gates.size() << " gates in " << m_netlist.levelCount() << " levels, " << m_fusedGates << " of them fused into "
+             << m_fused.size() << " bus operations.\n\n"
+             << "#include \"hdl-simulator.hpp\"\n\n"
+             << "static void eval" << chipName << "(uint8_t *w, int16_t *const *memories)\n{\n"
+             << "    (void)memories;\n"
+             << m_code.str()
+             << "}\n\n"
+             << "static CompiledChip compiled" << chipName << "(\"" << chipName << "\", 0x" << hex << m_netlist.signature() << dec
+             << "ull, eval" << chipName << ");\n";
+        return file.str();
+    }
+
+private:
+    static string replace(string text, const string &from, const string &to)
+    {
+        for (size_t pos = text.find(from); pos != string::npos; pos = text.find(from, pos + to.size()))
+        {
+            text.replace(pos, from.size(), to);
+        }
+        return text;
+    }
+
+    // Checks that each output bit depends only on the same bit of the 16-bit
+    // inputs and on the 1-bit inputs, through gates used nowhere else, and
+    // computes the operation's function of them.
+    bool fusable(const Fused &fused, vector<uint32_t> &cone)
+    {
+        if (fused.out.size() != 16)
+        {
+            return false;
+        }
+        for (const auto &input : fused.inputs)
+        {
+            if (input.size() != 16 && input.size() != 1)
+            {
+                return false;
+            }
+        }
+
+        vector<uint8_t> inCone(m_netlist.gates().size(), false);
+        for (int bit = 0; bit < 16; bit++)
+        {
+            vector<uint32_t> leaves;
+            for (const auto &input : fused.inputs)
+            {
+                leaves.push_back(input.size() == 1 ? input[0] : input[bit]);
+            }
+
+            vector<uint32_t> bitCone;
+            vector<uint32_t> stack = {fused.out[bit]};
+            if (m_producer[fused.out[bit]] < 0)
+            {
+                return false;
+            }
+            while (!stack.empty())
+            {
+                uint32_t wire = stack.back();
+                stack.pop_back();
+                if (wire == Netlist::FALSE_WIRE || wire == Netlist::TRUE_WIRE || find(leaves.begin(), leaves.end(), wire) != leaves.end())
+                {
+                    continue;
+                }
+
+                int32_t gate = m_producer[wire];
+                if (gate < 0 || m_fusedGate[gate])
+                {
+                    return false;
+                }
+                if (!inCone[gate])
+                {
+                    inCone[gate] = true;
+                    bitCone.push_back(gate);
+                    stack.push_back(m_netlist.gates()[gate].a);
+                    stack.push_back(m_netlist.gates()[gate].b);
+                }
+            }
+
+            sort(bitCone.begin(), bitCone.end());
+            if (!truthTableMatches(*fused.operation, leaves, bitCone))
+            {
+                return false;
+            }
+            cone.insert(cone.end(), bitCone.begin(), bitCone.end());
+        }
+
+        // The gates' outputs, other than the part's, must stay inside.
+        map<uint32_t, uint32_t> uses;
+        for (auto gate : cone)
+        {
+            uses[m_netlist.gates()[gate].a]++;
+            uses[m_netlist.gates()[gate].b]++;
+        }
+        for (auto gate : cone)
+        {
+            uint32_t wire = m_netlist.gates()[gate].out;
+            if (find(fused.out.begin(), fused.out.end(), wire) == fused.out.end() && uses[wire] != m_consumers[wire])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Evaluates a bit's gates, which are in level order, for every value of
+    // its inputs.
+    bool truthTableMatches(const BusOperation &operation, const vector<uint32_t> &leaves, const vector<uint32_t> &bitCone)
+    {
+        const auto &gates = m_netlist.gates();
+        for (int values = 0; values < 1 << leaves.size(); values++)
+        {
+            map<uint32_t, int> wires = {{Netlist::FALSE_WIRE, 0}, {Netlist::TRUE_WIRE, 1}};
+            int in[8];
+            for (size_t i = 0; i < leaves.size(); i++)
+            {
+                in[i] = (values >> i) & 1;
+                if (wires.count(leaves[i]) && wires[leaves[i]] != in[i])
+                {
+                    return false;
+                }
+                wires[leaves[i]] = in[i];
+            }
+
+            for (auto gate : bitCone)
+            {
+                wires[gates[gate].out] = !(wires[gates[gate].a] & wires[gates[gate].b]);
+            }
+            if (wires[gates[bitCone.back()].out] != operation.bit(in))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Orders the gates left unfused, the fused operations and the memory
+    // reads with Kahn's algorithm, dropping those no observed wire needs.
+    vector<Node> order(const vector<uint8_t> &observed)
+    {
+        vector<Node> nodes;
+        vector<Netlist::Bus> inputs;
+        vector<Netlist::Bus> outputs;
+
+        const auto &gates = m_netlist.gates();
+        for (size_t i = 0; i < gates.size(); i++)
+        {
+            if (!m_fusedGate[i])
+            {
+                nodes.push_back({Node::GATE, i});
+                inputs.push_back({gates[i].a, gates[i].b});
+                outputs.push_back({gates[i].out});
+            }
+        }
+        for (size_t i = 0; i < m_fused.size(); i++)
+        {
+            nodes.push_back({Node::FUSED, i});
+            inputs.emplace_back();
+            for (const auto &input : m_fused[i].inputs)
+            {
+                inputs.back().insert(inputs.back().end(), input.begin(), input.end());
+            }
+            outputs.push_back(m_fused[i].out);
+        }
+        for (size_t i = 0; i < m_netlist.memories().size(); i++)
+        {
+            nodes.push_back({Node::MEMORY, i});
+            inputs.push_back(m_netlist.memories()[i].address);
+            outputs.push_back(m_netlist.memories()[i].out);
+        }
+
+        vector<int32_t> producer(m_netlist.wireCount(), -1);
+        for (size_t node = 0; node < nodes.size(); node++)
+        {
+            for (auto wire : outputs[node])
+            {
+                producer[wire] = node;
+            }
+        }
+
+        vector<uint32_t> pending(nodes.size(), 0);
+        vector<vector<uint32_t>> next(nodes.size());
+        for (size_t node = 0; node < nodes.size(); node++)
+        {
+            for (auto wire : inputs[node])
+            {
+                if (producer[wire] >= 0)
+                {
+                    pending[node]++;
+                    next[producer[wire]].push_back(node);
+                }
+            }
+        }
+
+        vector<uint32_t> queue;
+        for (size_t node = 0; node < nodes.size(); node++)
+        {
+            if (pending[node] == 0)
+            {
+                queue.push_back(node);
+            }
+        }
+        for (size_t i = 0; i < queue.size(); i++)
+        {
+            for (auto node : next[queue[i]])
+            {
+                if (--pending[node] == 0)
+                {
+                    queue.push_back(node);
+                }
+            }
+        }
+
+        vector<uint8_t> live = observed;
+        vector<uint8_t> needed(nodes.size(), false);
+        for (size_t i = queue.size(); i-- > 0;)
+        {
+            uint32_t node = queue[i];
+            for (auto wire : outputs[node])
+            {
+                needed[node] = needed[node] || live[wire];
+            }
+            if (needed[node])
+            {
+                for (auto wire : inputs[node])
+                {
+                    live[wire] = true;
+                }
+            }
+        }
+
+        vector<Node> ordered;
+        for (auto node : queue)
+        {
+            if (needed[node])
+            {
+                ordered.push_back(nodes[node]);
+            }
+        }
+        return ordered;
+    }
+
+    // The expression for a wire's bit, loading it from the array or
+    // extracting it from a word on first use.
+    string scalar(uint32_t wire)
+    {
+        if (wire == Netlist::FALSE_WIRE || wire == Netlist::TRUE_WIRE)
+        {
+            return to_string(wire);
+        }
+
+        if (m_scalar[wire].empty())
+        {
+            string name = "b" + to_string(wire);
+            auto [word, bit] = m_wordBit[wire];
+            if (word >= 0)
+            {
+                m_code << "    const uint8_t " << name << " = (v" << word << " >> " << bit << ") & 1;\n";
+            }
+            else
+            {
+                m_code << "    const uint8_t " << name << " = w[" << wire << "];\n";
+            }
+            m_scalar[wire] = name;
+        }
+        return m_scalar[wire];
+    }
+
+    // The expression for a bus as a word: a word holding its bits in order,
+    // or one packed from its bits on first use.
+    string word(const Netlist::Bus &bus)
+    {
+        auto [word, first] = m_wordBit[bus[0]];
+        bool inWord = word >= 0;
+        for (size_t bit = 0; bit < bus.size() && inWord; bit++)
+        {
+            inWord = m_wordBit[bus[bit]] == make_pair(word, first + (int)bit);
+        }
+        if (inWord)
+        {
+            string shifted = first == 0 ? "v" + to_string(word) : "(v" + to_string(word) + " >> " + to_string(first) + ")";
+            return first + bus.size() == 16 ? shifted : "(" + shifted + " & " + to_string((1 << bus.size()) - 1) + ")";
+        }
+
+        auto packed = m_packed.find(bus);
+        if (packed != m_packed.end())
+        {
+            return packed->second;
+        }
+
+        string expression;
+        for (size_t bit = 0; bit < bus.size(); bit++)
+        {
+            if (bus[bit] != Netlist::FALSE_WIRE)
+            {
+                expression += (expression.empty() ? "" : " | ") + scalar(bus[bit]) + (bit == 0 ? "" : " << " + to_string(bit));
+            }
+        }
+
+        string name = "v" + to_string(m_words++);
+        m_code << "    const uint16_t " << name << " = " << (expression.empty() ? "0" : expression) << ";\n";
+        m_packed[bus] = name;
+        return name;
+    }
+
+    void defineWord(const Netlist::Bus &bus, const string &expression)
+    {
+        int word = m_words++;
+        m_code << "    const uint16_t v" << word << " = " << expression << ";\n";
+        for (size_t bit = 0; bit < bus.size(); bit++)
+        {
+            m_wordBit[bus[bit]] = {word, (int)bit};
+        }
+    }
+};
+
+int main(int argc, char **argv)
+{
+    vector<string> libraries;
+    string chipPath;
+    string outputPath;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+
+        if (arg == "--lib" && i + 1 < argc)
+        {
+            libraries.push_back(argv[++i]);
+        }
+        else if (arg == "-o" && i + 1 < argc)
+        {
+            outputPath = argv[++i];
+        }
+        else
+        {
+            chipPath = arg;
+        }
+    }
+
+    if (chipPath.empty())
+    {
+        cout << "Invalid argument: specify path to .hdl file" << endl
+             << "Usage: hdl-codegen [--lib <directory>]... [-o <file.cpp>] <file.hdl>" << endl;
+        return -1;
+    }
+
+    filesystem::path path(chipPath);
+    string chipName = path.stem().string();
+    if (outputPath.empty())
+    {
+        outputPath = (path.parent_path() / (chipName + ".compiled.cpp")).string();
+    }
+
+    HDLLibrary library;
+    library.addDirectory(path.parent_path().empty() ? "." : path.parent_path());
+    for (const auto &directory : libraries)
+    {
+        library.addDirectory(directory);
+    }
+
+    set<string> busChips;
+    for (const auto &[name, operation] : busOperations)
+    {
+        busChips.insert(name);
+    }
+
+    Netlist netlist;
+    if (!netlist.build(library, chipName, busChips))
+    {
+        cerr << "Error: " << netlist.error() << endl;
+        return -1;
+    }
+
+    CodeGenerator generator(netlist);
+    generator.fuse();
+    string code = generator.generate(chipName);
+
+    ofstream file(outputPath);
+    if (!file)
+    {
+        cerr << "Error: cannot write " << outputPath << endl;
+        return -1;
+    }
+    file << code;
+
+    cout << chipName << ": " << netlist.gates().size() << " gates in " << netlist.levelCount() << " levels, "
+         << generator.fusedGates() << " of them fused into " << generator.fusedOperations() << " bus operations, written to "
+         << outputPath << endl;
+    return 0;
+}
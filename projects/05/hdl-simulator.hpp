@@ -0,0 +1,2737 @@
+#ifndef HDL_SIMULATOR_HPP
+#define HDL_SIMULATOR_HPP
+
+#include <fstream>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_set>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+// A pin of a chip's interface, e.g. address[14].
+struct HDLPin
+{
+    string name;
+    int width = 1;
+};
+
+// One connection of a part, pin[pinFrom..pinTo]=wire[wireFrom..wireTo]. The
+// ranges are -1 where the whole bus is meant, and the wire may be one of the
+// constants true and false.
+struct HDLConnection
+{
+    string pin;
+    int pinFrom = -1;
+    int pinTo = -1;
+    string wire;
+    int wireFrom = -1;
+    int wireTo = -1;
+};
+
+struct HDLPart
+{
+    string chip;
+    vector<HDLConnection> connections;
+    int line = 0;
+};
+
+// A chip definition, parsed from its .hdl file or, for the primitives, built
+// into the simulator.
+struct HDLChip
+{
+    enum Builtin
+    {
+        NONE,
+        NAND,
+        DFF,
+        RAM,
+        ROM,
+        KEYBOARD
+    };
+
+    string name;
+    string path;
+    Builtin builtin = NONE;
+    vector<HDLPin> inputs;
+    vector<HDLPin> outputs;
+    vector<HDLPart> parts;
+
+    const HDLPin *findPin(const string &pinName, bool &input) const
+    {
+        for (const auto &pins : {&inputs, &outputs})
+        {
+            for (const auto &pin : *pins)
+            {
+                if (pin.name == pinName)
+                {
+                    input = pins == &inputs;
+                    return &pin;
+                }
+            }
+        }
+
+        return nullptr;
+    }
+};
+
+class HDLParser
+{
+private:
+    struct Token
+    {
+        string text;
+        int line;
+    };
+
+    string m_path;
+    vector<Token> m_tokens;
+    size_t m_pos = 0;
+    bool m_builtin = false;
+    string m_error;
+
+public:
+    bool parse(const string &path, HDLChip &chip)
+    {
+        ifstream file(path);
+        if (!file)
+        {
+            m_error = "cannot open " + path;
+            return false;
+        }
+
+        stringstream buffer;
+        buffer << file.rdbuf();
+        m_path = path;
+        tokenize(buffer.str());
+        m_pos = 0;
+
+        chip = HDLChip();
+        chip.path = path;
+        if (!expect("CHIP") || !name(chip.name) || !expect("{"))
+        {
+            return false;
+        }
+
+        if (accept("IN") && !pins(chip.inputs))
+        {
+            return false;
+        }
+        if (accept("OUT") && !pins(chip.outputs))
+        {
+            return false;
+        }
+
+        // Builtin chips are implemented by the simulator itself.
+        m_builtin = accept("BUILTIN");
+        if (m_builtin)
+        {
+            string builtinName;
+            if (!name(builtinName) || !expect(";"))
+            {
+                return false;
+            }
+            while (m_pos < m_tokens.size() && peek() != "}")
+            {
+                m_pos++;
+            }
+            return expect("}");
+        }
+
+        if (!expect("PARTS") || !expect(":"))
+        {
+            return false;
+        }
+
+        while (peek() != "}")
+        {
+            HDLPart part;
+            part.line = line();
+            if (!name(part.chip) || !expect("(") || !connections(part.connections) || !expect(";"))
+            {
+                return false;
+            }
+            chip.parts.push_back(move(part));
+        }
+
+        return expect("}");
+    }
+
+    // Whether the chip was declared BUILTIN rather than given parts.
+    bool builtin() const
+    {
+        return m_builtin;
+    }
+
+    const string &error() const
+    {
+        return m_error;
+    }
+
+private:
+    void tokenize(const string &text)
+    {
+        m_tokens.clear();
+        int lineNumber = 1;
+        size_t i = 0;
+
+        while (i < text.size())
+        {
+            char c = text[i];
+
+            if (c == '\n')
+            {
+                lineNumber++;
+                i++;
+            }
+            else if (isspace(c))
+            {
+                i++;
+            }
+            else if (text.compare(i, 2, "//") == 0)
+            {
+                i = text.find('\n', i);
+            }
+            else if (text.compare(i, 2, "/*") == 0)
+            {
+                size_t end = text.find("*/", i + 2);
+                end = end == string::npos ? text.size() : end + 2;
+                lineNumber += count(text.begin() + i, text.begin() + end, '\n');
+                i = end;
+            }
+            else if (text.compare(i, 2, "..") == 0)
+            {
+                m_tokens.push_back({"..", lineNumber});
+                i += 2;
+            }
+            else if (isalnum(c) || c == '_')
+            {
+                size_t start = i;
+                while (i < text.size() && (isalnum(text[i]) || text[i] == '_'))
+                {
+                    i++;
+                }
+                m_tokens.push_back({text.substr(start, i - start), lineNumber});
+            }
+            else
+            {
+                m_tokens.push_back({string(1, c), lineNumber});
+                i++;
+            }
+        }
+    }
+
+    const string &peek() const
+    {
+        static const string end = "";
+        return m_pos < m_tokens.size() ? m_tokens[m_pos].text : end;
+    }
+
+    int line() const
+    {
+        return m_tokens.empty() ? 0 : m_tokens[min(m_pos, m_tokens.size() - 1)].line;
+    }
+
+    bool accept(const string &text)
+    {
+        if (peek() != text)
+        {
+            return false;
+        }
+        m_pos++;
+        return true;
+    }
+
+    bool fail(const string &message)
+    {
+        m_error = m_path + ":" + to_string(line()) + ": " + message;
+        return false;
+    }
+
+    bool expect(const string &text)
+    {
+        return accept(text) || fail("expected " + text + (m_pos < m_tokens.size() ? " before " + peek() : " at end of file"));
+    }
+
+    bool name(string &result)
+    {
+        if (!isalpha(peek()[0]) && peek()[0] != '_')
+        {
+            return fail("expected a name" + (m_pos < m_tokens.size() ? " before " + peek() : " at end of file"));
+        }
+        result = m_tokens[m_pos++].text;
+        return true;
+    }
+
+    bool number(int &result)
+    {
+        if (!isdigit(peek()[0]) || peek().find_first_not_of("0123456789") != string::npos)
+        {
+            return fail("expected a number before " + peek());
+        }
+        result = stoi(m_tokens[m_pos++].text);
+        return true;
+    }
+
+    // [i] or [i..j], if present.
+    bool subscript(int &from, int &to)
+    {
+        from = to = -1;
+        if (!accept("["))
+        {
+            return true;
+        }
+
+        if (!number(from))
+        {
+            return false;
+        }
+        to = from;
+        if (accept("..") && !number(to))
+        {
+            return false;
+        }
+        if (to < from)
+        {
+            return fail("invalid range " + to_string(from) + ".." + to_string(to));
+        }
+        return expect("]");
+    }
+
+    bool pins(vector<HDLPin> &result)
+    {
+        do
+        {
+            HDLPin pin;
+            if (!name(pin.name))
+            {
+                return false;
+            }
+            if (accept("[") && (!number(pin.width) || !expect("]")))
+            {
+                return false;
+            }
+            if (pin.width < 1 || pin.width > 16)
+            {
+                return fail("pin " + pin.name + " must be 1 to 16 bits wide");
+            }
+            result.push_back(pin);
+        } while (accept(","));
+
+        return expect(";");
+    }
+
+    bool connections(vector<HDLConnection> &result)
+    {
+        do
+        {
+            HDLConnection connection;
+            if (!name(connection.pin) || !subscript(connection.pinFrom, connection.pinTo) || !expect("=") ||
+                !name(connection.wire) || !subscript(connection.wireFrom, connection.wireTo))
+            {
+                return false;
+            }
+            result.push_back(connection);
+        } while (accept(","));
+
+        return expect(")");
+    }
+};
+
+// Finds chip definitions: a chip is read from the first of the library
+// directories holding its .hdl file, and the primitives Nand and DFF, the
+// memories and the chips declared BUILTIN are provided by the simulator.
+class HDLLibrary
+{
+private:
+    vector<filesystem::path> m_directories;
+    map<string, HDLChip> m_chips;
+    map<string, HDLChip> m_models;
+    bool m_memoryModels = true;
+    string m_error;
+
+public:
+    void addDirectory(const filesystem::path &directory)
+    {
+        m_directories.push_back(directory);
+    }
+
+    // Returns the chip, or nullptr with error() saying why it is unavailable.
+    const HDLChip *chip(const string &name)
+    {
+        auto found = m_chips.find(name);
+        if (found != m_chips.end())
+        {
+            return &found->second;
+        }
+
+        filesystem::path path;
+        for (const auto &directory : m_directories)
+        {
+            if (filesystem::exists(directory / (name + ".hdl")))
+            {
+                path = directory / (name + ".hdl");
+                break;
+            }
+        }
+
+        HDLChip chip;
+        if (name == "Nand" || name == "DFF" || path.empty())
+        {
+            // The CPU's A and D registers are ordinary registers.
+            if (!builtin(name, chip) && (name == "ARegister" || name == "DRegister"))
+            {
+                const HDLChip *registerChip = this->chip("Register");
+                if (registerChip == nullptr)
+                {
+                    return nullptr;
+                }
+                chip = *registerChip;
+                chip.name = name;
+            }
+            else if (chip.builtin == HDLChip::NONE)
+            {
+                m_error = "chip " + name + " not found";
+                return nullptr;
+            }
+        }
+        else
+        {
+            HDLParser parser;
+            if (!parser.parse(path.string(), chip))
+            {
+                m_error = parser.error();
+                return nullptr;
+            }
+            if (chip.name != name)
+            {
+                m_error = path.string() + " defines chip " + chip.name + ", not " + name;
+                return nullptr;
+            }
+            if (parser.builtin() && !builtin(name, chip))
+            {
+                m_error = "no builtin implementation of chip " + name;
+                return nullptr;
+            }
+        }
+
+        return &m_chips.emplace(name, move(chip)).first->second;
+    }
+
+    // Returns the chip for a part. A RAM chip defined in HDL is replaced by
+    // the builtin memory once it has been checked to behave like one, so
+    // its registers and multiplexers need not be flattened; a RAM failing
+    // the check is flattened, and its tests show the fault.
+    const HDLChip *part(const string &name);
+
+    // Whether part() replaces RAM chips by builtin memories, which it does
+    // by default.
+    void setMemoryModels(bool memoryModels)
+    {
+        m_memoryModels = memoryModels;
+    }
+
+    // A hash of the .hdl files of the chip and of every chip it uses, and of
+    // the settings affecting how they are flattened, which changes whenever
+    // the chip's netlist may. False if a chip cannot be read.
+    bool contentHash(const string &chipName, uint64_t &hash)
+    {
+        hash = 0xCBF29CE484222325ull;
+        auto add = [&](const string &text)
+        {
+            for (char c : text)
+            {
+                hash = (hash ^ (uint8_t)c) * 0x100000001B3ull;
+            }
+            hash = (hash ^ 0xFF) * 0x100000001B3ull;
+        };
+        add(m_memoryModels ? "models" : "gates");
+
+        set<string> visited = {chipName};
+        vector<string> pending = {chipName};
+        while (!pending.empty())
+        {
+            const HDLChip *chip = this->chip(pending.back());
+            pending.pop_back();
+            if (chip == nullptr)
+            {
+                return false;
+            }
+
+            add(chip->name);
+            if (chip->path.empty())
+            {
+                add("builtin " + to_string(chip->builtin));
+            }
+            else
+            {
+                ifstream file(chip->path);
+                stringstream text;
+                text << file.rdbuf();
+                add(text.str());
+            }
+
+            for (const auto &part : chip->parts)
+            {
+                if (visited.insert(part.chip).second)
+                {
+                    pending.push_back(part.chip);
+                }
+            }
+        }
+        return true;
+    }
+
+    const string &error() const
+    {
+        return m_error;
+    }
+
+private:
+    bool matchesModel(const string &name, const HDLChip &model);
+
+    // The primitives and the memories, used for chips declared BUILTIN and
+    // for memories no .hdl file defines.
+    bool builtin(const string &name, HDLChip &chip)
+    {
+        static const map<string, int> ramAddressWidths = {
+            {"RAM8", 3}, {"RAM64", 6}, {"RAM512", 9}, {"RAM4K", 12}, {"RAM16K", 14}, {"Screen", 13}};
+
+        chip.name = name;
+        if (name == "Nand")
+        {
+            chip.builtin = HDLChip::NAND;
+            chip.inputs = {{"a", 1}, {"b", 1}};
+            chip.outputs = {{"out", 1}};
+            return true;
+        }
+        if (name == "DFF")
+        {
+            chip.builtin = HDLChip::DFF;
+            chip.inputs = {{"in", 1}};
+            chip.outputs = {{"out", 1}};
+            return true;
+        }
+
+        if (ramAddressWidths.count(name))
+        {
+            chip.builtin = HDLChip::RAM;
+            chip.inputs = {{"in", 16}, {"load", 1}, {"address", ramAddressWidths.at(name)}};
+            chip.outputs = {{"out", 16}};
+            return true;
+        }
+        if (name == "ROM32K")
+        {
+            chip.builtin = HDLChip::ROM;
+            chip.inputs = {{"address", 15}};
+            chip.outputs = {{"out", 16}};
+            return true;
+        }
+        if (name == "Keyboard")
+        {
+            chip.builtin = HDLChip::KEYBOARD;
+            chip.outputs = {{"out", 16}};
+            return true;
+        }
+
+        return false;
+    }
+};
+
+// A chip flattened to Nand gates, DFFs and builtin memories over a flat array
+// of one-bit wires. Wire 0 is constant false and wire 1 constant true. The
+// gates are levelized: every gate comes after the gates driving its inputs,
+// and the gates of one level, which do not depend on each other, are stored
+// together. A DFF's output and the chip's inputs start a combinational path;
+// a memory reads out[] from address[] within its level and writes on the
+// clock.
+class Netlist
+{
+public:
+    typedef vector<uint32_t> Bus;
+
+    struct Gate
+    {
+        uint32_t a;
+        uint32_t b;
+        uint32_t out;
+    };
+
+    struct Flop
+    {
+        uint32_t in;
+        uint32_t out;
+    };
+
+    struct Memory
+    {
+        string name;
+        HDLChip::Builtin kind;
+        uint32_t level = 0;
+        Bus in;
+        uint32_t load = 0;
+        Bus address;
+        Bus out;
+    };
+
+    enum PinKind
+    {
+        INPUT,
+        OUTPUT,
+        INTERNAL
+    };
+
+    struct Pin
+    {
+        PinKind kind;
+        Bus wires;
+    };
+
+    // A part using one of the chips build() was asked to record, with the
+    // wires of its input and output pins.
+    struct Instance
+    {
+        string chip;
+        map<string, Bus> pins;
+    };
+
+    // A part of the chip's hierarchy: the chip it uses, the line declaring
+    // it in its parent's .hdl file, and the index of the parent part. Part 0
+    // is the chip itself, whose parent is NO_PART.
+    struct Part
+    {
+        string chip;
+        int line;
+        uint32_t parent;
+    };
+
+private:
+    vector<Gate> m_gates;
+    vector<uint32_t> m_levelStart;
+    vector<Flop> m_flops;
+    vector<Memory> m_memories;
+    vector<uint32_t> m_memoryLevelStart;
+    map<string, Pin> m_pins;
+    map<string, Bus> m_partOutputs;
+    map<string, Bus> m_partAddresses;
+    map<string, size_t> m_partMemories;
+    set<string> m_instanceChips;
+    vector<Instance> m_instances;
+    bool m_recordParts = false;
+    vector<Part> m_parts;
+    vector<uint32_t> m_gateParts;
+    vector<uint32_t> m_flopParts;
+    uint32_t m_currentPart = 0;
+    uint32_t m_wireCount = 0;
+    string m_error;
+
+    // A chip's pins laid out as consecutive bits, inputs first, then
+    // outputs and internal pins, with each part's connections resolved to
+    // bits once per chip rather than once per instance.
+    struct Layout
+    {
+        struct Link
+        {
+            bool input;
+            int partBit;
+            int bit;
+            const string *wire;
+        };
+
+        struct Part
+        {
+            Layout *layout;
+            const string *chipName;
+            int line;
+            vector<Link> links;
+        };
+
+        const HDLChip *chip = nullptr;
+        map<string, pair<int, int>> pins;
+        int inputWidth = 0;
+        int ioWidth = 0;
+        int width = 0;
+        vector<Part> parts;
+        bool resolving = false;
+        bool recorded = false;
+    };
+
+    // While flattening, wires joined by a connection are merged with a
+    // union-find; a wire is driven once a gate, DFF or memory outputs to it.
+    map<const HDLChip *, Layout> m_layouts;
+    vector<uint32_t> m_parent;
+    vector<uint8_t> m_driven;
+    const HDLChip *m_contextChip = nullptr;
+    int m_contextLine = 0;
+
+public:
+    static constexpr uint32_t FALSE_WIRE = 0;
+    static constexpr uint32_t TRUE_WIRE = 1;
+    static constexpr uint32_t NO_PART = UINT32_MAX;
+
+    // Flattens the chip. Parts using instanceChips are listed in
+    // instances(), and with recordParts the part each Nand and DFF belongs
+    // to is kept.
+    bool build(HDLLibrary &library, const string &chipName, const set<string> &instanceChips = {}, bool recordParts = false)
+    {
+        *this = Netlist();
+        m_instanceChips = instanceChips;
+        m_recordParts = recordParts;
+        if (recordParts)
+        {
+            m_parts.push_back({chipName, 0, NO_PART});
+        }
+        const HDLChip *chip = library.chip(chipName);
+        if (chip == nullptr)
+        {
+            m_error = library.error();
+            return false;
+        }
+
+        Layout *layout = resolve(library, *chip);
+        if (layout == nullptr)
+        {
+            return false;
+        }
+
+        newWire(true);
+        newWire(true);
+        vector<uint32_t> io(layout->ioWidth);
+        for (int bit = 0; bit < layout->ioWidth; bit++)
+        {
+            io[bit] = newWire(bit < layout->inputWidth);
+        }
+
+        vector<uint32_t> wires = io;
+        if (chip->builtin != HDLChip::NONE ? !instantiateBuiltin(*layout, io.data()) : !instantiate(*layout, io.data(), wires))
+        {
+            return false;
+        }
+
+        for (const auto &[name, range] : layout->pins)
+        {
+            PinKind kind = range.first < layout->inputWidth ? INPUT : range.first < layout->ioWidth ? OUTPUT : INTERNAL;
+            m_pins[name] = {kind, Bus(wires.begin() + range.first, wires.begin() + range.first + range.second)};
+        }
+        m_layouts.clear();
+
+        compact();
+        return levelize();
+    }
+
+    const vector<Gate> &gates() const
+    {
+        return m_gates;
+    }
+
+    // Gates [levelStart()[l], levelStart()[l + 1]) form level l.
+    const vector<uint32_t> &levelStart() const
+    {
+        return m_levelStart;
+    }
+
+    size_t levelCount() const
+    {
+        return m_levelStart.size() - 1;
+    }
+
+    const vector<Flop> &flops() const
+    {
+        return m_flops;
+    }
+
+    // Memories [memoryLevelStart()[l], memoryLevelStart()[l + 1]) are read
+    // at level l, after its gates.
+    const vector<Memory> &memories() const
+    {
+        return m_memories;
+    }
+
+    const vector<uint32_t> &memoryLevelStart() const
+    {
+        return m_memoryLevelStart;
+    }
+
+    const map<string, Pin> &pins() const
+    {
+        return m_pins;
+    }
+
+    // The out pin of the first part, in depth-first order, using the chip.
+    const Bus *partOutput(const string &chipName) const
+    {
+        auto found = m_partOutputs.find(chipName);
+        return found == m_partOutputs.end() ? nullptr : &found->second;
+    }
+
+    // The address pin of that part, if it has one.
+    const Bus *partAddress(const string &chipName) const
+    {
+        auto found = m_partAddresses.find(chipName);
+        return found == m_partAddresses.end() ? nullptr : &found->second;
+    }
+
+    // The index of the first builtin memory of the given chip, or -1.
+    int partMemory(const string &chipName) const
+    {
+        auto found = m_partMemories.find(chipName);
+        return found == m_partMemories.end() ? -1 : found->second;
+    }
+
+    // The parts of the hierarchy and, for each gate and DFF, the innermost
+    // part containing it, if build() was asked to record them.
+    const vector<Part> &parts() const
+    {
+        return m_parts;
+    }
+
+    const vector<uint32_t> &gateParts() const
+    {
+        return m_gateParts;
+    }
+
+    const vector<uint32_t> &flopParts() const
+    {
+        return m_flopParts;
+    }
+
+    // Every part using a chip named in build()'s instanceChips.
+    const vector<Instance> &instances() const
+    {
+        return m_instances;
+    }
+
+    uint32_t wireCount() const
+    {
+        return m_wireCount;
+    }
+
+    // A hash of the netlist's structure, telling whether code generated
+    // from a netlist still matches it.
+    uint64_t signature() const
+    {
+        uint64_t hash = 0xCBF29CE484222325ull;
+        auto add = [&](uint64_t value)
+        {
+            hash = (hash ^ value) * 0x100000001B3ull;
+        };
+        auto addBus = [&](const Bus &bus)
+        {
+            add(bus.size());
+            for (auto wire : bus)
+            {
+                add(wire);
+            }
+        };
+
+        add(m_wireCount);
+        for (const auto &gate : m_gates)
+        {
+            add(gate.a);
+            add(gate.b);
+            add(gate.out);
+        }
+        for (const auto &flop : m_flops)
+        {
+            add(flop.in);
+            add(flop.out);
+        }
+        for (const auto &memory : m_memories)
+        {
+            add(memory.kind);
+            addBus(memory.in);
+            add(memory.load);
+            addBus(memory.address);
+            addBus(memory.out);
+        }
+        return hash;
+    }
+
+    // Writes the netlist to a binary cache file, tagged with a key such as
+    // HDLLibrary::contentHash(). The file is written under a temporary name
+    // and renamed, so readers never see part of one.
+    bool save(const string &path, uint64_t key) const
+    {
+        string data;
+        auto put = [&](uint64_t value, int bytes)
+        {
+            data.append((const char *)&value, bytes);
+        };
+        auto putBus = [&](const Bus &bus)
+        {
+            put(bus.size(), 4);
+            data.append((const char *)bus.data(), bus.size() * sizeof(uint32_t));
+        };
+        auto putString = [&](const string &text)
+        {
+            put(text.size(), 4);
+            data += text;
+        };
+
+        put(CACHE_MAGIC, 8);
+        put(key, 8);
+        put(m_wireCount, 4);
+        put(m_gates.size(), 4);
+        data.append((const char *)m_gates.data(), m_gates.size() * sizeof(Gate));
+        putBus(m_levelStart);
+        put(m_flops.size(), 4);
+        data.append((const char *)m_flops.data(), m_flops.size() * sizeof(Flop));
+        put(m_memories.size(), 4);
+        for (const auto &memory : m_memories)
+        {
+            putString(memory.name);
+            put(memory.kind, 4);
+            put(memory.level, 4);
+            putBus(memory.in);
+            put(memory.load, 4);
+            putBus(memory.address);
+            putBus(memory.out);
+        }
+        putBus(m_memoryLevelStart);
+        put(m_pins.size(), 4);
+        for (const auto &[name, pin] : m_pins)
+        {
+            putString(name);
+            put(pin.kind, 4);
+            putBus(pin.wires);
+        }
+        put(m_partOutputs.size(), 4);
+        for (const auto &[name, bus] : m_partOutputs)
+        {
+            putString(name);
+            putBus(bus);
+        }
+        put(m_partAddresses.size(), 4);
+        for (const auto &[name, bus] : m_partAddresses)
+        {
+            putString(name);
+            putBus(bus);
+        }
+        put(m_partMemories.size(), 4);
+        for (const auto &[name, index] : m_partMemories)
+        {
+            putString(name);
+            put(index, 4);
+        }
+
+        string temporary = path + "." + to_string(getpid());
+        ofstream file(temporary, ios::binary);
+        file.write(data.data(), data.size());
+        file.close();
+
+        error_code error;
+        if (file)
+        {
+            filesystem::rename(temporary, path, error);
+        }
+        if (!file || error)
+        {
+            filesystem::remove(temporary, error);
+            return false;
+        }
+        return true;
+    }
+
+    // Reads a netlist written by save() with the same key, mapping the file
+    // rather than reading it. False if there is none or it is damaged.
+    bool load(const string &path, uint64_t key)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat info;
+        void *mapped = fstat(fd, &info) == 0 && info.st_size > 0 ? mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (mapped == MAP_FAILED)
+        {
+            return false;
+        }
+
+        *this = Netlist();
+        const char *pos = (const char *)mapped;
+        const char *end = pos + info.st_size;
+        bool valid = true;
+        auto take = [&](void *target, size_t bytes)
+        {
+            valid = valid && (size_t)(end - pos) >= bytes;
+            if (valid)
+            {
+                memcpy(target, pos, bytes);
+                pos += bytes;
+            }
+        };
+        auto get = [&](int bytes)
+        {
+            uint64_t value = 0;
+            take(&value, bytes);
+            return value;
+        };
+        auto getArray = [&](auto &items)
+        {
+            size_t count = get(4);
+            valid = valid && (size_t)(end - pos) >= count * sizeof(items[0]);
+            items.resize(valid ? count : 0);
+            take(items.data(), items.size() * sizeof(items[0]));
+        };
+        auto getString = [&]()
+        {
+            string text;
+            getArray(text);
+            return text;
+        };
+
+        valid = get(8) == CACHE_MAGIC && get(8) == key;
+        m_wireCount = get(4);
+        getArray(m_gates);
+        getArray(m_levelStart);
+        getArray(m_flops);
+        m_memories.resize(valid ? get(4) : 0);
+        for (auto &memory : m_memories)
+        {
+            memory.name = getString();
+            memory.kind = (HDLChip::Builtin)get(4);
+            memory.level = get(4);
+            getArray(memory.in);
+            memory.load = get(4);
+            getArray(memory.address);
+            getArray(memory.out);
+        }
+        getArray(m_memoryLevelStart);
+        for (size_t i = 0, count = get(4); valid && i < count; i++)
+        {
+            string name = getString();
+            Pin &pin = m_pins[name];
+            pin.kind = (PinKind)get(4);
+            getArray(pin.wires);
+        }
+        for (size_t i = 0, count = get(4); valid && i < count; i++)
+        {
+            string name = getString();
+            getArray(m_partOutputs[name]);
+        }
+        for (size_t i = 0, count = get(4); valid && i < count; i++)
+        {
+            string name = getString();
+            getArray(m_partAddresses[name]);
+        }
+        for (size_t i = 0, count = get(4); valid && i < count; i++)
+        {
+            string name = getString();
+            m_partMemories[name] = get(4);
+        }
+        munmap(mapped, info.st_size);
+
+        if (!valid || pos != end || m_levelStart.empty() || m_levelStart.back() != m_gates.size() ||
+            m_memoryLevelStart.size() != m_levelStart.size())
+        {
+            *this = Netlist();
+            return false;
+        }
+        return true;
+    }
+
+    const string &error() const
+    {
+        return m_error;
+    }
+
+private:
+    static constexpr uint64_t CACHE_MAGIC = 0x3230544C4E4C4448ull;
+
+    uint32_t newWire(bool driven)
+    {
+        m_parent.push_back(m_parent.size());
+        m_driven.push_back(driven);
+        return m_parent.size() - 1;
+    }
+
+    uint32_t find(uint32_t wire)
+    {
+        while (m_parent[wire] != wire)
+        {
+            m_parent[wire] = m_parent[m_parent[wire]];
+            wire = m_parent[wire];
+        }
+        return wire;
+    }
+
+    bool fail(const string &message)
+    {
+        m_error = m_contextChip ? m_contextChip->path + ":" + to_string(m_contextLine) + ": " + message : message;
+        return false;
+    }
+
+    bool join(uint32_t a, uint32_t b, const string &pinName)
+    {
+        a = find(a);
+        b = find(b);
+        if (a == b)
+        {
+            return true;
+        }
+        if (m_driven[a] && m_driven[b])
+        {
+            return fail("pin " + pinName + " has more than one source");
+        }
+
+        m_parent[b] = a;
+        m_driven[a] |= m_driven[b];
+        return true;
+    }
+
+    bool drive(uint32_t wire)
+    {
+        wire = find(wire);
+        if (m_driven[wire])
+        {
+            return fail("a pin has more than one source");
+        }
+        m_driven[wire] = true;
+        return true;
+    }
+
+    // Lays out a chip and, recursively, the chips of its parts, checking
+    // every connection.
+    Layout *resolve(HDLLibrary &library, const HDLChip &chip)
+    {
+        Layout &layout = m_layouts[&chip];
+        if (layout.chip != nullptr)
+        {
+            if (layout.resolving)
+            {
+                fail("chip " + chip.name + " contains itself");
+                return nullptr;
+            }
+            return &layout;
+        }
+
+        layout.chip = &chip;
+        layout.resolving = true;
+        for (const auto &pins : {&chip.inputs, &chip.outputs})
+        {
+            for (const auto &pin : *pins)
+            {
+                layout.pins[pin.name] = {layout.width, pin.width};
+                layout.width += pin.width;
+            }
+            layout.inputWidth = pins == &chip.inputs ? layout.width : layout.inputWidth;
+        }
+        layout.ioWidth = layout.width;
+
+        for (const auto &part : chip.parts)
+        {
+            const HDLChip *partChip = library.part(part.chip);
+            Layout *partLayout = partChip == nullptr ? nullptr : resolve(library, *partChip);
+            m_contextChip = &chip;
+            m_contextLine = part.line;
+            if (partChip == nullptr)
+            {
+                fail(library.error());
+                return nullptr;
+            }
+            if (partLayout == nullptr)
+            {
+                return nullptr;
+            }
+            layout.parts.push_back({partLayout, &part.chip, part.line, {}});
+
+            // An internal pin is as wide as the part output driving it.
+            for (const auto &connection : part.connections)
+            {
+                bool input = false;
+                const HDLPin *pin = partChip->findPin(connection.pin, input);
+                if (pin == nullptr)
+                {
+                    fail("chip " + part.chip + " has no pin " + connection.pin);
+                    return nullptr;
+                }
+                if (!input && (connection.wire == "true" || connection.wire == "false"))
+                {
+                    fail("cannot connect output " + connection.pin + " to " + connection.wire);
+                    return nullptr;
+                }
+                if (!input && !chip.findPin(connection.wire, input))
+                {
+                    int width = connection.wireTo >= 0 ? connection.wireTo + 1 : connection.pinFrom >= 0 ? connection.pinTo - connection.pinFrom + 1 : pin->width;
+                    auto &range = layout.pins.emplace(connection.wire, make_pair(-1, 0)).first->second;
+                    range.second = max(range.second, width);
+                }
+            }
+        }
+
+        for (auto &[name, range] : layout.pins)
+        {
+            if (range.first < 0)
+            {
+                range.first = layout.width;
+                layout.width += range.second;
+            }
+        }
+        layout.resolving = false;
+
+        for (size_t i = 0; i < chip.parts.size(); i++)
+        {
+            m_contextLine = chip.parts[i].line;
+            for (const auto &connection : chip.parts[i].connections)
+            {
+                if (!link(layout, *layout.parts[i].layout, connection, layout.parts[i].links))
+                {
+                    return nullptr;
+                }
+            }
+        }
+
+        return &layout;
+    }
+
+    // Resolves a connection to pairs of part and chip bits.
+    bool link(const Layout &layout, const Layout &partLayout, const HDLConnection &connection, vector<Layout::Link> &links)
+    {
+        auto pin = partLayout.pins.find(connection.pin);
+        bool input = pin->second.first < partLayout.inputWidth;
+        int pinFrom = connection.pinFrom >= 0 ? connection.pinFrom : 0;
+        int pinTo = connection.pinFrom >= 0 ? connection.pinTo : pin->second.second - 1;
+        if (pinTo >= pin->second.second)
+        {
+            return fail("pin " + connection.pin + " of " + partLayout.chip->name + " has no bit " + to_string(pinTo));
+        }
+
+        if (connection.wire == "true" || connection.wire == "false")
+        {
+            for (int bit = pinFrom; bit <= pinTo; bit++)
+            {
+                links.push_back({true, pin->second.first + bit, connection.wire == "true" ? -2 : -1, &connection.wire});
+            }
+            return true;
+        }
+
+        auto wire = layout.pins.find(connection.wire);
+        if (wire == layout.pins.end())
+        {
+            return fail("pin " + connection.wire + " has no source");
+        }
+        if (!input && wire->second.first < layout.inputWidth)
+        {
+            return fail("cannot connect output " + connection.pin + " to input pin " + connection.wire);
+        }
+
+        int width = wire->second.second;
+        int wireFrom = connection.wireFrom >= 0 ? connection.wireFrom : 0;
+        int wireTo = connection.wireFrom >= 0 ? connection.wireTo : width - 1;
+        if (wireTo >= width)
+        {
+            return fail("pin " + connection.wire + " has no bit " + to_string(wireTo));
+        }
+        if (wireTo - wireFrom != pinTo - pinFrom)
+        {
+            return fail("width of " + connection.pin + " does not match " + connection.wire);
+        }
+
+        for (int bit = 0; bit <= pinTo - pinFrom; bit++)
+        {
+            links.push_back({input, pin->second.first + pinFrom + bit, wire->second.first + wireFrom + bit, &connection.wire});
+        }
+        return true;
+    }
+
+    bool instantiateBuiltin(const Layout &layout, const uint32_t *io)
+    {
+        for (int bit = layout.inputWidth; bit < layout.ioWidth; bit++)
+        {
+            if (!drive(io[bit]))
+            {
+                return false;
+            }
+        }
+
+        switch (layout.chip->builtin)
+        {
+        case HDLChip::NAND:
+            m_gates.push_back({io[0], io[1], io[2]});
+            if (m_recordParts)
+            {
+                m_gateParts.push_back(m_currentPart);
+            }
+            return true;
+
+        case HDLChip::DFF:
+            m_flops.push_back({io[0], io[1]});
+            if (m_recordParts)
+            {
+                m_flopParts.push_back(m_currentPart);
+            }
+            return true;
+
+        default:
+            auto bus = [&](const string &name)
+            {
+                auto pin = layout.pins.find(name);
+                return pin == layout.pins.end() ? Bus() : Bus(io + pin->second.first, io + pin->second.first + pin->second.second);
+            };
+
+            Memory memory;
+            memory.name = layout.chip->name;
+            memory.kind = layout.chip->builtin;
+            memory.in = bus("in");
+            memory.load = layout.pins.count("load") ? bus("load")[0] : FALSE_WIRE;
+            memory.address = bus("address");
+            memory.out = bus("out");
+            m_partMemories.insert({memory.name, m_memories.size()});
+            m_memories.push_back(move(memory));
+            return true;
+        }
+    }
+
+    // Flattens a chip whose input and output pins are the given wires into
+    // the netlist; wires receives all of the chip's pins.
+    bool instantiate(Layout &layout, const uint32_t *io, vector<uint32_t> &wires)
+    {
+        wires.resize(layout.width);
+        copy(io, io + layout.ioWidth, wires.begin());
+        for (int bit = layout.ioWidth; bit < layout.width; bit++)
+        {
+            wires[bit] = newWire(false);
+        }
+
+        vector<uint32_t> partWires;
+        vector<uint32_t> partIo;
+        for (const auto &part : layout.parts)
+        {
+            const Layout &partLayout = *part.layout;
+            partIo.assign(partLayout.ioWidth, FALSE_WIRE);
+            for (int bit = partLayout.inputWidth; bit < partLayout.ioWidth; bit++)
+            {
+                partIo[bit] = newWire(false);
+            }
+
+            m_contextChip = layout.chip;
+            m_contextLine = part.line;
+            for (const auto &link : part.links)
+            {
+                if (link.input)
+                {
+                    partIo[link.partBit] = link.bit == -2 ? TRUE_WIRE : link.bit == -1 ? FALSE_WIRE : wires[link.bit];
+                }
+                else if (!join(wires[link.bit], partIo[link.partBit], *link.wire))
+                {
+                    return false;
+                }
+            }
+
+            uint32_t parentPart = m_currentPart;
+            if (m_recordParts && partLayout.chip->builtin == HDLChip::NONE)
+            {
+                m_parts.push_back({*part.chipName, part.line, parentPart});
+                m_currentPart = m_parts.size() - 1;
+            }
+            if (partLayout.chip->builtin != HDLChip::NONE ? !instantiateBuiltin(partLayout, partIo.data()) : !instantiate(*part.layout, partIo.data(), partWires))
+            {
+                return false;
+            }
+            m_currentPart = parentPart;
+
+            if (m_instanceChips.count(*part.chipName))
+            {
+                Instance instance = {*part.chipName, {}};
+                for (const auto &[name, range] : partLayout.pins)
+                {
+                    if (range.first >= partLayout.ioWidth)
+                    {
+                        continue;
+                    }
+                    instance.pins[name] = Bus(partIo.begin() + range.first, partIo.begin() + range.first + range.second);
+                }
+                m_instances.push_back(move(instance));
+            }
+
+            auto out = partLayout.pins.find("out");
+            if (!partLayout.recorded && partLayout.chip->builtin == HDLChip::NONE && out != partLayout.pins.end())
+            {
+                m_partOutputs.insert({*part.chipName, Bus(partIo.begin() + out->second.first, partIo.begin() + out->second.first + out->second.second)});
+                auto address = partLayout.pins.find("address");
+                if (address != partLayout.pins.end() && address->second.first < partLayout.inputWidth)
+                {
+                    m_partAddresses.insert({*part.chipName, Bus(partIo.begin() + address->second.first, partIo.begin() + address->second.first + address->second.second)});
+                }
+                part.layout->recorded = true;
+            }
+        }
+
+        return true;
+    }
+
+    // Numbers the merged wires densely, keeping the constants at 0 and 1.
+    void compact()
+    {
+        vector<uint32_t> ids(m_parent.size(), UINT32_MAX);
+        auto id = [&](uint32_t &wire)
+        {
+            uint32_t root = find(wire);
+            if (ids[root] == UINT32_MAX)
+            {
+                ids[root] = m_wireCount++;
+            }
+            wire = ids[root];
+        };
+        auto busIds = [&](Bus &bus)
+        {
+            for (auto &wire : bus)
+            {
+                id(wire);
+            }
+        };
+
+        uint32_t falseWire = FALSE_WIRE, trueWire = TRUE_WIRE;
+        id(falseWire);
+        id(trueWire);
+        for (auto &[name, pin] : m_pins)
+        {
+            busIds(pin.wires);
+        }
+        for (auto &gate : m_gates)
+        {
+            id(gate.a);
+            id(gate.b);
+            id(gate.out);
+        }
+        for (auto &flop : m_flops)
+        {
+            id(flop.in);
+            id(flop.out);
+        }
+        for (auto &memory : m_memories)
+        {
+            busIds(memory.in);
+            id(memory.load);
+            busIds(memory.address);
+            busIds(memory.out);
+        }
+        for (auto &[name, bus] : m_partOutputs)
+        {
+            busIds(bus);
+        }
+        for (auto &[name, bus] : m_partAddresses)
+        {
+            busIds(bus);
+        }
+        for (auto &instance : m_instances)
+        {
+            for (auto &[name, bus] : instance.pins)
+            {
+                busIds(bus);
+            }
+        }
+
+        m_parent = vector<uint32_t>();
+        m_driven = vector<uint8_t>();
+    }
+
+    // Orders the gates and memory reads by level with Kahn's algorithm;
+    // a gate's level is one more than that of its latest input.
+    bool levelize()
+    {
+        size_t nodeCount = m_gates.size() + m_memories.size();
+        vector<int32_t> producer(m_wireCount, -1);
+        for (size_t i = 0; i < m_gates.size(); i++)
+        {
+            producer[m_gates[i].out] = i;
+        }
+        for (size_t i = 0; i < m_memories.size(); i++)
+        {
+            for (auto wire : m_memories[i].out)
+            {
+                producer[wire] = m_gates.size() + i;
+            }
+        }
+
+        auto forEachInput = [&](size_t node, auto visit)
+        {
+            if (node < m_gates.size())
+            {
+                visit(m_gates[node].a);
+                visit(m_gates[node].b);
+                return;
+            }
+            for (auto wire : m_memories[node - m_gates.size()].address)
+            {
+                visit(wire);
+            }
+        };
+
+        vector<uint32_t> pending(nodeCount, 0);
+        vector<uint32_t> edgeStart(nodeCount + 1, 0);
+        for (size_t node = 0; node < nodeCount; node++)
+        {
+            forEachInput(node, [&](uint32_t wire)
+                         {
+                if (producer[wire] >= 0)
+                {
+                    pending[node]++;
+                    edgeStart[producer[wire] + 1]++;
+                } });
+        }
+        for (size_t node = 0; node < nodeCount; node++)
+        {
+            edgeStart[node + 1] += edgeStart[node];
+        }
+
+        vector<uint32_t> edges(edgeStart[nodeCount]);
+        vector<uint32_t> fill(edgeStart.begin(), edgeStart.end() - 1);
+        for (size_t node = 0; node < nodeCount; node++)
+        {
+            forEachInput(node, [&](uint32_t wire)
+                         {
+                if (producer[wire] >= 0)
+                {
+                    edges[fill[producer[wire]]++] = node;
+                } });
+        }
+
+        vector<uint32_t> levels(nodeCount, 0);
+        vector<uint32_t> queue;
+        for (size_t node = 0; node < nodeCount; node++)
+        {
+            if (pending[node] == 0)
+            {
+                queue.push_back(node);
+            }
+        }
+        for (size_t i = 0; i < queue.size(); i++)
+        {
+            uint32_t node = queue[i];
+            for (uint32_t edge = edgeStart[node]; edge < edgeStart[node + 1]; edge++)
+            {
+                uint32_t next = edges[edge];
+                levels[next] = max(levels[next], levels[node] + 1);
+                if (--pending[next] == 0)
+                {
+                    queue.push_back(next);
+                }
+            }
+        }
+
+        if (queue.size() < nodeCount)
+        {
+            m_error = "the chip has a combinational loop";
+            return false;
+        }
+
+        uint32_t levelCount = 1;
+        for (auto level : levels)
+        {
+            levelCount = max(levelCount, level + 1);
+        }
+
+        m_levelStart = sortByLevel(m_gates, levels.begin(), levelCount);
+        if (m_recordParts)
+        {
+            sortByLevel(m_gateParts, levels.begin(), levelCount);
+        }
+        for (size_t i = 0; i < m_memories.size(); i++)
+        {
+            m_memories[i].level = levels[m_gates.size() + i];
+        }
+
+        vector<size_t> order(m_memories.size());
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            order[i] = i;
+        }
+        stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                    { return m_memories[a].level < m_memories[b].level; });
+
+        vector<Memory> memories;
+        vector<size_t> position(order.size());
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            position[order[i]] = i;
+            memories.push_back(move(m_memories[order[i]]));
+        }
+        m_memories = move(memories);
+        for (auto &[name, index] : m_partMemories)
+        {
+            index = position[index];
+        }
+
+        m_memoryLevelStart.assign(levelCount + 1, 0);
+        for (const auto &memory : m_memories)
+        {
+            m_memoryLevelStart[memory.level + 1]++;
+        }
+        for (uint32_t level = 0; level < levelCount; level++)
+        {
+            m_memoryLevelStart[level + 1] += m_memoryLevelStart[level];
+        }
+
+        return true;
+    }
+
+    // Stably sorts the items by level with a counting sort and returns where
+    // each level starts.
+    template <typename Item, typename Levels>
+    static vector<uint32_t> sortByLevel(vector<Item> &items, Levels levels, uint32_t levelCount)
+    {
+        vector<uint32_t> start(levelCount + 1, 0);
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            start[levels[i] + 1]++;
+        }
+        for (uint32_t level = 0; level < levelCount; level++)
+        {
+            start[level + 1] += start[level];
+        }
+
+        vector<Item> sorted(items.size());
+        vector<uint32_t> fill(start.begin(), start.end() - 1);
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            sorted[fill[levels[i]]++] = items[i];
+        }
+        items = move(sorted);
+        return start;
+    }
+};
+
+// A netlist evaluation compiled to C++ by hdl-codegen. Linking a generated
+// file into a simulator registers its function, which ChipSimulator then
+// runs in place of its gate sweep for the netlist it was generated from.
+class CompiledChip
+{
+public:
+    typedef void (*Eval)(uint8_t *values, int16_t *const *memories);
+
+    CompiledChip(const string &chipName, uint64_t signature, Eval eval)
+    {
+        registry()[chipName] = {signature, eval};
+    }
+
+    // The compiled evaluation of a chip, or nullptr if there is none for a
+    // netlist with this signature.
+    static Eval find(const string &chipName, uint64_t signature)
+    {
+        auto found = registry().find(chipName);
+        return found == registry().end() || found->second.first != signature ? nullptr : found->second.second;
+    }
+
+private:
+    static map<string, pair<uint64_t, Eval>> &registry()
+    {
+        static map<string, pair<uint64_t, Eval>> chips;
+        return chips;
+    }
+};
+
+// Evaluates the gates of a level on several threads, the calling thread
+// included. Each level is partitioned into one run of consecutive gates per
+// thread: gates of a level are stored in the order their parts were
+// flattened, so a run mostly covers whole chip parts, and its ends are moved
+// to where the fewest wires written by another part's gates are read. A
+// thread evaluates its own part first, in chunks taken from the part's
+// counter, and then steals the chunks left in the other parts. Threads meet
+// at a barrier before and after each level.
+class LevelPool
+{
+public:
+    // Part p of level l is gates [start[l * (parts + 1) + p],
+    // start[l * (parts + 1) + p + 1]). Levels too small for the pool are
+    // left whole in part 0, which the calling thread sweeps.
+    struct Partition
+    {
+        int parts = 1;
+        vector<uint32_t> start;
+
+        // The wires pooled gates read from another part than the one that
+        // wrote them, counted once per reading part, and as many for cutting
+        // every level into equal runs of consecutive gates instead.
+        uint64_t cut = 0;
+        uint64_t consecutiveCut = 0;
+    };
+
+private:
+    // A barrier whose waiting threads spin, yielding, for a while before
+    // they sleep: a level takes microseconds, but between evals the workers
+    // would otherwise keep their CPUs busy for as long as the pool lives.
+    class Barrier
+    {
+    private:
+        static constexpr int SPINS = 1000;
+
+        atomic<uint32_t> m_arrived{0};
+        atomic<uint32_t> m_phase{0};
+        atomic<uint32_t> m_sleeping{0};
+        uint32_t m_threads;
+        mutex m_mutex;
+        condition_variable m_released;
+
+    public:
+        explicit Barrier(uint32_t threads) : m_threads(threads)
+        {
+        }
+
+        void wait()
+        {
+            uint32_t phase = m_phase.load(memory_order_acquire);
+            if (m_arrived.fetch_add(1, memory_order_acq_rel) + 1 == m_threads)
+            {
+                m_arrived.store(0, memory_order_relaxed);
+                m_phase.fetch_add(1);
+                if (m_sleeping.load() > 0)
+                {
+                    lock_guard<mutex> lock(m_mutex);
+                    m_released.notify_all();
+                }
+                return;
+            }
+
+            for (int spin = 0; spin < SPINS; spin++)
+            {
+                if (m_phase.load(memory_order_acquire) != phase)
+                {
+                    return;
+                }
+                this_thread::yield();
+            }
+
+            // The sleeper is counted before it checks the phase, so the
+            // last thread either sees it and wakes it or releases it first.
+            unique_lock<mutex> lock(m_mutex);
+            m_sleeping.fetch_add(1);
+            m_released.wait(lock, [&]
+                            { return m_phase.load() != phase; });
+            m_sleeping.fetch_sub(1);
+        }
+    };
+
+    // The next chunk of a part, on a cache line of its own.
+    struct alignas(64) Counter
+    {
+        atomic<uint32_t> next{0};
+    };
+
+    vector<thread> m_threads;
+    Barrier m_start;
+    Barrier m_finish;
+    vector<Counter> m_nextChunk;
+    const Netlist::Gate *m_gates = nullptr;
+    uint8_t *m_values = nullptr;
+    const uint32_t *m_partStart = nullptr;
+    bool m_stop = false;
+
+public:
+    static constexpr uint32_t CHUNK_GATES = 1024;
+
+    // Levels with fewer gates are not worth the barriers.
+    static constexpr uint32_t MIN_GATES = 4 * CHUNK_GATES;
+
+    explicit LevelPool(int threads) : m_start(threads), m_finish(threads), m_nextChunk(threads)
+    {
+        for (int i = 1; i < threads; i++)
+        {
+            m_threads.emplace_back(&LevelPool::work, this, i);
+        }
+    }
+
+    ~LevelPool()
+    {
+        m_stop = true;
+        m_start.wait();
+        for (auto &thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    int threads() const
+    {
+        return m_threads.size() + 1;
+    }
+
+    // Partitions the levels of the netlist with at least MIN_GATES gates
+    // into the given number of parts.
+    static Partition partition(const Netlist &netlist, int parts)
+    {
+        Partition result;
+        result.parts = parts;
+        const auto &gates = netlist.gates();
+        const auto &levelStart = netlist.levelStart();
+        if (levelStart.empty())
+        {
+            return result;
+        }
+        result.start.reserve(netlist.levelCount() * (parts + 1));
+
+        // The part that wrote each wire, in the partition and cut into
+        // consecutive runs, or -1 for wires no gate writes.
+        vector<int32_t> owner(netlist.wireCount(), -1);
+        vector<int32_t> consecutiveOwner(netlist.wireCount(), -1);
+        // Each wire a part reads from another part, as wire * parts + part.
+        unordered_set<uint64_t> crossing;
+        unordered_set<uint64_t> consecutiveCrossing;
+        auto read = [&](const vector<int32_t> &owners, unordered_set<uint64_t> &crossings, uint32_t wire, int32_t part)
+        {
+            if (owners[wire] >= 0 && owners[wire] != part)
+            {
+                crossings.insert((uint64_t)wire * parts + part);
+            }
+        };
+
+        for (size_t level = 0; level < netlist.levelCount(); level++)
+        {
+            uint32_t begin = levelStart[level];
+            uint32_t end = levelStart[level + 1];
+            uint32_t count = end - begin;
+            if (count < MIN_GATES)
+            {
+                result.start.push_back(begin);
+                result.start.insert(result.start.end(), parts, end);
+                for (uint32_t i = begin; i < end; i++)
+                {
+                    owner[gates[i].out] = 0;
+                    consecutiveOwner[gates[i].out] = 0;
+                }
+                continue;
+            }
+
+            // Each boundary moves from where equal parts would meet to the
+            // point within an eighth of a part that the fewest inputs cross,
+            // counting the inputs written by parts after the boundary that
+            // gates before it read, and the other way round.
+            uint32_t window = count / parts / 8;
+            result.start.push_back(begin);
+            for (int boundary = 1; boundary < parts; boundary++)
+            {
+                uint32_t even = begin + (uint64_t)count * boundary / parts;
+                uint32_t low = max(result.start.back(), even - window);
+                uint32_t high = even + window;
+                // The inputs of gate i written by parts after the boundary,
+                // or by parts before it.
+                auto inputs = [&](uint32_t i, bool writtenAfter)
+                {
+                    int crossings = 0;
+                    for (uint32_t wire : {gates[i].a, gates[i].b})
+                    {
+                        crossings += owner[wire] >= 0 && (owner[wire] >= boundary) == writtenAfter;
+                    }
+                    return crossings;
+                };
+
+                int crossings = 0;
+                for (uint32_t i = low; i < high; i++)
+                {
+                    crossings += inputs(i, false);
+                }
+                uint32_t best = low;
+                int fewest = crossings;
+                for (uint32_t split = low + 1; split <= high; split++)
+                {
+                    crossings += inputs(split - 1, true) - inputs(split - 1, false);
+                    if (crossings < fewest || (crossings == fewest && split <= even))
+                    {
+                        best = split;
+                        fewest = crossings;
+                    }
+                }
+                result.start.push_back(best);
+            }
+            result.start.push_back(end);
+
+            const uint32_t *partStart = &result.start[result.start.size() - parts - 1];
+            int32_t part = 0;
+            for (uint32_t i = begin; i < end; i++)
+            {
+                while (i >= partStart[part + 1])
+                {
+                    part++;
+                }
+                int32_t consecutive = (uint64_t)(i - begin) * parts / count;
+                for (uint32_t wire : {gates[i].a, gates[i].b})
+                {
+                    read(owner, crossing, wire, part);
+                    read(consecutiveOwner, consecutiveCrossing, wire, consecutive);
+                }
+
+                // Gates of a level do not read each other's outputs, so a
+                // gate's owner can be set before the rest are counted.
+                owner[gates[i].out] = part;
+                consecutiveOwner[gates[i].out] = consecutive;
+            }
+        }
+
+        result.cut = crossing.size();
+        result.consecutiveCut = consecutiveCrossing.size();
+        return result;
+    }
+
+    // Evaluates the parts of a level, whose gates must not depend on each
+    // other, given where each of the threads() parts starts.
+    void run(const Netlist::Gate *gates, uint8_t *values, const uint32_t *partStart)
+    {
+        m_gates = gates;
+        m_values = values;
+        m_partStart = partStart;
+        for (auto &counter : m_nextChunk)
+        {
+            counter.next.store(0, memory_order_relaxed);
+        }
+
+        m_start.wait();
+        evaluateParts(0);
+        m_finish.wait();
+    }
+
+private:
+    void work(int index)
+    {
+        while (true)
+        {
+            m_start.wait();
+            if (m_stop)
+            {
+                return;
+            }
+            evaluateParts(index);
+            m_finish.wait();
+        }
+    }
+
+    void evaluateParts(int index)
+    {
+        int parts = threads();
+        for (int i = 0; i < parts; i++)
+        {
+            int part = (index + i) % parts;
+            uint32_t begin = m_partStart[part];
+            uint32_t end = m_partStart[part + 1];
+            auto &counter = m_nextChunk[part].next;
+            for (uint32_t chunk = counter.fetch_add(1, memory_order_relaxed); begin + chunk * CHUNK_GATES < end;
+                 chunk = counter.fetch_add(1, memory_order_relaxed))
+            {
+                uint32_t chunkEnd = min(end, begin + (chunk + 1) * CHUNK_GATES);
+                for (uint32_t g = begin + chunk * CHUNK_GATES; g < chunkEnd; g++)
+                {
+                    const auto &gate = m_gates[g];
+                    m_values[gate.out] = (m_values[gate.a] & m_values[gate.b]) ^ 1;
+                }
+            }
+        }
+    }
+};
+
+// Simulates a netlist with one byte per wire. eval() sweeps the levelized
+// gates once; tick() samples the DFF inputs and memory writes on the rising
+// clock edge and tock() makes them visible on the falling one, as the
+// hardware simulator does. In event-driven mode eval() instead evaluates
+// only the gates and memory reads whose inputs changed, level by level, and
+// with several threads the sweep shares large levels among them.
+class ChipSimulator
+{
+private:
+    struct Write
+    {
+        bool pending = false;
+        uint16_t address = 0;
+        int16_t value = 0;
+    };
+
+    Netlist m_netlist;
+    vector<uint8_t> m_values;
+    vector<uint8_t> m_state;
+    vector<int32_t> m_flopDriving;
+    vector<vector<int16_t>> m_memoryData;
+    vector<int16_t *> m_memoryPointers;
+    vector<Write> m_writes;
+    map<pair<string, int>, vector<uint32_t>> m_words;
+    CompiledChip::Eval m_compiled = nullptr;
+    unique_ptr<LevelPool> m_pool;
+    LevelPool::Partition m_partition;
+    filesystem::path m_cacheDirectory;
+    uint64_t m_evaluations = 0;
+    string m_error;
+
+    // The gates are nodes 0 to gates - 1 and the memory reads follow. A
+    // node's level is twice its netlist level, plus one for memory reads,
+    // which come after the gates of their level.
+    bool m_eventDriven = false;
+    vector<uint32_t> m_fanoutStart;
+    vector<uint32_t> m_fanout;
+    vector<uint32_t> m_nodeLevel;
+    vector<vector<uint32_t>> m_queues;
+    vector<uint8_t> m_queued;
+
+public:
+    bool load(HDLLibrary &library, const string &chipName)
+    {
+        if (!buildNetlist(library, chipName))
+        {
+            return false;
+        }
+
+        m_values.assign(m_netlist.wireCount(), 0);
+        m_values[Netlist::TRUE_WIRE] = 1;
+        m_state.assign(m_netlist.flops().size(), 0);
+        m_flopDriving.assign(m_netlist.wireCount(), -1);
+        for (size_t i = 0; i < m_netlist.flops().size(); i++)
+        {
+            m_flopDriving[m_netlist.flops()[i].out] = i;
+        }
+        m_memoryData.clear();
+        for (const auto &memory : m_netlist.memories())
+        {
+            m_memoryData.emplace_back(memory.kind == HDLChip::KEYBOARD ? 1 : 1 << memory.address.size(), 0);
+        }
+        m_memoryPointers.clear();
+        for (auto &data : m_memoryData)
+        {
+            m_memoryPointers.push_back(data.data());
+        }
+        m_writes.assign(m_netlist.memories().size(), Write());
+        m_words.clear();
+        m_compiled = CompiledChip::find(chipName, m_netlist.signature());
+        m_evaluations = 0;
+        partition();
+        setEventDriven(m_eventDriven);
+        eval();
+        return true;
+    }
+
+    // Switches between sweeping the whole netlist in eval() and evaluating
+    // only what changed since the last eval(). The first eval() after
+    // switching on evaluates everything.
+    void setEventDriven(bool eventDriven)
+    {
+        m_eventDriven = eventDriven;
+        m_fanoutStart.clear();
+        m_fanout.clear();
+        m_queues.clear();
+        if (!eventDriven)
+        {
+            return;
+        }
+
+        const auto &gates = m_netlist.gates();
+        const auto &memories = m_netlist.memories();
+        size_t nodeCount = gates.size() + memories.size();
+        m_nodeLevel.assign(nodeCount, 0);
+        for (size_t level = 0; level < m_netlist.levelCount(); level++)
+        {
+            for (uint32_t i = m_netlist.levelStart()[level]; i < m_netlist.levelStart()[level + 1]; i++)
+            {
+                m_nodeLevel[i] = 2 * level;
+            }
+            for (uint32_t i = m_netlist.memoryLevelStart()[level]; i < m_netlist.memoryLevelStart()[level + 1]; i++)
+            {
+                m_nodeLevel[gates.size() + i] = 2 * level + 1;
+            }
+        }
+
+        // The nodes reading each wire, as a compressed sparse row.
+        auto forEachReader = [&](auto visit)
+        {
+            for (size_t i = 0; i < gates.size(); i++)
+            {
+                visit(gates[i].a, i);
+                visit(gates[i].b, i);
+            }
+            for (size_t i = 0; i < memories.size(); i++)
+            {
+                for (auto wire : memories[i].address)
+                {
+                    visit(wire, gates.size() + i);
+                }
+            }
+        };
+        m_fanoutStart.assign(m_netlist.wireCount() + 1, 0);
+        forEachReader([&](uint32_t wire, uint32_t)
+                      { m_fanoutStart[wire + 1]++; });
+        for (size_t wire = 0; wire < m_netlist.wireCount(); wire++)
+        {
+            m_fanoutStart[wire + 1] += m_fanoutStart[wire];
+        }
+        vector<uint32_t> next(m_fanoutStart.begin(), m_fanoutStart.end() - 1);
+        m_fanout.resize(m_fanoutStart.back());
+        forEachReader([&](uint32_t wire, uint32_t node)
+                      { m_fanout[next[wire]++] = node; });
+
+        m_queues.assign(2 * m_netlist.levelCount(), {});
+        m_queued.assign(nodeCount, false);
+        for (uint32_t node = 0; node < nodeCount; node++)
+        {
+            schedule(node);
+        }
+    }
+
+    // Keeps flattened netlists in the directory, keyed by the content hash
+    // of their .hdl files, so later loads of an unchanged chip skip parsing
+    // and flattening.
+    void setCacheDirectory(const filesystem::path &directory)
+    {
+        m_cacheDirectory = directory;
+    }
+
+    // Sets the number of threads sweeping large levels, 1 for none.
+    void setThreads(int threads)
+    {
+        m_pool = threads > 1 ? make_unique<LevelPool>(threads) : nullptr;
+        partition();
+    }
+
+    // How the levels are shared among the threads, when there are several.
+    const LevelPool::Partition &levelPartition() const
+    {
+        return m_partition;
+    }
+
+    // The gates and memory reads evaluated since the chip was loaded.
+    uint64_t evaluations() const
+    {
+        return m_evaluations;
+    }
+
+    const Netlist &netlist() const
+    {
+        return m_netlist;
+    }
+
+    // Whether eval() runs code generated for the chip by hdl-codegen.
+    bool compiled() const
+    {
+        return m_compiled != nullptr;
+    }
+
+    void eval()
+    {
+        if (m_eventDriven)
+        {
+            evalEvents();
+            return;
+        }
+
+        if (m_compiled != nullptr)
+        {
+            m_compiled(m_values.data(), m_memoryPointers.data());
+            m_evaluations += m_netlist.gates().size() + m_netlist.memories().size();
+            return;
+        }
+
+        const auto &gates = m_netlist.gates();
+        const auto &levelStart = m_netlist.levelStart();
+        const auto &memories = m_netlist.memories();
+        const auto &memoryLevelStart = m_netlist.memoryLevelStart();
+        uint8_t *values = m_values.data();
+
+        for (size_t level = 0; level < m_netlist.levelCount(); level++)
+        {
+            if (m_pool != nullptr && levelStart[level + 1] - levelStart[level] >= LevelPool::MIN_GATES)
+            {
+                m_pool->run(gates.data(), values, &m_partition.start[level * (m_partition.parts + 1)]);
+            }
+            else
+            {
+                for (uint32_t i = levelStart[level]; i < levelStart[level + 1]; i++)
+                {
+                    const auto &gate = gates[i];
+                    values[gate.out] = (values[gate.a] & values[gate.b]) ^ 1;
+                }
+            }
+
+            for (uint32_t i = memoryLevelStart[level]; i < memoryLevelStart[level + 1]; i++)
+            {
+                int16_t value = m_memoryData[i][read(memories[i].address)];
+                for (size_t bit = 0; bit < memories[i].out.size(); bit++)
+                {
+                    values[memories[i].out[bit]] = (value >> bit) & 1;
+                }
+            }
+        }
+        m_evaluations += gates.size() + memories.size();
+    }
+
+    void tick()
+    {
+        eval();
+
+        const auto &flops = m_netlist.flops();
+        for (size_t i = 0; i < flops.size(); i++)
+        {
+            m_state[i] = m_values[flops[i].in];
+        }
+
+        const auto &memories = m_netlist.memories();
+        for (size_t i = 0; i < memories.size(); i++)
+        {
+            m_writes[i].pending = memories[i].kind == HDLChip::RAM && m_values[memories[i].load];
+            if (m_writes[i].pending)
+            {
+                m_writes[i].address = read(memories[i].address);
+                m_writes[i].value = read(memories[i].in);
+            }
+        }
+    }
+
+    void tock()
+    {
+        const auto &flops = m_netlist.flops();
+        for (size_t i = 0; i < flops.size(); i++)
+        {
+            change(flops[i].out, m_state[i]);
+        }
+
+        for (size_t i = 0; i < m_writes.size(); i++)
+        {
+            if (m_writes[i].pending)
+            {
+                m_memoryData[i][m_writes[i].address] = m_writes[i].value;
+                m_writes[i].pending = false;
+                scheduleMemory(i);
+            }
+        }
+
+        eval();
+    }
+
+    // Loads a .hack file into the ROM32K part.
+    bool loadROM(const string &filename)
+    {
+        int memory = m_netlist.partMemory("ROM32K");
+        if (memory < 0)
+        {
+            m_error = "the chip has no ROM32K";
+            return false;
+        }
+
+        ifstream file(filename);
+        if (!file)
+        {
+            m_error = "cannot open " + filename;
+            return false;
+        }
+
+        auto &data = m_memoryData[memory];
+        fill(data.begin(), data.end(), 0);
+        string line;
+        for (size_t address = 0; getline(file, line) && address < data.size();)
+        {
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (!line.empty())
+            {
+                data[address++] = stoi(line, nullptr, 2);
+            }
+        }
+
+        scheduleMemory(memory);
+        eval();
+        return true;
+    }
+
+    // Reads a pin of the chip, or the state of a part: Register[] is the
+    // value held by the first part using the Register chip and RAM16K[i] a
+    // word of the first RAM16K, builtin or flattened.
+    bool get(const string &name, int16_t &value)
+    {
+        const auto &pins = m_netlist.pins();
+        auto pin = pins.find(name);
+        if (pin != pins.end())
+        {
+            value = read(pin->second.wires);
+            return true;
+        }
+
+        string chipName;
+        int index = 0;
+        if (!partState(name, chipName, index))
+        {
+            return false;
+        }
+
+        int memory = m_netlist.partMemory(chipName);
+        if (memory >= 0)
+        {
+            value = m_memoryData[memory][index % m_memoryData[memory].size()];
+            return true;
+        }
+
+        if (m_netlist.partAddress(chipName) != nullptr)
+        {
+            const vector<uint32_t> *bits = partWord(chipName, index);
+            if (bits == nullptr)
+            {
+                return false;
+            }
+
+            value = 0;
+            for (size_t bit = 0; bit < bits->size(); bit++)
+            {
+                value |= (m_state[(*bits)[bit] >> 1] ^ ((*bits)[bit] & 1)) << bit;
+            }
+            return true;
+        }
+
+        value = 0;
+        const Netlist::Bus &out = *m_netlist.partOutput(chipName);
+        for (size_t bit = 0; bit < out.size(); bit++)
+        {
+            int flop = m_flopDriving[out[bit]];
+            value |= (flop >= 0 ? m_state[flop] : m_values[out[bit]]) << bit;
+        }
+        return true;
+    }
+
+    bool set(const string &name, int16_t value)
+    {
+        const auto &pins = m_netlist.pins();
+        auto pin = pins.find(name);
+        if (pin != pins.end())
+        {
+            if (pin->second.kind != Netlist::INPUT)
+            {
+                m_error = "cannot set " + name + ", it is not an input pin";
+                return false;
+            }
+            write(pin->second.wires, value);
+            return true;
+        }
+
+        string chipName;
+        int index = 0;
+        if (!partState(name, chipName, index))
+        {
+            return false;
+        }
+
+        int memory = m_netlist.partMemory(chipName);
+        if (memory >= 0)
+        {
+            m_memoryData[memory][index % m_memoryData[memory].size()] = value;
+            scheduleMemory(memory);
+            return true;
+        }
+
+        if (m_netlist.partAddress(chipName) != nullptr)
+        {
+            const vector<uint32_t> *bits = partWord(chipName, index);
+            if (bits == nullptr)
+            {
+                return false;
+            }
+
+            for (size_t bit = 0; bit < bits->size(); bit++)
+            {
+                uint32_t flop = (*bits)[bit] >> 1;
+                m_state[flop] = ((value >> bit) & 1) ^ ((*bits)[bit] & 1);
+                change(m_netlist.flops()[flop].out, m_state[flop]);
+            }
+            return true;
+        }
+
+        const Netlist::Bus &out = *m_netlist.partOutput(chipName);
+        for (size_t bit = 0; bit < out.size(); bit++)
+        {
+            int flop = m_flopDriving[out[bit]];
+            if (flop >= 0)
+            {
+                m_state[flop] = (value >> bit) & 1;
+                change(out[bit], m_state[flop]);
+            }
+        }
+        return true;
+    }
+
+    const string &error() const
+    {
+        return m_error;
+    }
+
+private:
+    void partition()
+    {
+        m_partition = m_pool != nullptr ? LevelPool::partition(m_netlist, m_pool->threads()) : LevelPool::Partition();
+    }
+
+    bool buildNetlist(HDLLibrary &library, const string &chipName)
+    {
+        uint64_t key = 0;
+        filesystem::path cachePath;
+        if (!m_cacheDirectory.empty() && library.contentHash(chipName, key))
+        {
+            stringstream name;
+            name << chipName << "-" << hex << key << ".netlist";
+            cachePath = m_cacheDirectory / name.str();
+            if (m_netlist.load(cachePath.string(), key))
+            {
+                return true;
+            }
+        }
+
+        if (!m_netlist.build(library, chipName))
+        {
+            m_error = m_netlist.error();
+            return false;
+        }
+
+        // The cache only saves time, so failing to write it is no error.
+        if (!cachePath.empty())
+        {
+            error_code error;
+            filesystem::create_directories(m_cacheDirectory, error);
+            m_netlist.save(cachePath.string(), key);
+        }
+        return true;
+    }
+
+    int16_t read(const Netlist::Bus &bus) const
+    {
+        int value = 0;
+        for (size_t bit = 0; bit < bus.size(); bit++)
+        {
+            value |= m_values[bus[bit]] << bit;
+        }
+        return value;
+    }
+
+    void write(const Netlist::Bus &bus, int16_t value)
+    {
+        for (size_t bit = 0; bit < bus.size(); bit++)
+        {
+            change(bus[bit], (value >> bit) & 1);
+        }
+    }
+
+    // Sets a wire, scheduling its readers in event-driven mode.
+    void change(uint32_t wire, uint8_t value)
+    {
+        if (m_values[wire] == value)
+        {
+            return;
+        }
+
+        m_values[wire] = value;
+        if (m_eventDriven)
+        {
+            for (uint32_t i = m_fanoutStart[wire]; i < m_fanoutStart[wire + 1]; i++)
+            {
+                schedule(m_fanout[i]);
+            }
+        }
+    }
+
+    void schedule(uint32_t node)
+    {
+        if (!m_queued[node])
+        {
+            m_queued[node] = true;
+            m_queues[m_nodeLevel[node]].push_back(node);
+        }
+    }
+
+    // Schedules a memory's read after its contents changed.
+    void scheduleMemory(size_t memory)
+    {
+        if (m_eventDriven)
+        {
+            schedule(m_netlist.gates().size() + memory);
+        }
+    }
+
+    // Evaluates the scheduled nodes level by level; a node only schedules
+    // readers at higher levels, so each level is final once reached.
+    void evalEvents()
+    {
+        const auto &gates = m_netlist.gates();
+        const auto &memories = m_netlist.memories();
+        uint8_t *values = m_values.data();
+
+        for (auto &queue : m_queues)
+        {
+            for (auto node : queue)
+            {
+                m_queued[node] = false;
+                if (node < gates.size())
+                {
+                    const auto &gate = gates[node];
+                    change(gate.out, (values[gate.a] & values[gate.b]) ^ 1);
+                }
+                else
+                {
+                    const auto &memory = memories[node - gates.size()];
+                    write(memory.out, m_memoryData[node - gates.size()][read(memory.address)]);
+                }
+            }
+            m_evaluations += queue.size();
+            queue.clear();
+        }
+    }
+
+    // The flops holding a word of a flattened memory part, such as RAM16K
+    // with --gate-level, as the flop's index times two, plus one where the
+    // out bit is the flop's complement. The netlist is evaluated with the
+    // part's address pins fixed to the index and every other wire unknown
+    // unless it follows a single flop; each bit of the part's out pin must
+    // then follow one.
+    const vector<uint32_t> *partWord(const string &chipName, int index)
+    {
+        auto cached = m_words.find({chipName, index});
+        if (cached != m_words.end())
+        {
+            return &cached->second;
+        }
+
+        // A wire is 0, 1, flop * 2 + 2 plus one if inverted, or UNKNOWN.
+        const int32_t UNKNOWN = -1;
+        vector<int32_t> values(m_netlist.wireCount(), UNKNOWN);
+        vector<uint8_t> fixed(m_netlist.wireCount(), false);
+        values[Netlist::FALSE_WIRE] = 0;
+        values[Netlist::TRUE_WIRE] = 1;
+        for (size_t i = 0; i < m_netlist.flops().size(); i++)
+        {
+            values[m_netlist.flops()[i].out] = i * 2 + 2;
+        }
+
+        const Netlist::Bus &address = *m_netlist.partAddress(chipName);
+        for (size_t bit = 0; bit < address.size(); bit++)
+        {
+            if (address[bit] > Netlist::TRUE_WIRE)
+            {
+                values[address[bit]] = (index >> bit) & 1;
+                fixed[address[bit]] = true;
+            }
+        }
+
+        for (const auto &gate : m_netlist.gates())
+        {
+            int32_t a = values[gate.a];
+            int32_t b = values[gate.b];
+            if (fixed[gate.out])
+            {
+                continue;
+            }
+            else if (a == 0 || b == 0 || (a > 1 && (a ^ 1) == b))
+            {
+                values[gate.out] = 1;
+            }
+            else if (a == UNKNOWN || b == UNKNOWN || (a > 1 && b > 1 && a != b))
+            {
+                values[gate.out] = UNKNOWN;
+            }
+            else
+            {
+                values[gate.out] = (a == 1 ? b : a) ^ 1;
+            }
+        }
+
+        vector<uint32_t> bits;
+        for (auto wire : *m_netlist.partOutput(chipName))
+        {
+            if (values[wire] < 2)
+            {
+                m_error = "cannot find the register holding " + chipName + "[" + to_string(index) + "]";
+                return nullptr;
+            }
+            bits.push_back(values[wire] - 2);
+        }
+        return &m_words.emplace(make_pair(chipName, index), move(bits)).first->second;
+    }
+
+    // Splits Chip[] or Chip[i] into the chip name and index.
+    bool partState(const string &name, string &chipName, int &index)
+    {
+        auto bracketPos = name.find("[");
+        chipName = name.substr(0, bracketPos);
+        string digits = bracketPos == string::npos ? "" : name.substr(bracketPos + 1, name.size() - bracketPos - 2);
+
+        if (bracketPos == string::npos || name.back() != ']' || digits.find_first_not_of("0123456789") != string::npos ||
+            (m_netlist.partMemory(chipName) < 0 && m_netlist.partOutput(chipName) == nullptr))
+        {
+            m_error = "unknown variable " + name;
+            return false;
+        }
+
+        index = digits.empty() ? 0 : stoi(digits);
+        return true;
+    }
+};
+
+inline const HDLChip *HDLLibrary::part(const string &name)
+{
+    const HDLChip *chip = this->chip(name);
+    auto model = m_models.find(name);
+    if (model == m_models.end())
+    {
+        HDLChip memory;
+        if (!m_memoryModels || chip == nullptr || chip->builtin != HDLChip::NONE || name.compare(0, 3, "RAM") != 0 || !builtin(name, memory))
+        {
+            return chip;
+        }
+
+        // The entry is made first, so a RAM containing itself is flattened
+        // and reported.
+        auto samePins = [](const vector<HDLPin> &a, const vector<HDLPin> &b)
+        {
+            return equal(a.begin(), a.end(), b.begin(), b.end(), [](const HDLPin &x, const HDLPin &y)
+                         { return x.name == y.name && x.width == y.width; });
+        };
+        model = m_models.emplace(name, HDLChip()).first;
+        if (samePins(chip->inputs, memory.inputs) && samePins(chip->outputs, memory.outputs) && matchesModel(name, memory))
+        {
+            model->second = move(memory);
+        }
+    }
+
+    return !m_memoryModels || model->second.builtin == HDLChip::NONE ? chip : &model->second;
+}
+
+// Runs the RAM chip against an array: every word is written with a pattern
+// and then its complement, read back with load unset, and then words are
+// accessed at random. Chips too big to check quickly, such as a RAM16K
+// built on a faulty RAM4K, fail the check.
+inline bool HDLLibrary::matchesModel(const string &name, const HDLChip &model)
+{
+    ChipSimulator simulator;
+    if (!simulator.load(*this, name))
+    {
+        return false;
+    }
+
+    int size = 1 << model.inputs[2].width;
+    int randomCycles = max(size, 256);
+    if ((uint64_t)simulator.netlist().gates().size() * (3 * size + randomCycles) > 1ull << 26)
+    {
+        return false;
+    }
+
+    vector<int16_t> data(size, 0);
+    auto cycle = [&](int16_t in, bool load, int address)
+    {
+        int16_t out = 0;
+        if (!simulator.set("in", in) || !simulator.set("load", load) || !simulator.set("address", address))
+        {
+            return false;
+        }
+        simulator.eval();
+        if (!simulator.get("out", out) || out != data[address])
+        {
+            return false;
+        }
+
+        simulator.tick();
+        simulator.tock();
+        data[address] = load ? in : data[address];
+        return simulator.get("out", out) && out == data[address];
+    };
+
+    for (int pass = 0; pass < 3; pass++)
+    {
+        for (int address = 0; address < size; address++)
+        {
+            int16_t pattern = address * 0x9E37 ^ 0x5A5A;
+            if (!cycle(pass == 1 ? ~pattern : pattern, pass < 2, address))
+            {
+                return false;
+            }
+        }
+    }
+
+    uint32_t random = 0x2545F491;
+    for (int i = 0; i < randomCycles; i++)
+    {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        if (!cycle(random >> 16, random & 1, (random >> 1) & (size - 1)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The number of 64-bit words per wire in LaneSimulator. Four words fill an
+// AVX2 register; build with -DHDL_LANE_WORDS=8 and -mavx512f for AVX-512.
+#ifndef HDL_LANE_WORDS
+#define HDL_LANE_WORDS 4
+#endif
+
+// Simulates a combinational netlist on LANES independent input vectors at
+// once: bit i of every word belongs to lane i, so each Nand is one ~(a & b)
+// over all lanes. The words are GCC vector types, which the compiler maps to
+// SSE, AVX2 or AVX-512 registers.
+class LaneSimulator
+{
+public:
+    typedef uint64_t Lanes __attribute__((vector_size(8 * HDL_LANE_WORDS)));
+    static const int WORDS = HDL_LANE_WORDS;
+    static const int LANES = 64 * HDL_LANE_WORDS;
+
+private:
+    const Netlist *m_netlist = nullptr;
+    vector<Lanes> m_values;
+    string m_error;
+
+public:
+    bool load(const Netlist &netlist)
+    {
+        if (!netlist.flops().empty() || !netlist.memories().empty())
+        {
+            m_error = "the chip is not combinational";
+            return false;
+        }
+
+        m_netlist = &netlist;
+        m_values.assign(netlist.wireCount(), Lanes{});
+        m_values[Netlist::TRUE_WIRE] = ~Lanes{};
+        return true;
+    }
+
+    Lanes &wire(uint32_t wire)
+    {
+        return m_values[wire];
+    }
+
+    void eval()
+    {
+        Lanes *values = m_values.data();
+        for (const auto &gate : m_netlist->gates())
+        {
+            values[gate.out] = ~(values[gate.a] & values[gate.b]);
+        }
+    }
+
+    const string &error() const
+    {
+        return m_error;
+    }
+
+    // Transposes a 64x64 bit matrix in place: bit j of word i moves to bit i
+    // of word j.
+    static void transpose(uint64_t block[64])
+    {
+        uint64_t mask = 0x00000000FFFFFFFFull;
+        for (int width = 32; width > 0; width >>= 1, mask ^= mask << width)
+        {
+            for (int i = 0; i < 64; i = (i + width + 1) & ~width)
+            {
+                uint64_t swap = ((block[i] >> width) ^ block[i + width]) & mask;
+                block[i] ^= swap << width;
+                block[i + width] ^= swap;
+            }
+        }
+    }
+};
+
+#endif
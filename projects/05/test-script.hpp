@@ -0,0 +1,604 @@
+#ifndef TEST_SCRIPT_HPP
+#define TEST_SCRIPT_HPP
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <chrono>
+#include <filesystem>
+#include "./vcd-writer.hpp"
+
+using namespace std;
+
+// Runs the course's .tst test scripts: parses the script, executes the
+// commands common to all simulators (output-file, compare-to, output-list,
+// set, output, repeat) and compares every output line with the compare file
+// as the Java tools do. A simulator derives from it and supplies loading,
+// stepping and its variables. With m_waveform set, the variables of the
+// output lists are also written to a .vcd file next to the script whenever
+// they change, at every half cycle.
+class TestScript
+{
+protected:
+    // One script command and its arguments; a repeat holds its count and body.
+    struct Command
+    {
+        vector<string> args;
+        uint64_t count = 0;
+        vector<Command> body;
+    };
+
+    // A column of the output list, e.g. RAM[0]%D2.6.2: the format letter and
+    // the padding left of, the width of and the padding right of the value.
+    struct Column
+    {
+        string name;
+        char format = 'D';
+        int left = 1;
+        int width = 6;
+        int right = 1;
+    };
+
+    filesystem::path m_directory;
+    string m_stepCommand;
+    uint64_t m_time = 0;
+    bool m_tickPhase = false;
+    bool m_waveform = false;
+    string m_error;
+
+private:
+    vector<Column> m_columns;
+    VCDWriter m_vcd;
+    vector<string> m_vcdNames;
+    ofstream m_output;
+    vector<string> m_compare;
+    size_t m_line = 0;
+
+public:
+    // stepCommand is the command advancing the simulator by one step, such
+    // as ticktock or vmstep.
+    TestScript(const string &scriptPath, const string &stepCommand)
+    {
+        m_directory = filesystem::path(scriptPath).parent_path();
+        m_stepCommand = stepCommand;
+    }
+
+    virtual ~TestScript() = default;
+
+    // Runs the script and returns whether it completed with every output
+    // line matching the compare file; error() says why it did not.
+    bool run(const string &scriptPath)
+    {
+        ifstream file(scriptPath);
+        if (!file)
+        {
+            m_error = "cannot open " + scriptPath;
+            return false;
+        }
+
+        stringstream buffer;
+        buffer << file.rdbuf();
+        vector<string> tokens = tokenize(buffer.str());
+
+        size_t pos = 0;
+        vector<Command> commands;
+        if (!parseBlock(tokens, pos, commands, false))
+        {
+            return false;
+        }
+
+        filesystem::path vcdPath = filesystem::path(scriptPath).replace_extension(".vcd");
+        if (m_waveform && !m_vcd.open(vcdPath.string(), vcdPath.stem().string()))
+        {
+            m_error = "cannot write " + vcdPath.string();
+            return false;
+        }
+
+        bool passed = execute(commands);
+        m_vcd.close();
+        return passed;
+    }
+
+    const string &error() const
+    {
+        return m_error;
+    }
+
+    size_t linesCompared() const
+    {
+        return m_line;
+    }
+
+protected:
+    // Loads the program or chip named by a load command; the name is empty
+    // for a bare `load`.
+    virtual bool load(const string &filename) = 0;
+
+    // Advances the simulator by the given number of steps.
+    virtual bool step(uint64_t count) = 0;
+
+    virtual bool get(const string &name, int16_t &value) = 0;
+    virtual bool set(const string &name, int16_t value) = 0;
+
+    // The width in bits of a variable in the waveform.
+    virtual int width(const string &name)
+    {
+        (void)name;
+        return 16;
+    }
+
+    // Executes a command the base class does not know, such as tick or tock.
+    virtual bool executeCommand(const vector<string> &args)
+    {
+        m_error = "unsupported command " + args[0];
+        return false;
+    }
+
+private:
+    // Splits a script into words, quoted strings and the separators , ; { }
+    // after dropping comments.
+    static vector<string> tokenize(const string &text)
+    {
+        vector<string> tokens;
+        size_t i = 0;
+
+        while (i < text.size())
+        {
+            char c = text[i];
+
+            if (isspace(c))
+            {
+                i++;
+            }
+            else if (text.compare(i, 2, "//") == 0)
+            {
+                i = text.find('\n', i);
+            }
+            else if (text.compare(i, 2, "/*") == 0)
+            {
+                i = text.find("*/", i);
+                i = i == string::npos ? i : i + 2;
+            }
+            else if (c == ',' || c == ';' || c == '{' || c == '}')
+            {
+                tokens.push_back(string(1, c));
+                i++;
+            }
+            else if (c == '"')
+            {
+                size_t end = text.find('"', i + 1);
+                tokens.push_back(text.substr(i, end == string::npos ? string::npos : end - i + 1));
+                i = end == string::npos ? end : end + 1;
+            }
+            else
+            {
+                size_t end = text.find_first_of(" \t\r\n,;{}", i);
+                tokens.push_back(text.substr(i, end - i));
+                i = end;
+            }
+        }
+
+        return tokens;
+    }
+
+    bool parseBlock(const vector<string> &tokens, size_t &pos, vector<Command> &commands, bool nested)
+    {
+        while (pos < tokens.size())
+        {
+            if (tokens[pos] == "}")
+            {
+                if (!nested)
+                {
+                    m_error = "unexpected }";
+                    return false;
+                }
+                pos++;
+                return true;
+            }
+
+            if (tokens[pos] == "," || tokens[pos] == ";")
+            {
+                pos++;
+                continue;
+            }
+
+            if (tokens[pos] == "while" || tokens[pos] == "{")
+            {
+                m_error = "while loops wait for the user, interactive scripts are not supported";
+                return false;
+            }
+
+            Command command;
+            if (tokens[pos] == "repeat")
+            {
+                pos++;
+                if (pos >= tokens.size() || tokens[pos] == "{" || !isdigit(tokens[pos][0]))
+                {
+                    m_error = "repeat without a count runs forever, interactive scripts are not supported";
+                    return false;
+                }
+                command.args.push_back("repeat");
+                command.count = stoull(tokens[pos++]);
+
+                if (pos >= tokens.size() || tokens[pos] != "{")
+                {
+                    m_error = "expected { after repeat " + to_string(command.count);
+                    return false;
+                }
+                pos++;
+
+                if (!parseBlock(tokens, pos, command.body, true))
+                {
+                    return false;
+                }
+                commands.push_back(move(command));
+                continue;
+            }
+
+            while (pos < tokens.size() && tokens[pos] != "," && tokens[pos] != ";" && tokens[pos] != "{" && tokens[pos] != "}")
+            {
+                command.args.push_back(tokens[pos++]);
+            }
+            commands.push_back(move(command));
+        }
+
+        if (nested)
+        {
+            m_error = "missing } at end of script";
+            return false;
+        }
+
+        return true;
+    }
+
+    bool execute(const vector<Command> &commands)
+    {
+        for (const auto &command : commands)
+        {
+            if (!execute(command))
+            {
+                return false;
+            }
+            sampleWaveform();
+        }
+
+        return true;
+    }
+
+    bool execute(const Command &command)
+    {
+        const auto &args = command.args;
+        const string &name = args[0];
+
+        if (name == "repeat")
+        {
+            // The usual `repeat N { ticktock; }` runs as one stretch.
+            if (command.body.size() == 1 && command.body[0].args.size() == 1 && command.body[0].args[0] == m_stepCommand)
+            {
+                return advance(command.count);
+            }
+
+            for (uint64_t i = 0; i < command.count; i++)
+            {
+                if (!execute(command.body))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        if (name == "load" && args.size() <= 2)
+        {
+            return load(args.size() == 2 ? args[1] : "");
+        }
+
+        if (name == "output-file" && args.size() == 2)
+        {
+            m_output.open(m_directory / args[1]);
+            if (!m_output)
+            {
+                m_error = "cannot write " + args[1];
+                return false;
+            }
+            return true;
+        }
+
+        if (name == "compare-to" && args.size() == 2)
+        {
+            ifstream file(m_directory / args[1]);
+            if (!file)
+            {
+                m_error = "cannot open " + args[1];
+                return false;
+            }
+
+            string line;
+            while (getline(file, line))
+            {
+                line.erase(line.find_last_not_of("\r") + 1);
+                m_compare.push_back(line);
+            }
+            return true;
+        }
+
+        if (name == "output-list")
+        {
+            return setOutputList(args);
+        }
+
+        if (name == "set" && args.size() == 3)
+        {
+            int16_t value;
+            return parseValue(args[2], value) && set(args[1], value);
+        }
+
+        if (name == m_stepCommand)
+        {
+            return advance(1);
+        }
+
+        if (name == "output")
+        {
+            return output();
+        }
+
+        if (name == "echo" || name == "clear-echo" || name == "breakpoint" || name == "clear-breakpoints")
+        {
+            return true;
+        }
+
+        return executeCommand(args);
+    }
+
+    bool advance(uint64_t count)
+    {
+        if (!m_vcd.isOpen())
+        {
+            m_time += count;
+            return step(count);
+        }
+
+        for (uint64_t i = 0; i < count; i++)
+        {
+            m_time++;
+            if (!step(1))
+            {
+                return false;
+            }
+            sampleWaveform();
+        }
+        return true;
+    }
+
+    // Time advances by two per cycle, so that tick and tock each have one.
+    void sampleWaveform()
+    {
+        for (size_t i = 0; i < m_vcdNames.size(); i++)
+        {
+            int16_t value = 0;
+            if (get(m_vcdNames[i], value))
+            {
+                m_vcd.sample(2 * m_time + m_tickPhase, i, value);
+            }
+        }
+    }
+
+    // ARegister[] is shown as ARegister and RAM[16] as RAM_16.
+    void addWaveformSignal(const string &name)
+    {
+        if (!m_vcd.isOpen() || name == "time" || find(m_vcdNames.begin(), m_vcdNames.end(), name) != m_vcdNames.end())
+        {
+            return;
+        }
+
+        string signal = name;
+        auto bracketPos = signal.find("[");
+        if (bracketPos != string::npos)
+        {
+            string index = signal.substr(bracketPos + 1, signal.size() - bracketPos - 2);
+            signal = signal.substr(0, bracketPos) + (index.empty() ? "" : "_" + index);
+        }
+        if (m_vcd.addSignal(signal, width(name)) >= 0)
+        {
+            m_vcdNames.push_back(name);
+        }
+    }
+
+    bool parseValue(const string &text, int16_t &value)
+    {
+        try
+        {
+            if (text.compare(0, 2, "%X") == 0)
+            {
+                value = stoi(text.substr(2), nullptr, 16);
+            }
+            else if (text.compare(0, 2, "%B") == 0)
+            {
+                value = stoi(text.substr(2), nullptr, 2);
+            }
+            else
+            {
+                value = stoi(text.compare(0, 2, "%D") == 0 ? text.substr(2) : text);
+            }
+        }
+        catch (const exception &)
+        {
+            m_error = "invalid value " + text;
+            return false;
+        }
+
+        return true;
+    }
+
+    bool setOutputList(const vector<string> &args)
+    {
+        m_columns.clear();
+
+        for (size_t i = 1; i < args.size(); i++)
+        {
+            Column column;
+            auto percentPos = args[i].find("%");
+            column.name = args[i].substr(0, percentPos);
+
+            if (percentPos != string::npos)
+            {
+                int count = 0;
+                char format = 0;
+                sscanf(args[i].c_str() + percentPos, "%%%c%d.%d.%d%n", &format, &column.left, &column.width, &column.right, &count);
+                if (count == 0 || string("DXBS").find(format) == string::npos)
+                {
+                    m_error = "invalid output format " + args[i];
+                    return false;
+                }
+                column.format = format;
+            }
+
+            int16_t value;
+            if (column.name != "time" && !get(column.name, value))
+            {
+                return false;
+            }
+            m_columns.push_back(column);
+            addWaveformSignal(column.name);
+        }
+
+        string header = "|";
+        for (const auto &column : m_columns)
+        {
+            int width = column.left + column.width + column.right;
+            string name = column.name.substr(0, width);
+            int leftSpace = (width - name.size()) / 2;
+            header += string(leftSpace, ' ') + name + string(width - leftSpace - name.size(), ' ') + "|";
+        }
+
+        return writeLine(header);
+    }
+
+    bool output()
+    {
+        string line = "|";
+
+        for (const auto &column : m_columns)
+        {
+            string text;
+            if (column.name == "time")
+            {
+                text = to_string(m_time) + (m_tickPhase ? "+" : "");
+            }
+            else
+            {
+                int16_t value = 0;
+                get(column.name, value);
+                text = format(column, value);
+            }
+
+            if ((int)text.size() < column.width)
+            {
+                string padding(column.width - text.size(), ' ');
+                text = column.format == 'S' ? text + padding : padding + text;
+            }
+            line += string(column.left, ' ') + text + string(column.right, ' ') + "|";
+        }
+
+        return writeLine(line);
+    }
+
+    // Decimal values are shown in full; binary and hexadecimal values show
+    // their low `width` digits.
+    static string format(const Column &column, int16_t value)
+    {
+        if (column.format == 'D' || column.format == 'S')
+        {
+            return to_string(value);
+        }
+
+        int bits = column.format == 'B' ? 1 : 4;
+        string digits;
+        for (int i = column.width - 1; i >= 0; i--)
+        {
+            int shift = i * bits;
+            int digit = shift < 16 ? ((uint16_t)value >> shift) & ((1 << bits) - 1) : 0;
+            digits += "0123456789ABCDEF"[digit];
+        }
+        return digits;
+    }
+
+    bool writeLine(const string &line)
+    {
+        if (m_output.is_open())
+        {
+            m_output << line << endl;
+        }
+
+        if (m_compare.empty())
+        {
+            return true;
+        }
+
+        if (m_line >= m_compare.size() || !matches(line, m_compare[m_line]))
+        {
+            m_error = "comparison failure at line " + to_string(m_line + 1) + "\n  expected: " +
+                      (m_line < m_compare.size() ? m_compare[m_line] : "(end of file)") + "\n  actual:   " + line;
+            return false;
+        }
+
+        m_line++;
+        return true;
+    }
+
+    // Compare files may mark characters that need not match with `*`.
+    static bool matches(const string &line, const string &expected)
+    {
+        if (line.size() != expected.size())
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < line.size(); i++)
+        {
+            if (line[i] != expected[i] && expected[i] != '*')
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+};
+
+// Runs each script with Script, constructed from the script path and the
+// given arguments, prints PASS or FAIL with the reason for each and returns
+// non-zero if any failed.
+template <typename Script, typename... Args>
+int runScripts(const vector<string> &scriptPaths, const Args &...args)
+{
+    int failures = 0;
+    for (const auto &scriptPath : scriptPaths)
+    {
+        auto start = chrono::steady_clock::now();
+        Script script(scriptPath, args...);
+        bool passed = script.run(scriptPath);
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+        if (passed)
+        {
+            cout << "PASS " << scriptPath << " (" << script.linesCompared() << " lines compared in "
+                 << elapsed.count() * 1000 << " ms)" << endl;
+        }
+        else
+        {
+            cout << "FAIL " << scriptPath << ": " << script.error() << endl;
+            failures++;
+        }
+    }
+
+    return failures == 0 ? 0 : -1;
+}
+
+#endif
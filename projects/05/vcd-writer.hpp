@@ -0,0 +1,159 @@
+#ifndef VCD_WRITER_HPP
+#define VCD_WRITER_HPP
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Writes a VCD waveform file for GTKWave and similar viewers. The signals are
+// declared before the first sample; after that only changed values are
+// written, each time stamp once before its first change. The text gathers in
+// a buffer that is written out in large blocks.
+class VCDWriter
+{
+private:
+    struct Signal
+    {
+        string name;
+        int width;
+        string id;
+        int32_t value = -1;
+    };
+
+    static constexpr size_t BUFFER_SIZE = 1 << 16;
+
+    FILE *m_file = nullptr;
+    string m_scope;
+    string m_buffer;
+    vector<Signal> m_signals;
+    bool m_started = false;
+    uint64_t m_time = 0;
+    bool m_timeWritten = false;
+
+public:
+    ~VCDWriter()
+    {
+        close();
+    }
+
+    bool open(const string &path, const string &scope)
+    {
+        close();
+        m_file = fopen(path.c_str(), "w");
+        m_scope = scope;
+        m_signals.clear();
+        m_started = false;
+        m_timeWritten = false;
+        return m_file != nullptr;
+    }
+
+    bool isOpen() const
+    {
+        return m_file != nullptr;
+    }
+
+    // Declares a signal and returns its index, or -1 once sampling started.
+    int addSignal(const string &name, int width)
+    {
+        if (m_started)
+        {
+            return -1;
+        }
+
+        // Identifiers are numbers in base 94 over the printable characters.
+        string id;
+        for (size_t n = m_signals.size(); id.empty() || n > 0; n /= 94)
+        {
+            id += (char)('!' + n % 94);
+        }
+        m_signals.push_back({name, width, id});
+        return m_signals.size() - 1;
+    }
+
+    void sample(uint64_t time, int signal, uint16_t value)
+    {
+        Signal &entry = m_signals[signal];
+        value &= entry.width >= 16 ? 0xFFFF : (1 << entry.width) - 1;
+        if (entry.value == value)
+        {
+            return;
+        }
+
+        if (!m_started)
+        {
+            writeHeader();
+        }
+        if (!m_timeWritten || time != m_time)
+        {
+            m_buffer += "#" + to_string(time) + "\n";
+            m_time = time;
+            m_timeWritten = true;
+        }
+
+        entry.value = value;
+        if (entry.width == 1)
+        {
+            m_buffer += (char)('0' + value);
+        }
+        else
+        {
+            m_buffer += 'b';
+            int bit = 15;
+            while (bit > 0 && !((value >> bit) & 1))
+            {
+                bit--;
+            }
+            for (; bit >= 0; bit--)
+            {
+                m_buffer += (char)('0' + ((value >> bit) & 1));
+            }
+            m_buffer += ' ';
+        }
+        m_buffer += entry.id;
+        m_buffer += '\n';
+
+        if (m_buffer.size() >= BUFFER_SIZE)
+        {
+            flush();
+        }
+    }
+
+    void close()
+    {
+        if (m_file == nullptr)
+        {
+            return;
+        }
+
+        if (!m_started)
+        {
+            writeHeader();
+        }
+        flush();
+        fclose(m_file);
+        m_file = nullptr;
+    }
+
+private:
+    void writeHeader()
+    {
+        m_buffer += "$timescale 1ns $end\n$scope module " + m_scope + " $end\n";
+        for (const auto &signal : m_signals)
+        {
+            m_buffer += "$var wire " + to_string(signal.width) + " " + signal.id + " " + signal.name + " $end\n";
+        }
+        m_buffer += "$upscope $end\n$enddefinitions $end\n";
+        m_started = true;
+    }
+
+    void flush()
+    {
+        fwrite(m_buffer.data(), 1, m_buffer.size(), m_file);
+        m_buffer.clear();
+    }
+};
+
+#endif
@@ -0,0 +1,238 @@
+#ifndef HACK_CODE_HPP
+#define HACK_CODE_HPP
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+// Binary encodings of Hack C-instructions and an in-memory assembler, shared
+// by the tools that produce or load Hack machine code.
+struct Code
+{
+    static map<string, uint16_t> createDestMap()
+    {
+        map<string, uint16_t> tmp;
+        tmp[""] = 0b000;
+        tmp["M"] = 0b001;
+        tmp["D"] = 0b010;
+        tmp["MD"] = 0b011;
+        tmp["A"] = 0b100;
+        tmp["AM"] = 0b101;
+        tmp["AD"] = 0b110;
+        tmp["AMD"] = 0b111;
+        return tmp;
+    }
+
+    static map<string, uint16_t> createCompMap()
+    {
+        map<string, uint16_t> tmp;
+        tmp["0"] = 0b0101010;
+        tmp["1"] = 0b0111111;
+        tmp["-1"] = 0b0111010;
+        tmp["D"] = 0b0001100;
+        tmp["A"] = 0b0110000;
+        tmp["!D"] = 0b0001101;
+        tmp["!A"] = 0b0110001;
+        tmp["-D"] = 0b0001111;
+        tmp["-A"] = 0b0110011;
+        tmp["D+1"] = 0b0011111;
+        tmp["A+1"] = 0b0110111;
+        tmp["D-1"] = 0b0001110;
+        tmp["A-1"] = 0b0110010;
+        tmp["D+A"] = 0b0000010;
+        tmp["D-A"] = 0b0010011;
+        tmp["A-D"] = 0b0000111;
+        tmp["D&A"] = 0b0000000;
+        tmp["D|A"] = 0b0010101;
+        tmp["M"] = 0b1110000;
+        tmp["!M"] = 0b1110001;
+        tmp["-M"] = 0b1110011;
+        tmp["M+1"] = 0b1110111;
+        tmp["M-1"] = 0b1110010;
+        tmp["D+M"] = 0b1000010;
+        tmp["D-M"] = 0b1010011;
+        tmp["M-D"] = 0b1000111;
+        tmp["D&M"] = 0b1000000;
+        tmp["D|M"] = 0b1010101;
+        return tmp;
+    }
+
+    static map<string, uint16_t> createJumpMap()
+    {
+        map<string, uint16_t> tmp;
+        tmp[""] = 0b000;
+        tmp["JGT"] = 0b001;
+        tmp["JEQ"] = 0b010;
+        tmp["JGE"] = 0b011;
+        tmp["JLT"] = 0b100;
+        tmp["JNE"] = 0b101;
+        tmp["JLE"] = 0b110;
+        tmp["JMP"] = 0b111;
+        return tmp;
+    }
+
+    static inline const map<string, uint16_t> destMap = createDestMap();
+    static inline const map<string, uint16_t> compMap = createCompMap();
+    static inline const map<string, uint16_t> jumpMap = createJumpMap();
+
+    // Encodes a "dest=comp;jump" mnemonic, or returns false if one of its
+    // fields is not a Hack mnemonic.
+    static bool encode(const string &mnemonic, uint16_t &word)
+    {
+        auto equalPos = mnemonic.find("=");
+        auto sColonPos = mnemonic.find(";");
+        auto compPos = equalPos == string::npos ? 0 : equalPos + 1;
+
+        auto dest = destMap.find(equalPos == string::npos ? "" : mnemonic.substr(0, equalPos));
+        auto comp = compMap.find(mnemonic.substr(compPos, sColonPos == string::npos ? string::npos : sColonPos - compPos));
+        auto jump = jumpMap.find(sColonPos == string::npos ? "" : mnemonic.substr(sColonPos + 1));
+        if (dest == destMap.end() || comp == compMap.end() || jump == jumpMap.end())
+        {
+            return false;
+        }
+
+        word = 0b111 << 13 | comp->second << 6 | dest->second << 3 | jump->second;
+        return true;
+    }
+
+    // Encodes a mnemonic known to be valid. The translator only ever emits a
+    // handful of distinct mnemonics, so each one is split and looked up once.
+    static uint16_t encode(const string &mnemonic)
+    {
+        static unordered_map<string, uint16_t> cache;
+
+        auto cached = cache.find(mnemonic);
+        if (cached != cache.end())
+        {
+            return cached->second;
+        }
+
+        uint16_t word = 0;
+        encode(mnemonic, word);
+        cache[mnemonic] = word;
+        return word;
+    }
+};
+
+inline const map<string, int> &predefinedSymbols()
+{
+    static const map<string, int> symbols = {
+        {"SP", 0},
+        {"LCL", 1},
+        {"ARG", 2},
+        {"THIS", 3},
+        {"THAT", 4},
+        {"R0", 0},
+        {"R1", 1},
+        {"R2", 2},
+        {"R3", 3},
+        {"R4", 4},
+        {"R5", 5},
+        {"R6", 6},
+        {"R7", 7},
+        {"R8", 8},
+        {"R9", 9},
+        {"R10", 10},
+        {"R11", 11},
+        {"R12", 12},
+        {"R13", 13},
+        {"R14", 14},
+        {"R15", 15},
+        {"SCREEN", 16384},
+        {"KBD", 24576}};
+
+    return symbols;
+}
+
+// Assembles a .asm file in memory, resolving symbols like hack-assembler:
+// labels first, then variables from RAM[16] in order of first use. A label
+// defined twice, or named like a predefined symbol, is an error.
+inline bool assemble(const string &filename, vector<uint16_t> &words)
+{
+    ifstream file(filename);
+    if (!file)
+    {
+        cerr << "Error: cannot open " << filename << endl;
+        return false;
+    }
+
+    map<string, int> symbolMap = predefinedSymbols();
+
+    vector<string> lines;
+    string line;
+    while (getline(file, line))
+    {
+        auto commentPos = line.find("//");
+        if (commentPos != string::npos)
+        {
+            line.erase(commentPos);
+        }
+        line.erase(remove_if(line.begin(), line.end(), ::isspace), line.end());
+
+        if (line.empty())
+        {
+            continue;
+        }
+
+        if (line[0] == '(')
+        {
+            string label = line.substr(1, line.size() - 2);
+            if (!symbolMap.insert({label, (int)lines.size()}).second)
+            {
+                cerr << "Error: label " << label << " is defined more than once in " << filename << endl;
+                return false;
+            }
+            continue;
+        }
+
+        lines.push_back(line);
+    }
+
+    if (lines.size() > 32768)
+    {
+        cerr << "Error: " << filename << " does not fit in ROM" << endl;
+        return false;
+    }
+
+    words.clear();
+    int availableAddress = 16;
+    for (const auto &instruction : lines)
+    {
+        if (instruction[0] == '@')
+        {
+            string symbol = instruction.substr(1);
+            if (isdigit(symbol[0]))
+            {
+                words.push_back(stoi(symbol) & 0x7FFF);
+                continue;
+            }
+
+            if (!symbolMap.count(symbol))
+            {
+                symbolMap.insert({symbol, availableAddress});
+                availableAddress++;
+            }
+            words.push_back(symbolMap[symbol] & 0x7FFF);
+            continue;
+        }
+
+        uint16_t word;
+        if (!Code::encode(instruction, word))
+        {
+            cerr << "Error: invalid instruction " << instruction << " in " << filename << endl;
+            return false;
+        }
+        words.push_back(word);
+    }
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,10 @@
+load LocalLabels.asm,
+output-file LocalLabels.out,
+compare-to LocalLabels.cmp,
+output-list RAM[6000]%D1.7.1 RAM[6001]%D1.7.1;
+
+repeat 5000 {
+  ticktock;
+}
+
+output;
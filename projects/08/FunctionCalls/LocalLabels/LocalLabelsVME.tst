@@ -0,0 +1,10 @@
+load,
+output-file LocalLabels.out,
+compare-to LocalLabels.cmp,
+output-list RAM[6000]%D1.7.1 RAM[6001]%D1.7.1;
+
+repeat 200 {
+  vmstep;
+}
+
+output;
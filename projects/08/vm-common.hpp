@@ -0,0 +1,159 @@
+#ifndef VM_COMMON_HPP
+#define VM_COMMON_HPP
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <map>
+#include <set>
+#include <vector>
+#include <algorithm>
+#include <regex>
+
+using namespace std;
+
+enum CommandType
+{
+    C_ARITHMETIC,
+    C_PUSH,
+    C_POP,
+    C_LABEL,
+    C_GOTO,
+    C_IF,
+    C_FUNCTION,
+    C_RETURN,
+    C_CALL
+};
+
+class Parser
+{
+private:
+    ifstream m_file;
+    string m_line;
+
+public:
+    Parser(string filename)
+    {
+        m_file.open(filename);
+        advance();
+    }
+
+    ~Parser()
+    {
+        m_file.close();
+    }
+
+    // The parser always holds the next command, so a last line without a
+    // trailing newline is still read and an empty file has no commands.
+    bool hasMoreCommands()
+    {
+        return !m_line.empty();
+    }
+
+    void advance()
+    {
+        m_line.clear();
+
+        while (m_line.empty() && getline(m_file, m_line))
+        {
+            cleanLine(m_line);
+        }
+    }
+
+    CommandType commandType()
+    {
+        map<string, CommandType> commands;
+        commands["add"] = C_ARITHMETIC;
+        commands["sub"] = C_ARITHMETIC;
+        commands["neg"] = C_ARITHMETIC;
+        commands["eq"] = C_ARITHMETIC;
+        commands["gt"] = C_ARITHMETIC;
+        commands["lt"] = C_ARITHMETIC;
+        commands["and"] = C_ARITHMETIC;
+        commands["or"] = C_ARITHMETIC;
+        commands["not"] = C_ARITHMETIC;
+        commands["push"] = C_PUSH;
+        commands["pop"] = C_POP;
+        commands["call"] = C_CALL;
+        commands["function"] = C_FUNCTION;
+        commands["return"] = C_RETURN;
+        commands["label"] = C_LABEL;
+        commands["goto"] = C_GOTO;
+        commands["if-goto"] = C_IF;
+
+        return commands.find(m_line.substr(0, m_line.find(" ")))->second;
+    }
+
+    string arg1()
+    {
+        if (commandType() == C_RETURN)
+        {
+            return "";
+        }
+
+        auto first_pos = m_line.find(" ");
+
+        if (commandType() == C_ARITHMETIC)
+        {
+            return m_line.substr(0, first_pos);
+        }
+
+        return m_line.substr(first_pos + 1, m_line.find(" ", first_pos + 1) - first_pos - 1);
+    }
+
+    string arg2()
+    {
+        CommandType cmd = commandType();
+        if (cmd == C_PUSH || cmd == C_POP || cmd == C_FUNCTION || cmd == C_CALL)
+        {
+            auto first_pos = m_line.find(" ");
+            auto second_pos = m_line.find(" ", first_pos + 1);
+            auto third_pos = m_line.find(" ", second_pos + 1);
+            return m_line.substr(second_pos + 1, third_pos - second_pos - 1);
+        }
+        else
+        {
+            return "";
+        }
+    }
+
+private:
+    void cleanLine(string &input)
+    {
+        regex r("//.*|\r|\n");
+        input = regex_replace(input, r, "");
+        input.erase(input.find_last_not_of(" \t") + 1);
+        input.erase(0, input.find_first_not_of(" \t"));
+    }
+};
+
+// Packs static variables into RAM from address 16, ordered by class name and
+// then by index. Unlike first-use allocation, a static keeps its address no
+// matter in which order the files are translated or linked.
+inline map<string, int> layoutStatics(const set<string> &symbols)
+{
+    vector<pair<string, int>> keys;
+    for (const auto &symbol : symbols)
+    {
+        auto dotPos = symbol.find_last_of(".");
+        keys.push_back({symbol.substr(0, dotPos), stoi(symbol.substr(dotPos + 1))});
+    }
+    sort(keys.begin(), keys.end());
+
+    map<string, int> statics;
+    int availableAddress = 16;
+    for (const auto &[className, index] : keys)
+    {
+        statics.insert({className + "." + to_string(index), availableAddress});
+        availableAddress++;
+    }
+
+    if (availableAddress > 256)
+    {
+        cerr << "Warning: " << availableAddress - 256 << " statics overlap the stack at RAM[256]" << endl;
+    }
+
+    return statics;
+}
+
+#endif
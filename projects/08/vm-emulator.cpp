@@ -0,0 +1,110 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "./vm-engine.hpp"
+
+using namespace std;
+
+void saveScreen(int16_t *ram, const string &filename)
+{
+    ofstream file(filename);
+    file << "P1" << endl
+         << "512 256" << endl;
+
+    for (int row = 0; row < 256; row++)
+    {
+        for (int col = 0; col < 512; col++)
+        {
+            int16_t word = ram[VMEngine::SCREEN + row * 32 + col / 16];
+            file << ((word >> (col % 16)) & 1);
+        }
+        file << endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t maxSteps = 100000000;
+    int jitThreshold = -1;
+    string screenFilePath;
+    vector<pair<int, int>> ranges;
+    vector<string> paths;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+
+        if (arg == "--steps" && i + 1 < argc)
+        {
+            maxSteps = stoull(argv[++i]);
+        }
+        else if (arg == "--jit")
+        {
+            jitThreshold = jitThreshold < 0 ? 10 : jitThreshold;
+        }
+        else if (arg == "--jit-threshold" && i + 1 < argc)
+        {
+            jitThreshold = stoi(argv[++i]);
+        }
+        else if (arg == "--screen" && i + 1 < argc)
+        {
+            screenFilePath = argv[++i];
+        }
+        else if (arg == "--print" && i + 1 < argc)
+        {
+            string range = argv[++i];
+            auto dashPos = range.find("-");
+            int first = stoi(range.substr(0, dashPos));
+            int last = dashPos == string::npos ? first : stoi(range.substr(dashPos + 1));
+            ranges.push_back({first, last});
+        }
+        else
+        {
+            paths.push_back(arg);
+        }
+    }
+
+    if (paths.empty())
+    {
+        cout << "Invalid argument: specify path to .vm file" << endl
+             << "Usage: vm-emulator [--steps N] [--jit] [--jit-threshold N] [--print addr[-addr]]... [--screen out.pbm] <file.vm|directory>..." << endl;
+        return -1;
+    }
+
+    VMEngine engine;
+    if (!engine.load(paths))
+    {
+        return -1;
+    }
+
+    if (jitThreshold >= 0 && !engine.enableJit(jitThreshold))
+    {
+        cerr << "Warning: JIT is not supported on this platform, interpreting" << endl;
+    }
+
+    engine.reset();
+    auto start = chrono::steady_clock::now();
+    uint64_t steps = engine.run(maxSteps);
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    cout << (engine.halted() ? "Halted" : "Stopped") << " after " << steps << " VM commands in "
+         << elapsed.count() * 1000 << " ms (" << steps / elapsed.count() / 1e6 << " M commands/s)" << endl;
+
+    int16_t *ram = engine.ram();
+    for (const auto &[first, last] : ranges)
+    {
+        for (int address = first; address <= last && address < VMEngine::RAM_SIZE; address++)
+        {
+            cout << "RAM[" << address << "] = " << ram[address] << endl;
+        }
+    }
+
+    if (!screenFilePath.empty())
+    {
+        saveScreen(ram, screenFilePath);
+    }
+
+    return 0;
+}
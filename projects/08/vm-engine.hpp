@@ -0,0 +1,1150 @@
+#ifndef VM_ENGINE_HPP
+#define VM_ENGINE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include "./vm-common.hpp"
+
+#if defined(__x86_64__) && defined(__unix__)
+#define VM_JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+enum Opcode : uint8_t
+{
+    OP_PUSH_CONSTANT,
+    OP_PUSH_SEGMENT,
+    OP_PUSH_ADDRESS,
+    OP_POP_SEGMENT,
+    OP_POP_ADDRESS,
+    OP_ADD,
+    OP_SUB,
+    OP_NEG,
+    OP_EQ,
+    OP_GT,
+    OP_LT,
+    OP_AND,
+    OP_OR,
+    OP_NOT,
+    OP_GOTO,
+    OP_IF_GOTO,
+    OP_CALL,
+    OP_FUNCTION,
+    OP_RETURN,
+    OP_HALT
+};
+
+// One pre-decoded VM command. For segment access `base` is the RAM address
+// of the segment pointer (LCL, ARG, THIS or THAT) and `arg` the index; static,
+// temp and pointer accesses are resolved to a fixed RAM address in `arg`.
+// Jumps and calls hold the index of their target op in `arg`, with the
+// number of call arguments or function locals in `base`.
+struct Op
+{
+    Opcode opcode;
+    uint16_t base;
+    int32_t arg;
+};
+
+#ifdef VM_JIT_SUPPORTED
+// Compiles hot VM functions to x86-64 code. A function's ops are split into
+// blocks at jump targets and after jumps, calls and returns. Each block first
+// charges its length against the step budget, so the engine stops after
+// exactly the same number of commands as the interpreter, and checks that the
+// stack slots it touches lie inside RAM; blocks failing either check are left
+// to the interpreter. Compiled code keeps SP in ebp and addresses stack slots
+// relative to it, adding a block's net push count to ebp only where SP is
+// observed. All RAM accesses are 16-bit loads and stores, so arithmetic wraps
+// like on the Hack platform. Calls, returns and jumps out of a function go
+// through a table holding the native address of every compiled block; blocks
+// that are not compiled point at the exit path, which hands the op index to
+// continue at back to the interpreter.
+class VMJit
+{
+private:
+    typedef uint32_t (*Trampoline)(int16_t *ram, uint64_t *steps, uint64_t maxSteps, const void *const *table, uint32_t pc);
+
+    static const size_t REGION_SIZE = 64 << 20;
+
+    enum Register
+    {
+        EAX = 0,
+        ECX = 1,
+        EDX = 2,
+        EBP = 5,
+        ESI = 6
+    };
+
+    struct Fixup
+    {
+        size_t position;
+        uint32_t target;
+    };
+
+    // Number of ops a block executes and the lowest and highest stack slot
+    // it accesses, relative to SP on entry.
+    struct Block
+    {
+        uint32_t length;
+        int32_t low;
+        int32_t high;
+    };
+
+    const vector<Op> *m_code = nullptr;
+    uint8_t *m_region = nullptr;
+    size_t m_used = 0;
+    const uint8_t *m_exit = nullptr;
+    vector<const void *> m_table;
+    vector<uint32_t> m_counts;
+    vector<uint32_t> m_functionOf;
+    vector<bool> m_compiled;
+    uint32_t m_threshold = 0;
+    vector<uint8_t> m_buffer;
+
+public:
+    ~VMJit()
+    {
+        if (m_region)
+        {
+            munmap(m_region, REGION_SIZE);
+        }
+    }
+
+    // Functions are compiled once any of their entry points, i.e. the
+    // function itself, a return address or a loop head, has been entered
+    // threshold times by the interpreter. Calling init again, after the
+    // program has been reloaded, drops everything compiled so far.
+    bool init(const vector<Op> &code, uint32_t threshold)
+    {
+        if (m_region)
+        {
+            munmap(m_region, REGION_SIZE);
+            m_region = nullptr;
+            m_used = 0;
+        }
+
+        void *region = mmap(nullptr, REGION_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED)
+        {
+            return false;
+        }
+
+        m_code = &code;
+        m_region = (uint8_t *)region;
+        m_threshold = threshold;
+        m_counts.assign(code.size(), 0);
+        m_compiled.assign(code.size(), false);
+        m_functionOf.assign(code.size(), 0);
+
+        uint32_t function = 0;
+        for (size_t i = 1; i + 1 < code.size(); i++)
+        {
+            function = code[i].opcode == OP_FUNCTION ? i : function;
+            m_functionOf[i] = function;
+        }
+
+        // push rbx, rbp, r12-r15; rbx = ram, r12 = &steps, r13 = steps,
+        // r14 = maxSteps, r15 = table, ebp = SP; jmp [r15 + pc * 8]
+        emit({0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});
+        emit({0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4, 0x4C, 0x8B, 0x2E, 0x49, 0x89, 0xD6, 0x49, 0x89, 0xCF});
+        emit({0x0F, 0xB7, 0x2B, 0x44, 0x89, 0xC0, 0x41, 0xFF, 0x24, 0xC7});
+
+        // Exit: SP = bp; steps = r13; pop r15-r12, rbp, rbx; ret with the
+        // pc in eax.
+        m_exit = m_region + m_buffer.size();
+        emit({0x66, 0x89, 0x2B, 0x4D, 0x89, 0x2C, 0x24});
+        emit({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B, 0xC3});
+
+        m_table.assign(code.size(), m_exit);
+        return commit();
+    }
+
+    // Whether execution can continue in native code at the given op. Counts
+    // the entry and compiles the enclosing function once it is hot.
+    bool enterable(uint32_t pc)
+    {
+        if (m_table[pc] != m_exit)
+        {
+            return true;
+        }
+
+        uint32_t function = m_functionOf[pc];
+        if (function == 0 || m_compiled[function] || ++m_counts[pc] < m_threshold)
+        {
+            return false;
+        }
+
+        m_compiled[function] = true;
+        compile(function);
+        return m_table[pc] != m_exit;
+    }
+
+    // Runs native code from the given op until it reaches code that is not
+    // compiled or runs out of steps, and returns the op to continue at.
+    uint32_t enter(uint32_t pc, int16_t *ram, uint64_t &steps, uint64_t maxSteps)
+    {
+        uint64_t nativeSteps = steps;
+        pc = ((Trampoline)m_region)(ram, &nativeSteps, maxSteps, m_table.data(), pc);
+        steps = nativeSteps;
+        return pc;
+    }
+
+private:
+    // Compiles the ops from a function up to the next one. `depth` is the
+    // number of pushes not yet added to ebp, so SP is ebp + depth.
+    void compile(uint32_t start)
+    {
+        static const map<Opcode, uint8_t> alu = {{OP_ADD, 0x01}, {OP_SUB, 0x29}, {OP_AND, 0x21}, {OP_OR, 0x09}};
+        static const map<Opcode, uint8_t> setcc = {{OP_EQ, 0x94}, {OP_GT, 0x9F}, {OP_LT, 0x9C}};
+
+        const auto &code = *m_code;
+        uint32_t end = start + 1;
+        while (end + 1 < code.size() && code[end].opcode != OP_FUNCTION)
+        {
+            end++;
+        }
+
+        vector<bool> blockStart(end - start + 1, false);
+        blockStart[0] = true;
+        for (uint32_t i = start; i < end; i++)
+        {
+            Opcode opcode = code[i].opcode;
+            uint32_t target = code[i].arg;
+
+            if ((opcode == OP_GOTO || opcode == OP_IF_GOTO) && target >= start && target < end)
+            {
+                blockStart[target - start] = true;
+            }
+
+            if (opcode == OP_GOTO || opcode == OP_IF_GOTO || opcode == OP_CALL || opcode == OP_RETURN || opcode == OP_HALT)
+            {
+                blockStart[i + 1 - start] = true;
+            }
+        }
+
+        m_buffer.clear();
+        const uint8_t *base = m_region + m_used;
+        vector<size_t> offsets(end - start, 0);
+        vector<Fixup> jumps;
+        vector<Fixup> exits;
+        int32_t depth = 0;
+        uint32_t remaining = 0;
+
+        for (uint32_t i = start; i < end; i++)
+        {
+            const Op &op = code[i];
+
+            if (blockStart[i - start])
+            {
+                settle(depth);
+                Block block = measure(i, end, blockStart, start);
+                remaining = block.length;
+                offsets[i - start] = m_buffer.size();
+
+                // lea eax, [rbp + low - 1]; cmp eax, limit; ja exit
+                lea(EAX, EBP, block.low - 1);
+                aluImm(7, EAX, 0x7FFF - block.high + block.low - 1);
+                emit({0x0F, 0x87});
+                exits.push_back({m_buffer.size(), i});
+                emit32(0);
+
+                // lea rax, [r13 + length]; cmp rax, r14; ja exit; mov r13, rax
+                emit({0x49, 0x8D, 0x85});
+                emit32(block.length);
+                emit({0x4C, 0x39, 0xF0, 0x0F, 0x87});
+                exits.push_back({m_buffer.size(), i});
+                emit32(0);
+                emit({0x49, 0x89, 0xC5});
+            }
+
+            switch (op.opcode)
+            {
+            case OP_PUSH_CONSTANT:
+                storeStackImm(depth++, op.arg);
+                break;
+
+            case OP_PUSH_SEGMENT:
+                // The segment may alias RAM[0], so SP is stored first.
+                lea(ECX, EBP, depth);
+                storeWord(ECX, 0);
+                segmentAddress(op);
+                loadWordIndexed(EDX, EAX);
+                storeStack(EDX, depth++);
+                break;
+
+            case OP_PUSH_ADDRESS:
+                loadWord(EDX, op.arg * 2);
+                storeStack(EDX, depth++);
+                break;
+
+            case OP_POP_SEGMENT:
+                loadStack(EDX, --depth);
+                segmentAddress(op);
+                storeWordIndexed(EDX, EAX);
+
+                // Storing to RAM[0] sets SP, so the rest of the block is
+                // left to the interpreter: test eax, eax; jnz skip;
+                // movzx ebp, word [rbx]; sub r13, remaining; exit to i + 1
+                emit({0x85, 0xC0, 0x75, 0x18});
+                loadWord(EBP, 0);
+                emit({0x49, 0x81, 0xED});
+                emit32(remaining - 1);
+                exitTo(i + 1);
+                break;
+
+            case OP_POP_ADDRESS:
+                loadStack(EDX, --depth);
+                storeWord(EDX, op.arg * 2);
+                break;
+
+            case OP_ADD:
+            case OP_SUB:
+            case OP_AND:
+            case OP_OR:
+                loadStack(EDX, --depth);
+                aluStack(alu.at(op.opcode), EDX, depth - 1);
+                break;
+
+            case OP_EQ:
+            case OP_GT:
+            case OP_LT:
+                // cmp x, y; setcc cl; movzx ecx, cl; neg ecx; x = cx
+                loadStack(EDX, --depth);
+                aluStack(0x39, EDX, depth - 1);
+                emit({0x0F, setcc.at(op.opcode), 0xC1, 0x0F, 0xB6, 0xC9, 0xF7, 0xD9});
+                storeStack(ECX, depth - 1);
+                break;
+
+            case OP_NEG:
+            case OP_NOT:
+                aluStack(0xF7, (Register)(op.opcode == OP_NEG ? 3 : 2), depth - 1);
+                break;
+
+            case OP_GOTO:
+                settle(depth);
+                jump(op.arg, start, end, jumps);
+                break;
+
+            case OP_IF_GOTO:
+                // test dx, dx; jnz target
+                loadStack(EDX, --depth);
+                settle(depth);
+                emit({0x66, 0x85, 0xD2});
+                if ((uint32_t)op.arg >= start && (uint32_t)op.arg < end)
+                {
+                    emit({0x0F, 0x85});
+                    jumps.push_back({m_buffer.size(), (uint32_t)op.arg});
+                    emit32(0);
+                }
+                else
+                {
+                    emit({0x74, 0x09});
+                    tableJump(op.arg);
+                }
+                break;
+
+            case OP_CALL:
+                settle(depth);
+                mov(ECX, EBP);
+                mov(EAX, ECX);
+                andMask(EAX);
+                emit({0x66, 0xC7, 0x04, 0x43});
+                emit16(i + 1);
+                for (int k = 1; k <= 4; k++)
+                {
+                    loadWord(EDX, k * 2);
+                    lea(EAX, ECX, k);
+                    andMask(EAX);
+                    storeWordIndexed(EDX, EAX);
+                }
+                lea(EAX, ECX, 5);
+                storeWord(EAX, 0);
+                storeWord(EAX, 2);
+                movzxWord(EBP, EAX);
+                mov(EAX, ECX);
+                aluImm(5, EAX, op.base);
+                storeWord(EAX, 4);
+                jump(op.arg, start, end, jumps);
+                break;
+
+            case OP_FUNCTION:
+                for (int k = 0; k < op.base; k++)
+                {
+                    storeStackImm(depth++, 0);
+                }
+                break;
+
+            case OP_RETURN:
+                settle(depth);
+                storeWord(EBP, 0);
+                loadWord(ECX, 2);
+                lea(EAX, ECX, -5);
+                andMask(EAX);
+                loadWordIndexed(ESI, EAX);
+                lea(EAX, EBP, -1);
+                andMask(EAX);
+                loadWordIndexed(EDX, EAX);
+                loadWord(EAX, 4);
+                andMask(EAX);
+                storeWordIndexed(EDX, EAX);
+                loadWord(EAX, 4);
+                lea(EAX, EAX, 1);
+                storeWord(EAX, 0);
+                movzxWord(EBP, EAX);
+                for (int k = 1; k <= 4; k++)
+                {
+                    lea(EAX, ECX, -k);
+                    andMask(EAX);
+                    loadWordIndexed(EDX, EAX);
+                    storeWord(EDX, (5 - k) * 2);
+                }
+                // cmp esi, size; jb +2; xor esi, esi; mov eax, esi; jmp [r15 + rax * 8]
+                aluImm(7, ESI, code.size());
+                emit({0x72, 0x02, 0x31, 0xF6});
+                mov(EAX, ESI);
+                emit({0x41, 0xFF, 0x24, 0xC7});
+                break;
+
+            case OP_HALT:
+                settle(depth);
+                exitTo(i);
+                break;
+            }
+
+            remaining -= op.opcode != OP_HALT;
+        }
+
+        settle(depth);
+        tableJump(end);
+
+        for (const auto &fixup : exits)
+        {
+            patch(fixup.position, m_buffer.size());
+            exitTo(fixup.target);
+        }
+
+        for (const auto &fixup : jumps)
+        {
+            patch(fixup.position, offsets[fixup.target - start]);
+        }
+
+        if (m_used + m_buffer.size() > REGION_SIZE)
+        {
+            return;
+        }
+
+        for (uint32_t i = start; i < end; i++)
+        {
+            if (blockStart[i - start])
+            {
+                m_table[i] = base + offsets[i - start];
+            }
+        }
+
+        commit();
+    }
+
+    Block measure(uint32_t first, uint32_t end, const vector<bool> &blockStart, uint32_t start)
+    {
+        const auto &code = *m_code;
+        Block block = {0, 0, 0};
+        int32_t depth = 0;
+
+        for (uint32_t i = first; i < end && (i == first || !blockStart[i - start]); i++)
+        {
+            const Op &op = code[i];
+            block.length += op.opcode != OP_HALT;
+
+            switch (op.opcode)
+            {
+            case OP_PUSH_CONSTANT:
+            case OP_PUSH_SEGMENT:
+            case OP_PUSH_ADDRESS:
+                block.high = max(block.high, depth++);
+                break;
+
+            case OP_POP_SEGMENT:
+            case OP_POP_ADDRESS:
+            case OP_IF_GOTO:
+                block.low = min(block.low, --depth);
+                break;
+
+            case OP_NEG:
+            case OP_NOT:
+                block.low = min(block.low, depth - 1);
+                break;
+
+            case OP_FUNCTION:
+                depth += op.base;
+                block.high = max(block.high, depth - 1);
+                break;
+
+            case OP_GOTO:
+            case OP_CALL:
+            case OP_RETURN:
+            case OP_HALT:
+                break;
+
+            default:
+                block.low = min(block.low, --depth - 1);
+                break;
+            }
+        }
+
+        return block;
+    }
+
+    // Copies the buffer into the executable region. The region is only
+    // writable while the copy is made.
+    bool commit()
+    {
+        if (mprotect(m_region, REGION_SIZE, PROT_READ | PROT_WRITE) != 0)
+        {
+            return false;
+        }
+
+        memcpy(m_region + m_used, m_buffer.data(), m_buffer.size());
+        m_used += m_buffer.size();
+        m_buffer.clear();
+
+        return mprotect(m_region, REGION_SIZE, PROT_READ | PROT_EXEC) == 0;
+    }
+
+    void emit(initializer_list<uint8_t> bytes)
+    {
+        m_buffer.insert(m_buffer.end(), bytes);
+    }
+
+    void emit16(uint16_t value)
+    {
+        m_buffer.push_back(value);
+        m_buffer.push_back(value >> 8);
+    }
+
+    void emit32(uint32_t value)
+    {
+        emit16(value);
+        emit16(value >> 16);
+    }
+
+    void patch(size_t position, size_t target)
+    {
+        uint32_t rel = target - (position + 4);
+        memcpy(&m_buffer[position], &rel, 4);
+    }
+
+    // movzx r32, word [rbx + disp32]
+    void loadWord(Register reg, int32_t disp)
+    {
+        emit({0x0F, 0xB7, (uint8_t)(0x83 | reg << 3)});
+        emit32(disp);
+    }
+
+    // movzx r32, word [rbx + index * 2]
+    void loadWordIndexed(Register reg, Register index)
+    {
+        emit({0x0F, 0xB7, (uint8_t)(0x04 | reg << 3), (uint8_t)(0x43 | index << 3)});
+    }
+
+    // mov word [rbx + disp32], r16
+    void storeWord(Register reg, int32_t disp)
+    {
+        emit({0x66, 0x89, (uint8_t)(0x83 | reg << 3)});
+        emit32(disp);
+    }
+
+    // mov word [rbx + index * 2], r16
+    void storeWordIndexed(Register reg, Register index)
+    {
+        emit({0x66, 0x89, (uint8_t)(0x04 | reg << 3), (uint8_t)(0x43 | index << 3)});
+    }
+
+    // movzx r32, word [rbx + rbp * 2 + slot * 2]
+    void loadStack(Register reg, int32_t slot)
+    {
+        emit({0x0F, 0xB7, (uint8_t)(0x84 | reg << 3), 0x6B});
+        emit32(slot * 2);
+    }
+
+    // mov word [rbx + rbp * 2 + slot * 2], r16
+    void storeStack(Register reg, int32_t slot)
+    {
+        aluStack(0x89, reg, slot);
+    }
+
+    // mov word [rbx + rbp * 2 + slot * 2], imm16
+    void storeStackImm(int32_t slot, uint16_t value)
+    {
+        aluStack(0xC7, EAX, slot);
+        emit16(value);
+    }
+
+    // A 16-bit instruction on the stack slot, with `reg` as its register
+    // operand or opcode extension.
+    void aluStack(uint8_t opcode, Register reg, int32_t slot)
+    {
+        emit({0x66, opcode, (uint8_t)(0x84 | reg << 3), 0x6B});
+        emit32(slot * 2);
+    }
+
+    // add (0), and (4), sub (5) or cmp (7) r32, imm32
+    void aluImm(int extension, Register reg, uint32_t value)
+    {
+        emit({0x81, (uint8_t)(0xC0 | extension << 3 | reg)});
+        emit32(value);
+    }
+
+    // and r32, 0x7FFF
+    void andMask(Register reg)
+    {
+        aluImm(4, reg, 0x7FFF);
+    }
+
+    // lea r32, [r64 + disp32]
+    void lea(Register dst, Register src, int32_t disp)
+    {
+        emit({0x8D, (uint8_t)(0x80 | dst << 3 | src)});
+        emit32(disp);
+    }
+
+    // mov r32, imm32
+    void movImm(Register reg, uint32_t value)
+    {
+        emit({(uint8_t)(0xB8 | reg)});
+        emit32(value);
+    }
+
+    // mov r32, r32
+    void mov(Register dst, Register src)
+    {
+        emit({0x89, (uint8_t)(0xC0 | src << 3 | dst)});
+    }
+
+    // movzx r32, r16
+    void movzxWord(Register dst, Register src)
+    {
+        emit({0x0F, 0xB7, (uint8_t)(0xC0 | dst << 3 | src)});
+    }
+
+    // Adds the pending pushes to ebp.
+    void settle(int32_t &depth)
+    {
+        if (depth != 0)
+        {
+            lea(EBP, EBP, depth);
+            depth = 0;
+        }
+    }
+
+    // eax = RAM[base] + index
+    void segmentAddress(const Op &op)
+    {
+        loadWord(EAX, op.base * 2);
+        aluImm(0, EAX, op.arg);
+        andMask(EAX);
+    }
+
+    // mov eax, pc; jmp [r15 + rax * 8]
+    void tableJump(uint32_t pc)
+    {
+        movImm(EAX, pc);
+        emit({0x41, 0xFF, 0x24, 0xC7});
+    }
+
+    // mov eax, pc; jmp exit
+    void exitTo(uint32_t pc)
+    {
+        movImm(EAX, pc);
+        emit({0xE9});
+        emit32(m_exit - (m_region + m_used + m_buffer.size() + 4));
+    }
+
+    void jump(uint32_t target, uint32_t start, uint32_t end, vector<Fixup> &jumps)
+    {
+        if (target < start || target >= end)
+        {
+            tableJump(target);
+            return;
+        }
+
+        emit({0xE9});
+        jumps.push_back({m_buffer.size(), target});
+        emit32(0);
+    }
+};
+#else
+class VMJit
+{
+public:
+    bool init(const vector<Op> &, uint32_t)
+    {
+        return false;
+    }
+
+    bool enterable(uint32_t)
+    {
+        return false;
+    }
+
+    uint32_t enter(uint32_t pc, int16_t *, uint64_t &, uint64_t)
+    {
+        return pc;
+    }
+};
+#endif
+
+// Executes VM programs directly on a Hack RAM image, without translating them
+// to assembly first. The RAM follows the Hack memory map, so SCREEN and KBD
+// are where Jack OS code expects them and statics use the same layout as
+// vm-translator.
+class VMEngine
+{
+public:
+    static const int RAM_SIZE = 32768;
+    static const int SCREEN = 16384;
+    static const int KBD = 24576;
+
+private:
+    vector<Op> m_code;
+    vector<int16_t> m_ram = vector<int16_t>(RAM_SIZE);
+    map<string, int> m_functions;
+    map<string, int> m_statics;
+    size_t m_pc = 0;
+    VMJit m_jit;
+    bool m_jitEnabled = false;
+
+public:
+    // Loads .vm files and directories of .vm files. When the same class is
+    // found more than once the first one wins, so a test directory can be
+    // loaded ahead of a directory holding the complete OS.
+    bool load(const vector<string> &paths)
+    {
+        vector<filesystem::path> files;
+        set<string> classes;
+
+        for (const auto &path : paths)
+        {
+            vector<filesystem::path> entries;
+
+            if (filesystem::is_directory(path))
+            {
+                for (const auto &entry : filesystem::directory_iterator(path))
+                {
+                    if (entry.path().extension() == ".vm")
+                    {
+                        entries.push_back(entry.path());
+                    }
+                }
+                sort(entries.begin(), entries.end());
+            }
+            else
+            {
+                entries.push_back(path);
+            }
+
+            for (const auto &entry : entries)
+            {
+                if (classes.insert(entry.stem()).second)
+                {
+                    files.push_back(entry);
+                }
+            }
+        }
+
+        return decode(files);
+    }
+
+    // Sets SP to 256 and calls Sys.init, leaving the same frame as the
+    // translator's bootstrap code; returning from Sys.init halts. Programs
+    // without Sys.init start at their first command.
+    void reset()
+    {
+        fill(m_ram.begin(), m_ram.end(), 0);
+        m_ram[0] = 256;
+        m_pc = 1;
+
+        auto sysInit = m_functions.find("Sys.init");
+        if (sysInit != m_functions.end())
+        {
+            m_ram[0] = 261;
+            m_ram[1] = 261;
+            m_ram[2] = 256;
+            m_pc = sysInit->second;
+        }
+    }
+
+    // Compiles functions to native code once they have been entered
+    // threshold times. Must be called after load; returns false when the
+    // platform has no JIT support.
+    bool enableJit(uint32_t threshold)
+    {
+        m_jitEnabled = m_jit.init(m_code, threshold);
+        return m_jitEnabled;
+    }
+
+    // Runs until the program halts or maxSteps commands have been executed,
+    // and returns the number of commands executed. Dispatch is a computed
+    // goto through a table of label addresses (a GCC/Clang extension), so
+    // every handler ends in its own indirect jump to the next one. With the
+    // JIT enabled, calls, returns and jumps continue in native code whenever
+    // their target has been compiled.
+    uint64_t run(uint64_t maxSteps)
+    {
+        static const void *dispatch[] = {
+            &&push_constant, &&push_segment, &&push_address, &&pop_segment, &&pop_address,
+            &&add, &&sub, &&neg, &&eq, &&gt, &&lt, &&op_and, &&op_or, &&op_not,
+            &&op_goto, &&if_goto, &&call, &&function, &&op_return, &&halt};
+
+        int16_t *ram = m_ram.data();
+        const Op *code = m_code.data();
+        const Op *op = code + m_pc;
+        uint64_t steps = 0;
+        bool jit = m_jitEnabled;
+
+#define AT(address) ram[(uint16_t)(address) & 0x7FFF]
+#define SP ram[0]
+#define DISPATCH()                  \
+    do                              \
+    {                               \
+        if (steps == maxSteps)      \
+            goto stop;              \
+        steps++;                    \
+        goto *dispatch[op->opcode]; \
+    } while (0)
+#define JIT_ENTER()                                                       \
+    if (jit && m_jit.enterable(op - code))                               \
+    {                                                                    \
+        op = code + m_jit.enter(op - code, ram, steps, maxSteps);        \
+    }
+#define NEXT() \
+    op++;      \
+    DISPATCH()
+#define BINARY(expr)                   \
+    {                                  \
+        int16_t y = AT(--SP);          \
+        int16_t &x = AT(SP - 1);       \
+        x = (int16_t)(expr);           \
+        NEXT();                        \
+    }
+
+        DISPATCH();
+
+    push_constant:
+        AT(SP++) = op->arg;
+        NEXT();
+
+    push_segment:
+        AT(SP++) = AT(ram[op->base] + op->arg);
+        NEXT();
+
+    push_address:
+        AT(SP++) = ram[op->arg];
+        NEXT();
+
+    pop_segment:
+        AT(ram[op->base] + op->arg) = AT(--SP);
+        NEXT();
+
+    pop_address:
+        ram[op->arg] = AT(--SP);
+        NEXT();
+
+    add:
+        BINARY(x + y);
+
+    sub:
+        BINARY(x - y);
+
+    neg:
+        AT(SP - 1) = -AT(SP - 1);
+        NEXT();
+
+    eq:
+        BINARY(x == y ? -1 : 0);
+
+    gt:
+        BINARY(x > y ? -1 : 0);
+
+    lt:
+        BINARY(x < y ? -1 : 0);
+
+    op_and:
+        BINARY(x & y);
+
+    op_or:
+        BINARY(x | y);
+
+    op_not:
+        AT(SP - 1) = ~AT(SP - 1);
+        NEXT();
+
+    op_goto:
+        op = code + op->arg;
+        JIT_ENTER();
+        DISPATCH();
+
+    if_goto:
+        if (AT(--SP) != 0)
+        {
+            op = code + op->arg;
+            JIT_ENTER();
+            DISPATCH();
+        }
+        NEXT();
+
+    call:
+    {
+        int16_t frame = SP;
+        AT(frame) = (op - code) + 1;
+        AT(frame + 1) = ram[1];
+        AT(frame + 2) = ram[2];
+        AT(frame + 3) = ram[3];
+        AT(frame + 4) = ram[4];
+        SP = frame + 5;
+        ram[2] = frame - op->base;
+        ram[1] = SP;
+        op = code + op->arg;
+        JIT_ENTER();
+        DISPATCH();
+    }
+
+    function:
+        for (int i = 0; i < op->base; i++)
+        {
+            AT(SP++) = 0;
+        }
+        NEXT();
+
+    op_return:
+    {
+        int16_t frame = ram[1];
+        uint16_t returnAddress = AT(frame - 5);
+        AT(ram[2]) = AT(SP - 1);
+        SP = ram[2] + 1;
+        ram[4] = AT(frame - 1);
+        ram[3] = AT(frame - 2);
+        ram[2] = AT(frame - 3);
+        ram[1] = AT(frame - 4);
+        op = code + (returnAddress < m_code.size() ? returnAddress : 0);
+        JIT_ENTER();
+        DISPATCH();
+    }
+
+    halt:
+        steps--;
+
+    stop:
+#undef BINARY
+#undef NEXT
+#undef JIT_ENTER
+#undef DISPATCH
+#undef SP
+#undef AT
+        m_pc = op - code;
+        return steps;
+    }
+
+    bool halted() const
+    {
+        return m_code[m_pc].opcode == OP_HALT;
+    }
+
+    int16_t *ram()
+    {
+        return m_ram.data();
+    }
+
+    const map<string, int> &statics() const
+    {
+        return m_statics;
+    }
+
+private:
+    // Decodes every file into one op array. Op 0 is the halt the bootstrap
+    // call returns to, and a halt follows the last file. Labels are scoped
+    // to their function, or to their file outside of functions.
+    bool decode(const vector<filesystem::path> &files)
+    {
+        struct Command
+        {
+            CommandType type;
+            string arg1;
+            string arg2;
+            string scope;
+        };
+
+        vector<Command> commands = {{C_RETURN, "", "", ""}};
+        map<string, int> labels;
+        set<string> staticSymbols;
+
+        for (const auto &file : files)
+        {
+            string className = file.stem();
+            string scope = className;
+            Parser parser(file.string());
+
+            while (parser.hasMoreCommands())
+            {
+                Command command{parser.commandType(), parser.arg1(), parser.arg2(), scope};
+
+                if (command.type == C_FUNCTION)
+                {
+                    scope = command.arg1;
+                    command.scope = scope;
+                    m_functions[scope] = commands.size();
+                }
+                else if (command.type == C_LABEL)
+                {
+                    labels[scope + "$" + command.arg1] = commands.size();
+                    parser.advance();
+                    continue;
+                }
+                else if ((command.type == C_PUSH || command.type == C_POP) && command.arg1 == "static")
+                {
+                    command.arg1 = className + "." + command.arg2;
+                    staticSymbols.insert(command.arg1);
+                }
+
+                commands.push_back(command);
+                parser.advance();
+            }
+        }
+        commands.push_back({C_RETURN, "", "", ""});
+
+        m_statics = layoutStatics(staticSymbols);
+        const map<string, int> segments = {{"local", 1}, {"argument", 2}, {"this", 3}, {"that", 4}};
+        const map<string, Opcode> arithmetic = {
+            {"add", OP_ADD}, {"sub", OP_SUB}, {"neg", OP_NEG}, {"eq", OP_EQ}, {"gt", OP_GT}, {"lt", OP_LT}, {"and", OP_AND}, {"or", OP_OR}, {"not", OP_NOT}};
+
+        m_code.assign(commands.size(), {OP_HALT, 0, 0});
+        for (size_t i = 1; i + 1 < commands.size(); i++)
+        {
+            const auto &command = commands[i];
+            Op &op = m_code[i];
+
+            switch (command.type)
+            {
+            case C_ARITHMETIC:
+                op.opcode = arithmetic.at(command.arg1);
+                break;
+
+            case C_PUSH:
+            case C_POP:
+            {
+                bool push = command.type == C_PUSH;
+                auto segment = segments.find(command.arg1);
+
+                if (push && command.arg1 == "constant")
+                {
+                    op = {OP_PUSH_CONSTANT, 0, stoi(command.arg2)};
+                }
+                else if (segment != segments.end())
+                {
+                    op = {push ? OP_PUSH_SEGMENT : OP_POP_SEGMENT, (uint16_t)segment->second, stoi(command.arg2)};
+                }
+                else if (command.arg1 == "temp" || command.arg1 == "pointer")
+                {
+                    op = {push ? OP_PUSH_ADDRESS : OP_POP_ADDRESS, 0, stoi(command.arg2) + (command.arg1 == "pointer" ? 3 : 5)};
+                }
+                else if (m_statics.count(command.arg1))
+                {
+                    op = {push ? OP_PUSH_ADDRESS : OP_POP_ADDRESS, 0, m_statics.at(command.arg1)};
+                }
+                else
+                {
+                    cerr << "Error: invalid segment " << command.arg1 << " in " << command.scope << endl;
+                    return false;
+                }
+                break;
+            }
+
+            case C_GOTO:
+            case C_IF:
+            {
+                auto label = labels.find(command.scope + "$" + command.arg1);
+                if (label == labels.end())
+                {
+                    cerr << "Error: undefined label " << command.arg1 << " in " << command.scope << endl;
+                    return false;
+                }
+                op = {command.type == C_GOTO ? OP_GOTO : OP_IF_GOTO, 0, label->second};
+                break;
+            }
+
+            case C_CALL:
+            {
+                auto function = m_functions.find(command.arg1);
+                if (function == m_functions.end())
+                {
+                    cerr << "Error: undefined function " << command.arg1 << " called from " << command.scope << endl;
+                    return false;
+                }
+                op = {OP_CALL, (uint16_t)stoi(command.arg2), function->second};
+                break;
+            }
+
+            case C_FUNCTION:
+                op = {OP_FUNCTION, (uint16_t)stoi(command.arg2), 0};
+                break;
+
+            case C_RETURN:
+                op.opcode = OP_RETURN;
+                break;
+
+            default:
+                break;
+            }
+        }
+
+        for (size_t i = 1; i + 1 < m_code.size(); i++)
+        {
+            if (m_code[i].opcode == OP_GOTO && isIdleLoop(m_code[i].arg, i))
+            {
+                m_code[i] = {OP_HALT, 0, 0};
+            }
+        }
+
+        return true;
+    }
+
+    // Whether ops first..last form a loop that can never exit and has no
+    // side effects, such as Sys.halt's `while (true) {}`. Such loops are
+    // decoded as a halt so the engine stops instead of spinning.
+    bool isIdleLoop(size_t first, size_t last)
+    {
+        if (first > last)
+        {
+            return false;
+        }
+
+        vector<int16_t> stack;
+        for (size_t i = first; i < last; i++)
+        {
+            const Op &op = m_code[i];
+
+            if (op.opcode == OP_PUSH_CONSTANT)
+            {
+                stack.push_back(op.arg);
+            }
+            else if ((op.opcode == OP_NEG || op.opcode == OP_NOT) && !stack.empty())
+            {
+                stack.back() = op.opcode == OP_NEG ? -stack.back() : ~stack.back();
+            }
+            else if (op.opcode == OP_IF_GOTO && !stack.empty() && stack.back() == 0)
+            {
+                stack.pop_back();
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        return stack.empty();
+    }
+};
+
+#endif
@@ -0,0 +1,174 @@
+#include <iostream>
+#include <string>
+#include <map>
+#include <vector>
+#include "./vm-engine.hpp"
+#include "../05/test-script.hpp"
+
+using namespace std;
+
+// Runs the VM emulator test scripts of projects 07, 08 and 12 against
+// VMEngine. Classes a test directory does not define, such as the OS
+// classes the project 12 tests rely on, are taken from the library
+// directories given with --lib. --jit runs the scripts with the JIT
+// compiling functions after --jit-threshold entries, as in vm-emulator.
+
+class VMTestScript : public TestScript
+{
+private:
+    VMEngine m_engine;
+    vector<string> m_libraries;
+    int m_jitThreshold;
+    bool m_loaded = false;
+
+public:
+    VMTestScript(const string &scriptPath, const vector<string> &libraries, int jitThreshold) : TestScript(scriptPath, "vmstep")
+    {
+        m_libraries = libraries;
+        m_jitThreshold = jitThreshold;
+    }
+
+protected:
+    bool load(const string &filename) override
+    {
+        vector<string> paths = {(filename.empty() ? m_directory : m_directory / filename).string()};
+        paths.insert(paths.end(), m_libraries.begin(), m_libraries.end());
+
+        if (!m_engine.load(paths))
+        {
+            m_error = "cannot load " + (filename.empty() ? m_directory.string() : filename);
+            return false;
+        }
+
+        if (m_jitThreshold >= 0 && !m_engine.enableJit(m_jitThreshold))
+        {
+            cerr << "Warning: JIT is not supported on this platform, interpreting" << endl;
+        }
+
+        m_engine.reset();
+        m_loaded = true;
+        return true;
+    }
+
+    // A halted program stays halted, so further steps change nothing.
+    bool step(uint64_t count) override
+    {
+        if (!m_loaded)
+        {
+            m_error = "no program loaded";
+            return false;
+        }
+
+        m_engine.run(count);
+        return true;
+    }
+
+    bool get(const string &name, int16_t &value) override
+    {
+        int address = resolve(name);
+        if (address < 0)
+        {
+            m_error = "unknown variable " + name;
+            return false;
+        }
+
+        value = m_engine.ram()[address];
+        return true;
+    }
+
+    bool set(const string &name, int16_t value) override
+    {
+        int address = resolve(name);
+        if (address < 0)
+        {
+            m_error = "unknown variable " + name;
+            return false;
+        }
+
+        m_engine.ram()[address] = value;
+        return true;
+    }
+
+private:
+    // Maps the emulator's variables to RAM addresses: sp, local, argument,
+    // this and that are the pointers themselves, local[i] to that[i] index
+    // their segment, and temp[i], pointer[i] and RAM[i] are fixed addresses.
+    int resolve(const string &name)
+    {
+        static const map<string, int> pointers = {{"sp", 0}, {"local", 1}, {"argument", 2}, {"this", 3}, {"that", 4}};
+        int16_t *ram = m_engine.ram();
+
+        auto bracketPos = name.find("[");
+        if (bracketPos == string::npos)
+        {
+            auto pointer = pointers.find(name);
+            return pointer == pointers.end() ? -1 : pointer->second;
+        }
+
+        string segment = name.substr(0, bracketPos);
+        string digits = name.substr(bracketPos + 1, name.size() - bracketPos - 2);
+        if (name.back() != ']' || digits.empty() || digits.find_first_not_of("0123456789") != string::npos)
+        {
+            return -1;
+        }
+
+        int index = stoi(digits);
+        if (segment == "RAM")
+        {
+            return index & (VMEngine::RAM_SIZE - 1);
+        }
+        if (segment == "temp")
+        {
+            return (5 + index) & (VMEngine::RAM_SIZE - 1);
+        }
+        if (segment == "pointer")
+        {
+            return (3 + index) & (VMEngine::RAM_SIZE - 1);
+        }
+
+        auto pointer = pointers.find(segment);
+        if (pointer == pointers.end() || segment == "sp")
+        {
+            return -1;
+        }
+        return (ram[pointer->second] + index) & (VMEngine::RAM_SIZE - 1);
+    }
+};
+
+int main(int argc, char **argv)
+{
+    vector<string> libraries;
+    int jitThreshold = -1;
+    vector<string> scriptPaths;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+
+        if (arg == "--lib" && i + 1 < argc)
+        {
+            libraries.push_back(argv[++i]);
+        }
+        else if (arg == "--jit")
+        {
+            jitThreshold = jitThreshold < 0 ? 10 : jitThreshold;
+        }
+        else if (arg == "--jit-threshold" && i + 1 < argc)
+        {
+            jitThreshold = stoi(argv[++i]);
+        }
+        else
+        {
+            scriptPaths.push_back(arg);
+        }
+    }
+
+    if (scriptPaths.empty())
+    {
+        cout << "Invalid argument: specify path to .tst file" << endl
+             << "Usage: vm-test [--lib <directory>]... [--jit] [--jit-threshold N] <file.tst>..." << endl;
+        return -1;
+    }
+
+    return runScripts<VMTestScript>(scriptPaths, libraries, jitThreshold);
+}
@@ -2,138 +2,215 @@
 #include <fstream>
 #include <string>
 #include <map>
+#include <unordered_map>
+#include <vector>
+#include <bitset>
+#include <set>
+#include <algorithm>
+#include <iomanip>
 #include <filesystem>
 #include <regex>
+#include <sstream>
+#include "./vm-common.hpp"
+#include "../06/hack-code.hpp"
 
 using namespace std;
 
-enum CommandType
+void saveStaticMap(const map<string, int> &statics, const string &filename)
 {
-    C_ARITHMETIC,
-    C_PUSH,
-    C_POP,
-    C_LABEL,
-    C_GOTO,
-    C_IF,
-    C_FUNCTION,
-    C_RETURN,
-    C_CALL
-};
-
-class Parser
-{
-private:
-    ifstream m_file;
-    string m_line;
-
-public:
-    Parser(string filename)
+    vector<pair<int, string>> addresses;
+    for (const auto &[symbol, address] : statics)
     {
-        m_file.open(filename);
+        addresses.push_back({address, symbol});
     }
+    sort(addresses.begin(), addresses.end());
 
-    ~Parser()
+    ofstream file(filename);
+    for (const auto &[address, symbol] : addresses)
     {
-        m_file.close();
+        file << address << " " << symbol << endl;
     }
+}
 
-    bool hasMoreCommands()
-    {
-        return !m_file.eof();
-    }
+// Code size of one VM function, with each generated Hack instruction
+// attributed to the VM command type it was translated from.
+struct FunctionStats
+{
+    string name;
+    int instructions = 0;
+    int labels = 0;
+    map<CommandType, int> commands;
+};
 
-    void advance()
+struct Instruction
+{
+    enum Kind
     {
-        if (!hasMoreCommands())
-            return;
+        A_INSTRUCTION,
+        C_INSTRUCTION,
+        L_INSTRUCTION,
+        COMMENT
+    };
 
-        do
-        {
-            getline(m_file, m_line);
-            cleanLine(m_line);
-        } while (hasMoreCommands() && m_line.empty());
-    }
+    Kind kind;
+    string text;
+    uint16_t word;
+};
 
-    CommandType commandType()
+// A relocatable translation of a single .vm file. Words that hold a ROM
+// address inside the module, the address of another module's function or
+// the RAM address of a static variable are listed as relocations and are
+// patched by the linker once the final layout is known.
+struct ObjectModule
+{
+    enum RelocationKind
     {
-        map<string, CommandType> commands;
-        commands["add"] = C_ARITHMETIC;
-        commands["sub"] = C_ARITHMETIC;
-        commands["neg"] = C_ARITHMETIC;
-        commands["eq"] = C_ARITHMETIC;
-        commands["gt"] = C_ARITHMETIC;
-        commands["lt"] = C_ARITHMETIC;
-        commands["and"] = C_ARITHMETIC;
-        commands["or"] = C_ARITHMETIC;
-        commands["not"] = C_ARITHMETIC;
-        commands["push"] = C_PUSH;
-        commands["pop"] = C_POP;
-        commands["call"] = C_CALL;
-        commands["function"] = C_FUNCTION;
-        commands["return"] = C_RETURN;
-        commands["label"] = C_LABEL;
-        commands["goto"] = C_GOTO;
-        commands["if-goto"] = C_IF;
+        R_LOCAL,
+        R_SYMBOL,
+        R_STATIC
+    };
 
-        return commands.find(m_line.substr(0, m_line.find(" ")))->second;
-    }
+    struct Relocation
+    {
+        int offset;
+        RelocationKind kind;
+        string symbol;
+    };
+
+    string name;
+    vector<uint16_t> code;
+    map<string, int> exports;
+    vector<string> statics;
+    vector<Relocation> relocations;
 
-    string arg1()
+    void save(const string &filename) const
     {
-        if (commandType() == C_RETURN)
+        ofstream file(filename);
+
+        file << "module " << name << endl;
+
+        for (const auto &[symbol, offset] : exports)
         {
-            return "";
+            file << "export " << symbol << " " << offset << endl;
         }
 
-        auto first_pos = m_line.find(" ");
+        for (const auto &symbol : statics)
+        {
+            file << "static " << symbol << endl;
+        }
 
-        if (commandType() == C_ARITHMETIC)
+        for (const auto &relocation : relocations)
         {
-            return m_line.substr(0, first_pos);
+            file << "reloc " << relocation.offset << " ";
+
+            switch (relocation.kind)
+            {
+            case R_LOCAL:
+                file << "local" << endl;
+                break;
+
+            case R_SYMBOL:
+                file << "symbol " << relocation.symbol << endl;
+                break;
+
+            case R_STATIC:
+                file << "static " << relocation.symbol << endl;
+                break;
+            }
         }
 
-        return m_line.substr(first_pos + 1, m_line.find(" ", first_pos + 1) - first_pos - 1);
+        file << "code " << code.size() << hex << setfill('0');
+        for (size_t i = 0; i < code.size(); i++)
+        {
+            file << (i % 8 == 0 ? "\n" : " ") << setw(4) << code[i];
+        }
+        file << endl;
     }
 
-    string arg2()
+    bool load(const string &filename)
     {
-        CommandType cmd = commandType();
-        if (cmd == C_PUSH || cmd == C_POP || cmd == C_FUNCTION || cmd == C_CALL)
+        ifstream file(filename);
+        string directive;
+
+        if (!(file >> directive >> name) || directive != "module")
         {
-            auto first_pos = m_line.find(" ");
-            auto second_pos = m_line.find(" ", first_pos + 1);
-            auto third_pos = m_line.find(" ", second_pos + 1);
-            return m_line.substr(second_pos + 1, third_pos - second_pos - 1);
+            return false;
         }
-        else
+
+        while (file >> directive)
         {
-            return "";
+            if (directive == "export")
+            {
+                string symbol;
+                int offset;
+                file >> symbol >> offset;
+                exports[symbol] = offset;
+            }
+            else if (directive == "static")
+            {
+                string symbol;
+                file >> symbol;
+                statics.push_back(symbol);
+            }
+            else if (directive == "reloc")
+            {
+                Relocation relocation{0, R_LOCAL, ""};
+                string kind;
+                file >> relocation.offset >> kind;
+
+                if (kind == "symbol" || kind == "static")
+                {
+                    relocation.kind = kind == "symbol" ? R_SYMBOL : R_STATIC;
+                    file >> relocation.symbol;
+                }
+
+                relocations.push_back(relocation);
+            }
+            else if (directive == "code")
+            {
+                size_t size;
+                file >> size >> hex;
+                code.resize(size);
+
+                for (auto &word : code)
+                {
+                    file >> word;
+                }
+
+                return !file.fail();
+            }
+            else
+            {
+                return false;
+            }
         }
-    }
 
-private:
-    void cleanLine(string &input)
-    {
-        regex r("//.*|\r|\n");
-        input = regex_replace(input, r, "");
+        return false;
     }
 };
 
 class CodeWriter
 {
 private:
-    ofstream m_file;
+    static const int LOCALS_LOOP_THRESHOLD = 2;
+
+    vector<Instruction> m_code;
     string m_filename;
     int m_count = 0;
     map<string, string> m_symbols;
+    vector<string> m_functions;
+    set<string> m_statics;
+    vector<FunctionStats> m_stats;
+    bool m_inFunction = false;
+    string m_scope;
+    CommandType m_command = C_CALL;
 
 public:
     CodeWriter(string filename)
     {
-        m_file.open(filename);
-
         filesystem::path tmp(filename);
         m_filename = tmp.stem();
+        m_scope = m_filename;
 
         m_symbols["local"] = "LCL";
         m_symbols["argument"] = "ARG";
@@ -142,54 +219,52 @@ public:
         m_symbols["temp"] = "R5";
     }
 
-    ~CodeWriter()
-    {
-        m_file.close();
-    }
-
     void writeArithmetic(const string &input)
     {
 
         if (input == "add")
         {
-            m_file << "// add\n" + getOperatorSnippet("D+M") << endl;
+            emitComment("add");
+            emitOperator("D+M");
             return;
         }
 
         if (input == "sub")
         {
-            m_file << "// sub\n" + getOperatorSnippet("M-D") << endl;
+            emitComment("sub");
+            emitOperator("M-D");
             return;
         }
 
         if (input == "neg")
         {
-            m_file << R"(// neg
-@SP
-A=M-1
-M=-M)" << endl;
+            emitComment("neg");
+            emitA("SP");
+            emitC("A=M-1");
+            emitC("M=-M");
             return;
         }
 
         if (input == "and")
         {
-            m_file
-                << "// and\n" + getOperatorSnippet("D&M") << endl;
+            emitComment("and");
+            emitOperator("D&M");
             return;
         }
 
         if (input == "or")
         {
-            m_file << "// or\n" + getOperatorSnippet("D|M") << endl;
+            emitComment("or");
+            emitOperator("D|M");
             return;
         }
 
         if (input == "not")
         {
-            m_file << R"(// not
-@SP
-A=M-1
-M=!M)" << endl;
+            emitComment("not");
+            emitA("SP");
+            emitC("A=M-1");
+            emitC("M=!M");
             return;
         }
 
@@ -199,140 +274,120 @@ M=!M)" << endl;
 
         if (input == "eq")
         {
-            m_file << "// eq\n" + getComparisonSnippet(label, "JNE") << endl;
+            emitComment("eq");
+            emitComparison(label, "JNE");
             return;
         }
 
         if (input == "gt")
         {
-            m_file << "// gt\n" + getComparisonSnippet(label, "JLE") << endl;
+            emitComment("gt");
+            emitComparison(label, "JLE");
             return;
         }
 
         if (input == "lt")
         {
-            m_file << "// lt\n" + getComparisonSnippet(label, "JGE") << endl;
+            emitComment("lt");
+            emitComparison(label, "JGE");
             return;
         }
     }
 
     void writePushPop(const CommandType &cmd, const string &segment, const string &index)
     {
-        m_file << "// " << (cmd == C_PUSH ? "push" : "pop") << " " << segment << endl;
+        emitComment((cmd == C_PUSH ? "push " : "pop ") + segment);
 
         if (cmd == C_PUSH && segment == "constant")
         {
-            m_file << "@" << index << R"(
-D=A
-@SP
-AM=M+1
-A=A-1
-M=D)" << endl;
+            emitA(index);
+            emitC("D=A");
+            emitPushD();
             return;
         }
         else if (cmd == C_PUSH && segment == "static")
         {
-            m_file << "@" << m_filename << "." << index << R"(
-D=M
-@SP
-AM=M+1
-A=A-1
-M=D)" << endl;
+            emitStatic(index);
+            emitC("D=M");
+            emitPushD();
             return;
         }
         else if (cmd == C_PUSH && (segment == "pointer" || segment == "temp"))
         {
-            m_file << "@R" << to_string(stoi(index) + (segment == "pointer" ? 3 : 5)) << R"(
-D=M
-@SP
-AM=M+1
-A=A-1
-M=D)" << endl;
+            emitA("R" + to_string(stoi(index) + (segment == "pointer" ? 3 : 5)));
+            emitC("D=M");
+            emitPushD();
             return;
         }
         else if (cmd == C_PUSH)
         {
-            m_file << "@" << index << R"(
-D=A
-@)" << m_symbols.find(segment)->second
-                   << R"(
-A=D+M
-D=M
-@SP
-AM=M+1
-A=A-1
-M=D)" << endl;
+            emitA(index);
+            emitC("D=A");
+            emitA(m_symbols.find(segment)->second);
+            emitC("A=D+M");
+            emitC("D=M");
+            emitPushD();
             return;
         }
         else if (cmd == C_POP && segment == "static")
         {
-            m_file << R"(@SP
-AM=M-1
-D=M
-@)" << m_filename << "."
-                   << index << endl
-                   << "M=D" << endl;
+            emitPopD();
+            emitStatic(index);
+            emitC("M=D");
             return;
         }
         else if (cmd == C_POP && (segment == "pointer" || segment == "temp"))
         {
-            m_file << R"(@SP
-AM=M-1
-D=M
-@R)" << to_string(stoi(index) + (segment == "pointer" ? 3 : 5))
-                   << endl
-                   << "M=D" << endl;
+            emitPopD();
+            emitA("R" + to_string(stoi(index) + (segment == "pointer" ? 3 : 5)));
+            emitC("M=D");
             return;
         }
         else if (cmd == C_POP)
         {
-            m_file << "@" << index << R"(
-D=A
-@)" << m_symbols.find(segment)->second
-                   << R"(
-D=D+M
-@R13
-M=D
-@SP
-AM=M-1
-D=M
-@R13
-A=M
-M=D)" << endl;
+            emitA(index);
+            emitC("D=A");
+            emitA(m_symbols.find(segment)->second);
+            emitC("D=D+M");
+            emitA("R13");
+            emitC("M=D");
+            emitPopD();
+            emitA("R13");
+            emitC("A=M");
+            emitC("M=D");
             return;
         }
     }
 
     void writeInit()
     {
-        m_file << R"(@256
-D=A
-@SP
-M=D
-)";
+        m_stats.push_back(FunctionStats{"(bootstrap)", 0, 0, {}});
+        m_inFunction = true;
+        m_command = C_CALL;
+        emitA("256");
+        emitC("D=A");
+        emitA("SP");
+        emitC("M=D");
         writeCall("Sys.init", 0);
+        m_inFunction = false;
     }
 
     void writeLabel(const string &label)
     {
-        m_file << "(" << label << ")" << endl;
+        emitLabel(scoped(label));
     }
 
     void writeGoto(const string &label)
     {
-        m_file << "// goto " << label << endl
-               << "@" << label << endl
-               << "0;JMP" << endl;
+        emitGoto(scoped(label));
     }
 
     void writeIf(const string &label)
     {
-        m_file << "// if-goto " << label << R"(
-@SP
-AM=M-1
-D=M
-@)" << label << endl
-               << "D;JNE" << endl;
+        emitComment("if-goto " + label);
+        emitPopD();
+        emitA(scoped(label));
+        emitC("D;JNE");
     }
 
     void writeCall(const string &functionName, int numArgs)
@@ -346,8 +401,8 @@ D=M
         pushData("THAT");
         setAddress("ARG", "SP", -5 - numArgs);
         setAddress("LCL", "SP");
-        writeGoto(functionName);
-        writeLabel(retAddress);
+        emitGoto(functionName);
+        emitLabel(retAddress);
     }
 
     void writeReturn()
@@ -360,45 +415,356 @@ D=M
         setData("THIS", "R15", -2);
         setData("ARG", "R15", -3);
         setData("LCL", "R15", -4);
-        m_file << R"(@R14
-A=M
-0;JMP)" << endl;
+        emitA("R14");
+        emitC("A=M");
+        emitC("0;JMP");
     }
 
     void writeFunction(const string &functionName, int numLocals)
     {
-        writeLabel(functionName);
-        for (size_t i = 0; i < numLocals; i++)
+        m_functions.push_back(functionName);
+        m_stats.push_back(FunctionStats{functionName, 0, 0, {}});
+        m_inFunction = true;
+        m_scope = functionName;
+        emitLabel(functionName);
+
+        if (numLocals < LOCALS_LOOP_THRESHOLD)
         {
-            writePushPop(C_PUSH, "constant", "0");
+            for (int i = 0; i < numLocals; i++)
+            {
+                writePushPop(C_PUSH, "constant", "0");
+            }
+            return;
         }
+
+        // One zeroing push per iteration, counted down in D. Costs the same
+        // six cycles per local as the unrolled pushes but a fixed 8 words.
+        // Like the other generated labels it has no $, so no VM label can
+        // collide with it.
+        m_count++;
+        const string loopLabel = "INIT_LOCALS_" + to_string(m_count);
+        emitComment("init locals " + to_string(numLocals));
+        emitA(to_string(numLocals));
+        emitC("D=A");
+        emitLabel(loopLabel);
+        emitA("SP");
+        emitC("AM=M+1");
+        emitC("A=A-1");
+        emitC("M=0");
+        emitA(loopLabel);
+        emitC("D=D-1;JGT");
     }
 
     void setFileName(const string &filename)
     {
         m_filename = filename;
+        m_scope = filename;
+        m_inFunction = false;
+    }
+
+    void setCommandType(CommandType cmd)
+    {
+        m_command = cmd;
+    }
+
+    const vector<FunctionStats> &stats() const
+    {
+        return m_stats;
+    }
+
+    // Lays out the statics written so far, for saveAsm and saveHack to
+    // share, so both give each static the same address.
+    map<string, int> staticLayout() const
+    {
+        return layoutStatics(m_statics);
+    }
+
+    // Writes the code as assembly. Statics get the numeric addresses of
+    // the layout, named in a comment, rather than being left to the
+    // assembler's first-use allocation, so the .asm and .hack files and
+    // the .map agree.
+    void saveAsm(const string &filename, const map<string, int> &statics)
+    {
+        ofstream file(filename);
+
+        for (const auto &instruction : m_code)
+        {
+            switch (instruction.kind)
+            {
+            case Instruction::COMMENT:
+                file << "// " << instruction.text << endl;
+                break;
+
+            case Instruction::L_INSTRUCTION:
+                file << "(" << instruction.text << ")" << endl;
+                break;
+
+            case Instruction::A_INSTRUCTION:
+                if (statics.count(instruction.text))
+                {
+                    file << "@" << statics.at(instruction.text) << " // " << instruction.text << endl;
+                    break;
+                }
+                file << "@" << instruction.text << endl;
+                break;
+
+            case Instruction::C_INSTRUCTION:
+                file << instruction.text << endl;
+                break;
+            }
+        }
+    }
+
+    bool saveHack(const string &filename, const map<string, int> &statics)
+    {
+        vector<uint16_t> words;
+        if (!assemble(statics, words))
+        {
+            return false;
+        }
+
+        ofstream file(filename);
+        for (auto word : words)
+        {
+            file << bitset<16>(word).to_string() << endl;
+        }
+
+        return true;
+    }
+
+    // Assembles the code written so far as a relocatable module. Labels are
+    // resolved to module-relative offsets and function labels are exported;
+    // statics and calls into other modules are left to the linker.
+    bool toObject(ObjectModule &module)
+    {
+        module = ObjectModule();
+        module.name = m_filename;
+
+        map<string, int> labels;
+        int lineCount = 0;
+        if (!resolveLabels(labels, lineCount))
+        {
+            return false;
+        }
+
+        for (const auto &function : m_functions)
+        {
+            module.exports[function] = labels[function];
+        }
+
+        const auto &predefined = predefinedSymbols();
+        module.code.reserve(lineCount);
+        for (const auto &instruction : m_code)
+        {
+            if (instruction.kind == Instruction::C_INSTRUCTION)
+            {
+                module.code.push_back(instruction.word);
+                continue;
+            }
+
+            if (instruction.kind != Instruction::A_INSTRUCTION)
+            {
+                continue;
+            }
+
+            const string &s = instruction.text;
+            int offset = module.code.size();
+
+            if (isdigit(s[0]))
+            {
+                module.code.push_back(instruction.word);
+            }
+            else if (predefined.count(s))
+            {
+                module.code.push_back(predefined.at(s));
+            }
+            else if (labels.count(s))
+            {
+                module.relocations.push_back({offset, ObjectModule::R_LOCAL, ""});
+                module.code.push_back(labels[s]);
+            }
+            else if (m_statics.count(s))
+            {
+                if (find(module.statics.begin(), module.statics.end(), s) == module.statics.end())
+                {
+                    module.statics.push_back(s);
+                }
+                module.relocations.push_back({offset, ObjectModule::R_STATIC, s});
+                module.code.push_back(0);
+            }
+            else
+            {
+                module.relocations.push_back({offset, ObjectModule::R_SYMBOL, s});
+                module.code.push_back(0);
+            }
+        }
+
+        return true;
     }
 
 private:
+    // Resolves labels and variables like hack-assembler does: labels take
+    // the ROM address of the next instruction, any other symbol is a variable
+    // allocated in order of first use. Statics are placed up front by the
+    // given layout, so only stray variables are allocated after them.
+    bool assemble(const map<string, int> &statics, vector<uint16_t> &words)
+    {
+        map<string, int> symbolMap = predefinedSymbols();
+        symbolMap.insert(statics.begin(), statics.end());
+
+        int lineCount = 0;
+        if (!resolveLabels(symbolMap, lineCount))
+        {
+            return false;
+        }
+
+        if (lineCount > 32768)
+        {
+            cerr << "Warning: program is " << lineCount << " instructions, ROM holds 32768" << endl;
+        }
+
+        words.clear();
+        words.reserve(lineCount);
+        int availableAddress = 16 + statics.size();
+        for (const auto &instruction : m_code)
+        {
+            if (instruction.kind == Instruction::C_INSTRUCTION)
+            {
+                words.push_back(instruction.word);
+            }
+            else if (instruction.kind == Instruction::A_INSTRUCTION && isdigit(instruction.text[0]))
+            {
+                words.push_back(instruction.word);
+            }
+            else if (instruction.kind == Instruction::A_INSTRUCTION)
+            {
+                const string &s = instruction.text;
+                if (!symbolMap.count(s))
+                {
+                    symbolMap.insert({s, availableAddress});
+                    availableAddress++;
+                }
+                words.push_back(symbolMap[s] & 0x7FFF);
+            }
+        }
+
+        return true;
+    }
+
+    // Adds each label to the symbols with the ROM address of the next
+    // instruction, and counts the instructions. A label defined twice, by
+    // a VM program repeating a label in a function, is an error rather
+    // than a jump to whichever definition came first.
+    bool resolveLabels(map<string, int> &symbols, int &lineCount)
+    {
+        for (const auto &instruction : m_code)
+        {
+            if (instruction.kind == Instruction::L_INSTRUCTION && !symbols.insert({instruction.text, lineCount}).second)
+            {
+                cerr << "Error: label " << instruction.text << " is defined more than once" << endl;
+                return false;
+            }
+            if (instruction.kind == Instruction::C_INSTRUCTION || instruction.kind == Instruction::A_INSTRUCTION)
+            {
+                lineCount++;
+            }
+        }
+
+        return true;
+    }
+
+    void emitA(const string &symbol)
+    {
+        uint16_t word = isdigit(symbol[0]) ? stoi(symbol) & 0x7FFF : 0;
+        countInstruction();
+        m_code.push_back({Instruction::A_INSTRUCTION, symbol, word});
+    }
+
+    void emitC(const string &mnemonic)
+    {
+        countInstruction();
+        m_code.push_back({Instruction::C_INSTRUCTION, mnemonic, Code::encode(mnemonic)});
+    }
+
+    // Code outside of any function, as in the project 07 tests, is counted
+    // under the file name.
+    FunctionStats &currentStats()
+    {
+        if (!m_inFunction)
+        {
+            m_stats.push_back(FunctionStats{m_filename, 0, 0, {}});
+            m_inFunction = true;
+        }
+
+        return m_stats.back();
+    }
+
+    void countInstruction()
+    {
+        auto &stats = currentStats();
+        stats.instructions++;
+        stats.commands[m_command]++;
+    }
+
+    void emitStatic(const string &index)
+    {
+        string symbol = m_filename + "." + index;
+        m_statics.insert(symbol);
+        emitA(symbol);
+    }
+
+    // VM labels are local to their function, or to their file outside of
+    // functions, so classes compiled separately can reuse label names.
+    string scoped(const string &label)
+    {
+        return m_scope + "$" + label;
+    }
+
+    void emitLabel(const string &label)
+    {
+        currentStats().labels++;
+        m_code.push_back({Instruction::L_INSTRUCTION, label, 0});
+    }
+
+    void emitGoto(const string &label)
+    {
+        emitComment("goto " + label);
+        emitA(label);
+        emitC("0;JMP");
+    }
+
+    void emitComment(const string &text)
+    {
+        m_code.push_back({Instruction::COMMENT, text, 0});
+    }
+
+    void emitPushD()
+    {
+        emitA("SP");
+        emitC("AM=M+1");
+        emitC("A=A-1");
+        emitC("M=D");
+    }
+
+    void emitPopD()
+    {
+        emitA("SP");
+        emitC("AM=M-1");
+        emitC("D=M");
+    }
+
     void pushAddress(const string &label)
     {
-        m_file << "@" << label <<
-            R"(
-D=A
-@SP
-AM=M+1
-A=A-1
-M=D)" << endl;
+        emitA(label);
+        emitC("D=A");
+        emitPushD();
     }
 
     void pushData(const string &label)
     {
-        m_file << "@" << label << R"(
-D=M
-@SP
-AM=M+1
-A=A-1
-M=D)" << endl;
+        emitA(label);
+        emitC("D=M");
+        emitPushD();
     }
 
     void setAddress(const string &dest, const string &address, int offset = 0)
@@ -406,12 +772,12 @@ M=D)" << endl;
         bool pos = offset > 0;
         offset = abs(offset);
 
-        m_file << "@" << to_string(offset) << endl
-               << "D=A" << endl
-               << "@" << address << endl
-               << (pos ? "D=D+M" : "D=M-D") << endl
-               << "@" << dest << endl
-               << "M=D" << endl;
+        emitA(to_string(offset));
+        emitC("D=A");
+        emitA(address);
+        emitC(pos ? "D=D+M" : "D=M-D");
+        emitA(dest);
+        emitC("M=D");
     }
 
     void setData(const string &dest, const string &address, int offset = 0)
@@ -419,123 +785,1008 @@ M=D)" << endl;
         bool pos = offset > 0;
         offset = abs(offset);
 
-        m_file << "@" << to_string(offset) << endl
-               << "D=A" << endl
-               << "@" << address << endl
-               << (pos ? "A=D+M" : "A=M-D") << endl
-               << "D=M" << endl
-               << "@" << dest << endl
-               << "M=D" << endl;
-    }
-
-    string getComparisonSnippet(const string &label, const string &jump)
-    {
-        return R"(@SP
-AM=M-1
-D=M
-A=A-1
-D=M-D
-M=0
-@)" + label +
-               R"(
-D;)" + jump +
-               R"#(
-@SP
-A=M-1
-M=-1
-()#" + label +
-               ")";
-    }
-
-    string getOperatorSnippet(const string &line)
-    {
-        return R"(@SP
-AM=M-1
-D=M
-A=A-1
-M=)" + line;
+        emitA(to_string(offset));
+        emitC("D=A");
+        emitA(address);
+        emitC(pos ? "A=D+M" : "A=M-D");
+        emitC("D=M");
+        emitA(dest);
+        emitC("M=D");
+    }
+
+    void emitComparison(const string &label, const string &jump)
+    {
+        emitPopD();
+        emitC("A=A-1");
+        emitC("D=M-D");
+        emitC("M=0");
+        emitA(label);
+        emitC("D;" + jump);
+        emitA("SP");
+        emitC("A=M-1");
+        emitC("M=-1");
+        emitLabel(label);
+    }
+
+    void emitOperator(const string &line)
+    {
+        emitPopD();
+        emitC("A=A-1");
+        emitC("M=" + line);
     }
 };
 
-void handleFile(const string &vmFilePath, CodeWriter &codeWriter)
+// Translates VM code to a standalone C++ program instead of Hack assembly.
+// Every VM function becomes a C++ function and VM calls become C++ calls, but
+// the stack, the frames and all segments live in a global 32K RAM array laid
+// out as on the Hack platform, so RAM dumps match the other backends. Each
+// function keeps SP in a local that the host compiler can hold in a register,
+// addresses pushes and pops relative to it and only writes it back to RAM[0]
+// at labels, jumps, calls and returns.
+class CppWriter
 {
-    Parser parser(vmFilePath);
+private:
+    struct Command
+    {
+        CommandType type;
+        string arg1;
+        string arg2;
+    };
+
+    string m_filename;
+    int m_count = 0;
+    bool m_bootstrap = false;
+    bool m_inFunction = false;
+    string m_function;
+    int m_depth = 0;
+    ostringstream m_functionsCode;
+    ostringstream m_functionBody;
+    ostringstream m_topLevelCode;
+    set<string> m_functionTargets;
+    set<string> m_topLevelTargets;
+    set<string> m_functions;
+    string m_firstFunction;
+    map<string, string> m_calls;
+    set<string> m_statics;
+    vector<Command> m_commands;
+    map<string, size_t> m_labels;
+
+public:
+    CppWriter(string filename)
+    {
+        filesystem::path tmp(filename);
+        m_filename = tmp.stem();
+    }
 
-    while (parser.hasMoreCommands())
+    void writeArithmetic(const string &input)
     {
-        CommandType cType = parser.commandType();
+        m_commands.push_back({C_ARITHMETIC, input, ""});
 
-        if (cType == C_ARITHMETIC)
+        if (input == "neg")
         {
-            codeWriter.writeArithmetic(parser.arg1());
+            emit(slot(m_depth - 1) + " = (int16_t)-" + slot(m_depth - 1) + ";");
+            return;
         }
-        else if (cType == C_PUSH || cType == C_POP)
+
+        if (input == "not")
         {
-            codeWriter.writePushPop(cType, parser.arg1(), parser.arg2());
+            emit(slot(m_depth - 1) + " = ~" + slot(m_depth - 1) + ";");
+            return;
         }
-        else if (cType == C_CALL)
+
+        const map<string, string> operators = {{"add", "+"}, {"sub", "-"}, {"and", "&"}, {"or", "|"}, {"eq", "=="}, {"gt", ">"}, {"lt", "<"}};
+        m_depth--;
+        string x = slot(m_depth - 1);
+        string y = slot(m_depth);
+
+        if (input == "eq" || input == "gt" || input == "lt")
         {
-            codeWriter.writeCall(parser.arg1(), stoi(parser.arg2()));
+            emit(x + " = " + x + " " + operators.at(input) + " " + y + " ? -1 : 0;");
         }
-        else if (cType == C_FUNCTION)
+        else
         {
-            codeWriter.writeFunction(parser.arg1(), stoi(parser.arg2()));
+            emit(x + " = (int16_t)(" + x + " " + operators.at(input) + " " + y + ");");
         }
-        else if (cType == C_GOTO)
+    }
+
+    void writePushPop(const CommandType &cmd, const string &segment, const string &index)
+    {
+        m_commands.push_back({cmd, segment, index});
+
+        string location;
+        if (cmd == C_PUSH && segment == "constant")
         {
-            codeWriter.writeGoto(parser.arg1());
+            location = index;
         }
-        else if (cType == C_IF)
+        else if (segment == "static")
         {
-            codeWriter.writeIf(parser.arg1());
+            m_statics.insert(m_filename + "." + index);
+            location = "RAM[" + identifier("s_", m_filename + "." + index) + "]";
         }
-        else if (cType == C_LABEL)
+        else if (segment == "pointer" || segment == "temp")
         {
-            codeWriter.writeLabel(parser.arg1());
+            location = "RAM[" + to_string(stoi(index) + (segment == "pointer" ? 3 : 5)) + "]";
         }
-        else if (cType == C_RETURN)
+        else
         {
-            codeWriter.writeReturn();
+            const map<string, int> pointers = {{"local", 1}, {"argument", 2}, {"this", 3}, {"that", 4}};
+            location = "AT(RAM[" + to_string(pointers.at(segment)) + "] + " + index + ")";
         }
 
-        parser.advance();
+        if (cmd == C_PUSH)
+        {
+            emit(slot(m_depth++) + " = " + location + ";");
+        }
+        else
+        {
+            emit(location + " = " + slot(--m_depth) + ";");
+        }
     }
-}
-
-int main(int argc, char **argv)
-{
 
-    if (argc != 2)
+    void writeInit()
     {
-        cout << "Invalid argument: specify path to .vm file" << endl;
-        return -1;
+        m_bootstrap = true;
     }
 
-    if (filesystem::is_directory(argv[1]))
+    void writeLabel(const string &label)
     {
-        string asmFilePath = (string)argv[1] + "/" + (string)filesystem::path(argv[1]).filename() + ".asm";
-        CodeWriter codeWriter(asmFilePath);
-        codeWriter.writeInit();
+        settle();
+        m_labels[label] = m_commands.size();
+        out() << labelName(label) << ":;" << endl;
+    }
 
-        auto directories = filesystem::directory_iterator(argv[1]);
-        for (const auto &entry : directories)
+    // A jump back to a label that only pushes constants and pops them with
+    // untaken if-gotos, like Sys.halt's `while (true) {}`, never exits or
+    // changes anything, so it halts the program instead.
+    void writeGoto(const string &label)
+    {
+        settle();
+        auto target = m_labels.find(label);
+        if (target != m_labels.end() && isIdleLoop(target->second))
         {
-            if (entry.path().extension() == ".vm")
-            {
-                codeWriter.setFileName(entry.path().filename());
-                handleFile(entry.path().string(), codeWriter);
-            }
+            emit("halt();");
         }
+        else
+        {
+            emit("goto " + labelName(label) + ";");
+            targets().insert(labelName(label));
+        }
+        m_commands.push_back({C_GOTO, label, ""});
     }
-    else
+
+    void writeIf(const string &label)
     {
-        string vmFilePath = argv[1];
-        string asmFilePath = vmFilePath.substr(0, vmFilePath.find_last_of(".")) + ".asm";
+        m_commands.push_back({C_IF, label, ""});
+        m_depth--;
+        settle();
+        emit("if (AT(sp) != 0)");
+        emit("    goto " + labelName(label) + ";");
+        targets().insert(labelName(label));
+    }
 
-        CodeWriter codeWriter(asmFilePath);
-        codeWriter.writeInit();
+    void writeCall(const string &functionName, int numArgs)
+    {
+        m_commands.push_back({C_CALL, functionName, to_string(numArgs)});
+        settle();
+        m_calls.insert({functionName, m_inFunction ? m_function : m_filename});
+        emit("call(" + identifier("f_", functionName) + ", " + to_string(++m_count) + ", " + to_string(numArgs) + ");");
+        emit("sp = SP;");
+    }
+
+    void writeReturn()
+    {
+        m_commands.push_back({C_RETURN, "", ""});
+        settle();
+        emit("leave();");
+        emit("return;");
+    }
+
+    void writeFunction(const string &functionName, int numLocals)
+    {
+        closeFunction();
+        m_functions.insert(functionName);
+        if (m_firstFunction.empty())
+        {
+            m_firstFunction = functionName;
+        }
+        m_function = functionName;
+        m_inFunction = true;
+        m_commands.clear();
+        m_labels.clear();
+
+        m_functionsCode << endl
+                        << "// function " << functionName << " " << numLocals << endl
+                        << "void " << identifier("f_", functionName) << "()" << endl
+                        << "{" << endl;
+        emit("[[maybe_unused]] int16_t sp = SP;");
+
+        if (numLocals > 0)
+        {
+            emit("for (int i = 0; i < " + to_string(numLocals) + "; i++)");
+            emit("    AT(sp + i) = 0;");
+            m_depth = numLocals;
+        }
+    }
+
+    void setFileName(const string &filename)
+    {
+        closeFunction();
+        m_filename = filename;
+        m_inFunction = false;
+        m_commands.clear();
+        m_labels.clear();
+    }
+
+    // Statistics are only collected for Hack code.
+    void setCommandType(CommandType)
+    {
+    }
+
+    // Writes the program. Its arguments are RAM words to set before it runs,
+    // as addr=value, and RAM words to print when it halts, as addr[-addr].
+    bool saveCpp(const string &filename)
+    {
+        closeFunction();
+
+        for (const auto &[callee, caller] : m_calls)
+        {
+            if (!m_functions.count(callee))
+            {
+                cerr << "Error: undefined function " << callee << " called from " << caller << endl;
+                return false;
+            }
+        }
+
+        ofstream file(filename);
+        file << "// Translated from VM code by vm-translator --cpp." << endl
+             << R"(#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define SP RAM[0]
+#define AT(address) RAM[(uint16_t)(address) & 0x7FFF]
+
+static int16_t RAM[32768];
+static std::vector<std::pair<int, int>> ranges;
+static std::chrono::steady_clock::time_point start;
+
+[[noreturn]] static void halt()
+{
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    printf("Halted in %g ms\n", elapsed.count() * 1000);
+
+    for (const auto &range : ranges)
+    {
+        for (int address = range.first; address <= range.second && address < 32768; address++)
+        {
+            printf("RAM[%d] = %d\n", address, RAM[address]);
+        }
+    }
+
+    exit(0);
+}
+
+static inline void call(void (*function)(), int16_t returnAddress, int16_t numArgs)
+{
+    int16_t frame = SP;
+    AT(frame) = returnAddress;
+    AT(frame + 1) = RAM[1];
+    AT(frame + 2) = RAM[2];
+    AT(frame + 3) = RAM[3];
+    AT(frame + 4) = RAM[4];
+    SP = frame + 5;
+    RAM[2] = frame - numArgs;
+    RAM[1] = SP;
+    function();
+}
+
+static inline void leave()
+{
+    int16_t frame = RAM[1];
+    AT(RAM[2]) = AT(SP - 1);
+    SP = RAM[2] + 1;
+    RAM[4] = AT(frame - 1);
+    RAM[3] = AT(frame - 2);
+    RAM[2] = AT(frame - 3);
+    RAM[1] = AT(frame - 4);
+}
+)";
+
+        if (!m_statics.empty())
+        {
+            file << endl;
+        }
+        for (const auto &[symbol, address] : layoutStatics(m_statics))
+        {
+            file << "static const int " << identifier("s_", symbol) << " = " << address << ";" << endl;
+        }
+
+        file << endl;
+        for (const auto &function : m_functions)
+        {
+            file << "void " << identifier("f_", function) << "();" << endl;
+        }
+
+        bool bootstrap = m_bootstrap && m_functions.count("Sys.init");
+        // Without bootstrap or top-level code the assembly starts in the
+        // first function, running it on whatever frame RAM was given.
+        bool enterFirst = !bootstrap && m_topLevelCode.str().empty() && !m_firstFunction.empty();
+        file << m_functionsCode.str() << endl;
+
+        if (!bootstrap && !enterFirst)
+        {
+            file << "void topLevel()" << endl
+                 << "{" << endl
+                 << "    [[maybe_unused]] int16_t sp = SP;" << endl
+                 << pruneLabels(m_topLevelCode.str(), m_topLevelTargets)
+                 << "}" << endl
+                 << endl;
+        }
+
+        file << R"(int main(int argc, char **argv)
+{
+    SP = 256;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        auto equalsPos = arg.find("=");
+        if (equalsPos != std::string::npos)
+        {
+            RAM[std::stoi(arg.substr(0, equalsPos)) & 0x7FFF] = std::stoi(arg.substr(equalsPos + 1));
+            continue;
+        }
+
+        auto dashPos = arg.find("-");
+        int first = std::stoi(arg.substr(0, dashPos));
+        int last = dashPos == std::string::npos ? first : std::stoi(arg.substr(dashPos + 1));
+        ranges.push_back({first, last});
+    }
+
+    start = std::chrono::steady_clock::now();
+)";
+
+        // Like the bootstrap code, this resets SP whatever RAM was given.
+        if (bootstrap)
+        {
+            file << "    SP = 256;" << endl
+                 << "    call(" << identifier("f_", "Sys.init") << ", 0, 0);" << endl;
+        }
+        else if (enterFirst)
+        {
+            file << "    " << identifier("f_", m_firstFunction) << "();" << endl;
+        }
+        else
+        {
+            file << "    topLevel();" << endl;
+        }
+
+        file << "    halt();" << endl
+             << "}" << endl;
+
+        return true;
+    }
+
+private:
+    ostream &out()
+    {
+        return m_inFunction ? (ostream &)m_functionBody : (ostream &)m_topLevelCode;
+    }
+
+    set<string> &targets()
+    {
+        return m_inFunction ? m_functionTargets : m_topLevelTargets;
+    }
+
+    void emit(const string &line)
+    {
+        out() << "    " << line << endl;
+    }
+
+    // The stack slot at the given offset from SP.
+    string slot(int offset)
+    {
+        if (offset == 0)
+        {
+            return "AT(sp)";
+        }
+        return "AT(sp " + string(offset < 0 ? "- " : "+ ") + to_string(abs(offset)) + ")";
+    }
+
+    // Adds the pushes and pops since the last jump or label to SP.
+    void settle()
+    {
+        if (m_depth != 0)
+        {
+            emit("sp " + string(m_depth < 0 ? "-= " : "+= ") + to_string(abs(m_depth)) + ";");
+            emit("SP = sp;");
+            m_depth = 0;
+        }
+    }
+
+    void closeFunction()
+    {
+        settle();
+        if (m_inFunction)
+        {
+            m_functionsCode << pruneLabels(m_functionBody.str(), m_functionTargets) << "}" << endl;
+            m_functionBody.str("");
+            m_functionTargets.clear();
+            m_inFunction = false;
+        }
+    }
+
+    // Drops the labels no jump refers to, such as the start of an idle loop
+    // whose goto became halt(), so the C++ compiler does not warn about them.
+    static string pruneLabels(const string &code, const set<string> &targets)
+    {
+        istringstream lines(code);
+        string line;
+        string result;
+        while (getline(lines, line))
+        {
+            bool label = line.rfind("l_", 0) == 0 && line.size() > 2 && line.compare(line.size() - 2, 2, ":;") == 0;
+            if (!label || targets.count(line.substr(0, line.size() - 2)))
+            {
+                result += line + "\n";
+            }
+        }
+
+        return result;
+    }
+
+    // Labels are local to C++ functions already; code outside of functions
+    // is scoped by its file.
+    string labelName(const string &name)
+    {
+        return identifier("l_", m_inFunction ? name : m_filename + "$" + name);
+    }
+
+    // Maps a VM name to a unique C++ identifier: letters and digits are kept,
+    // '_' is doubled, '.' becomes "_d" and anything else "_x" and its code.
+    static string identifier(const string &prefix, const string &name)
+    {
+        ostringstream result;
+        result << prefix;
+
+        for (char c : name)
+        {
+            if (isalnum((unsigned char)c))
+            {
+                result << c;
+            }
+            else if (c == '_')
+            {
+                result << "__";
+            }
+            else if (c == '.')
+            {
+                result << "_d";
+            }
+            else
+            {
+                result << "_x" << hex << (int)(unsigned char)c << dec;
+            }
+        }
+
+        return result.str();
+    }
+
+    bool isIdleLoop(size_t first)
+    {
+        vector<int16_t> stack;
+        for (size_t i = first; i < m_commands.size(); i++)
+        {
+            const Command &command = m_commands[i];
+
+            if (command.type == C_PUSH && command.arg1 == "constant")
+            {
+                stack.push_back(stoi(command.arg2));
+            }
+            else if (command.type == C_ARITHMETIC && (command.arg1 == "neg" || command.arg1 == "not") && !stack.empty())
+            {
+                stack.back() = command.arg1 == "neg" ? -stack.back() : ~stack.back();
+            }
+            else if (command.type == C_IF && !stack.empty() && stack.back() == 0)
+            {
+                stack.pop_back();
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        return stack.empty();
+    }
+};
+
+struct VMCommand
+{
+    CommandType type;
+    string arg1;
+    string arg2;
+};
+
+vector<VMCommand> readCommands(const string &vmFilePath)
+{
+    vector<VMCommand> commands;
+    for (Parser parser(vmFilePath); parser.hasMoreCommands(); parser.advance())
+    {
+        commands.push_back({parser.commandType(), parser.arg1(), parser.arg2()});
+    }
+
+    return commands;
+}
+
+template <typename Writer>
+void writeCommands(const vector<VMCommand> &commands, Writer &codeWriter)
+{
+    for (const auto &command : commands)
+    {
+        CommandType cType = command.type;
+        codeWriter.setCommandType(cType);
+
+        if (cType == C_ARITHMETIC)
+        {
+            codeWriter.writeArithmetic(command.arg1);
+        }
+        else if (cType == C_PUSH || cType == C_POP)
+        {
+            codeWriter.writePushPop(cType, command.arg1, command.arg2);
+        }
+        else if (cType == C_CALL)
+        {
+            codeWriter.writeCall(command.arg1, stoi(command.arg2));
+        }
+        else if (cType == C_FUNCTION)
+        {
+            codeWriter.writeFunction(command.arg1, stoi(command.arg2));
+        }
+        else if (cType == C_GOTO)
+        {
+            codeWriter.writeGoto(command.arg1);
+        }
+        else if (cType == C_IF)
+        {
+            codeWriter.writeIf(command.arg1);
+        }
+        else if (cType == C_LABEL)
+        {
+            codeWriter.writeLabel(command.arg1);
+        }
+        else if (cType == C_RETURN)
+        {
+            codeWriter.writeReturn();
+        }
+    }
+}
+
+template <typename Writer>
+void handleFile(const string &vmFilePath, Writer &codeWriter)
+{
+    writeCommands(readCommands(vmFilePath), codeWriter);
+}
+
+// Every file is parsed once up front. Programs without Sys.init, like the
+// project 07 tests, get no bootstrap and start at their first command, as
+// they do in the VM emulator.
+template <typename Writer>
+void translate(const string &path, Writer &codeWriter)
+{
+    vector<pair<string, vector<VMCommand>>> files;
+    bool hasSysInit = false;
+
+    auto read = [&](const filesystem::path &vmFilePath)
+    {
+        files.push_back({vmFilePath.stem().string(), readCommands(vmFilePath.string())});
+        for (const auto &command : files.back().second)
+        {
+            hasSysInit = hasSysInit || (command.type == C_FUNCTION && command.arg1 == "Sys.init");
+        }
+    };
+
+    bool directory = filesystem::is_directory(path);
+    if (!directory)
+    {
+        read(path);
+    }
+    else
+    {
+        for (const auto &entry : filesystem::directory_iterator(path))
+        {
+            if (entry.path().extension() == ".vm")
+            {
+                read(entry.path());
+            }
+        }
+    }
+
+    if (hasSysInit)
+    {
+        codeWriter.writeInit();
+    }
+
+    for (const auto &[fileName, commands] : files)
+    {
+        if (directory)
+        {
+            codeWriter.setFileName(fileName);
+        }
+        writeCommands(commands, codeWriter);
+    }
+}
+
+// Lays the modules out in ROM in the given order, packs the statics of all
+// modules from RAM[16] and patches the relocations of each module. The
+// static addresses are written to a .map file next to the .hack file.
+bool link(const vector<ObjectModule> &modules, const string &hackFilePath)
+{
+    map<string, int> symbols;
+    vector<int> bases;
+    int base = 0;
+
+    for (const auto &module : modules)
+    {
+        bases.push_back(base);
+
+        for (const auto &[symbol, offset] : module.exports)
+        {
+            if (!symbols.insert({symbol, base + offset}).second)
+            {
+                cerr << "Error: " << symbol << " is defined in more than one module" << endl;
+                return false;
+            }
+        }
+
+        base += module.code.size();
+    }
+
+    if (base > 32768)
+    {
+        cerr << "Warning: program is " << base << " instructions, ROM holds 32768" << endl;
+    }
+
+    set<string> staticSymbols;
+    for (const auto &module : modules)
+    {
+        staticSymbols.insert(module.statics.begin(), module.statics.end());
+    }
+    auto statics = layoutStatics(staticSymbols);
+
+    vector<uint16_t> rom;
+    rom.reserve(base);
+    for (size_t i = 0; i < modules.size(); i++)
+    {
+        vector<uint16_t> code = modules[i].code;
+
+        for (const auto &relocation : modules[i].relocations)
+        {
+            uint16_t &word = code[relocation.offset];
+
+            if (relocation.kind == ObjectModule::R_LOCAL)
+            {
+                word += bases[i];
+            }
+            else if (relocation.kind == ObjectModule::R_STATIC)
+            {
+                word = statics.at(relocation.symbol);
+            }
+            else if (symbols.count(relocation.symbol))
+            {
+                word = symbols.at(relocation.symbol);
+            }
+            else
+            {
+                cerr << "Error: undefined symbol " << relocation.symbol << " in module " << modules[i].name << endl;
+                return false;
+            }
+
+            word &= 0x7FFF;
+        }
+
+        rom.insert(rom.end(), code.begin(), code.end());
+    }
+
+    ofstream file(hackFilePath);
+    for (auto word : rom)
+    {
+        file << bitset<16>(word).to_string() << endl;
+    }
+
+    saveStaticMap(statics, hackFilePath.substr(0, hackFilePath.find_last_of(".")) + ".map");
+
+    return true;
+}
+
+string commandName(CommandType cmd)
+{
+    switch (cmd)
+    {
+    case C_ARITHMETIC:
+        return "arithmetic";
+
+    case C_PUSH:
+        return "push";
+
+    case C_POP:
+        return "pop";
+
+    case C_LABEL:
+        return "label";
+
+    case C_GOTO:
+        return "goto";
+
+    case C_IF:
+        return "if-goto";
+
+    case C_FUNCTION:
+        return "function";
+
+    case C_RETURN:
+        return "return";
+
+    case C_CALL:
+        return "call";
+
+    default:
+        return "";
+    }
+}
+
+// Writes the per-function code size report, largest functions first, as
+// JSON if the file name ends in .json and as CSV otherwise.
+void saveReport(vector<FunctionStats> stats, const string &filename)
+{
+    sort(stats.begin(), stats.end(), [](const FunctionStats &a, const FunctionStats &b)
+         { return a.instructions != b.instructions ? a.instructions > b.instructions : a.name < b.name; });
+
+    const vector<CommandType> commands = {C_ARITHMETIC, C_PUSH, C_POP, C_LABEL, C_GOTO, C_IF, C_FUNCTION, C_RETURN, C_CALL};
+    ofstream file(filename);
+
+    if (filesystem::path(filename).extension() == ".json")
+    {
+        file << "[";
+        for (size_t i = 0; i < stats.size(); i++)
+        {
+            file << (i ? "," : "") << endl
+                 << "  {\"function\": \"" << stats[i].name << "\", \"instructions\": " << stats[i].instructions
+                 << ", \"labels\": " << stats[i].labels << ", \"commands\": {";
+
+            for (size_t j = 0; j < commands.size(); j++)
+            {
+                file << (j ? ", " : "") << "\"" << commandName(commands[j]) << "\": " << stats[i].commands[commands[j]];
+            }
+
+            file << "}}";
+        }
+        file << endl
+             << "]" << endl;
+        return;
+    }
+
+    file << "function,instructions,labels";
+    for (auto cmd : commands)
+    {
+        file << "," << commandName(cmd);
+    }
+    file << endl;
+
+    for (auto &function : stats)
+    {
+        file << function.name << "," << function.instructions << "," << function.labels;
+        for (auto cmd : commands)
+        {
+            file << "," << function.commands[cmd];
+        }
+        file << endl;
+    }
+}
+
+bool writeObject(const string &vmFilePath, vector<FunctionStats> &stats)
+{
+    CodeWriter codeWriter(vmFilePath);
+    handleFile(vmFilePath, codeWriter);
+
+    ObjectModule module;
+    if (!codeWriter.toObject(module))
+    {
+        return false;
+    }
+    module.save(vmFilePath.substr(0, vmFilePath.find_last_of(".")) + ".hobj");
+
+    auto fileStats = codeWriter.stats();
+    stats.insert(stats.end(), fileStats.begin(), fileStats.end());
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    bool hack = false;
+    bool listing = false;
+    bool object = false;
+    bool linking = false;
+    bool cpp = false;
+    string reportFilePath;
+    vector<string> paths;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+
+        if (arg == "--hack")
+        {
+            hack = true;
+        }
+        else if (arg == "--listing")
+        {
+            listing = true;
+        }
+        else if (arg == "--object")
+        {
+            object = true;
+        }
+        else if (arg == "--cpp")
+        {
+            cpp = true;
+        }
+        else if (arg == "--link")
+        {
+            linking = true;
+        }
+        else if (arg == "--report" && i + 1 < argc)
+        {
+            reportFilePath = argv[++i];
+        }
+        else
+        {
+            paths.push_back(arg);
+        }
+    }
+
+    if (linking ? paths.size() < 2 : paths.size() != 1)
+    {
+        cout << "Invalid argument: specify path to .vm file" << endl
+             << "Usage: vm-translator [--hack [--listing]] [--report <file.csv|file.json>] <file.vm|directory>" << endl
+             << "       vm-translator --cpp <file.vm|directory>" << endl
+             << "       vm-translator --object [--report <file.csv|file.json>] <file.vm|directory>" << endl
+             << "       vm-translator --link <output.hack> <file.hobj|directory>..." << endl;
+        return -1;
+    }
+
+    // As when translating, the bootstrap is only linked in front of the
+    // modules if one of them defines Sys.init; otherwise the program starts
+    // at the first module.
+    if (linking)
+    {
+        vector<string> objectFilePaths;
+        for (size_t i = 1; i < paths.size(); i++)
+        {
+            if (!filesystem::is_directory(paths[i]))
+            {
+                objectFilePaths.push_back(paths[i]);
+                continue;
+            }
+
+            vector<string> entries;
+            for (const auto &entry : filesystem::directory_iterator(paths[i]))
+            {
+                if (entry.path().extension() == ".hobj")
+                {
+                    entries.push_back(entry.path().string());
+                }
+            }
+            sort(entries.begin(), entries.end());
+            objectFilePaths.insert(objectFilePaths.end(), entries.begin(), entries.end());
+        }
+
+        vector<ObjectModule> modules(1);
+        bool hasSysInit = false;
+        for (const auto &objectFilePath : objectFilePaths)
+        {
+            ObjectModule module;
+            if (!module.load(objectFilePath))
+            {
+                cerr << "Error: " << objectFilePath << " is not a valid object file" << endl;
+                return -1;
+            }
+            hasSysInit = hasSysInit || module.exports.count("Sys.init");
+            modules.push_back(module);
+        }
+
+        if (hasSysInit)
+        {
+            CodeWriter bootstrap("Bootstrap");
+            bootstrap.writeInit();
+            bootstrap.toObject(modules[0]);
+        }
+        else
+        {
+            modules.erase(modules.begin());
+        }
+
+        return link(modules, paths[0]) ? 0 : -1;
+    }
+
+    string path = paths[0];
+
+    if (object)
+    {
+        vector<FunctionStats> stats;
+
+        vector<string> vmFilePaths;
+        if (!filesystem::is_directory(path))
+        {
+            vmFilePaths.push_back(path);
+        }
+        else
+        {
+            for (const auto &entry : filesystem::directory_iterator(path))
+            {
+                if (entry.path().extension() == ".vm")
+                {
+                    vmFilePaths.push_back(entry.path().string());
+                }
+            }
+        }
+
+        for (const auto &vmFilePath : vmFilePaths)
+        {
+            if (!writeObject(vmFilePath, stats))
+            {
+                return -1;
+            }
+        }
 
-        handleFile(vmFilePath, codeWriter);
+        if (!reportFilePath.empty())
+        {
+            saveReport(stats, reportFilePath);
+        }
+
+        return 0;
+    }
+
+    string outFilePath;
+
+    if (filesystem::is_directory(path))
+    {
+        outFilePath = path + "/" + (string)filesystem::path(path).filename();
+    }
+    else
+    {
+        outFilePath = path.substr(0, path.find_last_of("."));
+    }
+
+    if (cpp)
+    {
+        CppWriter cppWriter(outFilePath + ".cpp");
+        translate(path, cppWriter);
+        return cppWriter.saveCpp(outFilePath + ".cpp") ? 0 : -1;
+    }
+
+    CodeWriter codeWriter(outFilePath + ".asm");
+    translate(path, codeWriter);
+
+    auto statics = codeWriter.staticLayout();
+    if (hack && !codeWriter.saveHack(outFilePath + ".hack", statics))
+    {
+        return -1;
+    }
+
+    if (!hack || listing)
+    {
+        codeWriter.saveAsm(outFilePath + ".asm", statics);
+    }
+    saveStaticMap(statics, outFilePath + ".map");
+
+    if (!reportFilePath.empty())
+    {
+        saveReport(codeWriter.stats(), reportFilePath);
     }
 
     return 0;
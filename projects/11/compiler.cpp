@@ -2,9 +2,19 @@
 #include <fstream>
 #include <string>
 #include <set>
-#include <regex>
+#include <string_view>
+#include <array>
+#include <vector>
+#include <cstdint>
 #include <unordered_map>
 #include <filesystem>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -43,144 +53,137 @@ enum class Keyword
     UNDEFINED
 };
 
+struct Token
+{
+    TokenType type;
+    Keyword keyword;
+    int intValue;
+    string_view text;
+    uint32_t offset;
+    uint32_t line;
+};
+
+// Maps the source file and lexes it up front in a single pass over the
+// characters, classifying every token once. Token text points into the
+// mapping, so the tokenizer must outlive everything that keeps a token.
 class Tokenizer
 {
 private:
-    ifstream m_file;
-    string m_token = "";
-    string m_extract = "";
-    size_t m_extractIndex = string::npos;
-    const string m_symbols = "{}()[].,;+-*/&|<>=~";
-
-public:
-    Tokenizer(const string &file)
-    {
-        m_file.open(file);
-    }
-
-    ~Tokenizer()
-    {
-        m_file.close();
-    }
-
-    bool hasMoreTokens()
+    enum CharClass : uint8_t
     {
-        return !m_file.eof();
-    }
+        OTHER,
+        SPACE,
+        LETTER,
+        DIGIT,
+        SYMBOL,
+        SLASH,
+        QUOTE
+    };
+
+    string m_path;
+    const char *m_source = nullptr;
+    size_t m_size = 0;
+    vector<Token> m_tokens;
+    size_t m_next = 0;
+    const Token *m_token;
+    bool m_valid = false;
+
+    static constexpr Token END = {TokenType::SYMBOL, Keyword::UNDEFINED, 0, string_view(), 0, 0};
 
-    void advance()
+public:
+    Tokenizer(const string &file) : m_path(file), m_token(&END)
     {
-        if (m_extractIndex == string::npos)
+        int fd = ::open(file.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0)
         {
-            m_file >> m_extract;
-            m_file >> ws;
-            m_extractIndex = 0;
+            cerr << "Error: cannot open " << file << endl;
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+            return;
         }
 
-        skipComments();
-
-        if (m_extract[m_extractIndex] == '"')
+        m_size = info.st_size;
+        void *mapped = m_size > 0 ? mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+        ::close(fd);
+        if (mapped == MAP_FAILED)
         {
-            string tail;
-            getline(m_file, tail, '"');
-            // TODO: Investigate skipped whitespace between extracts
-            m_token = m_extract.substr(m_extractIndex) + " " + tail + "\"";
-            m_extractIndex = string::npos;
+            cerr << "Error: cannot map " << file << endl;
+            m_size = 0;
             return;
         }
 
-        size_t end = m_extract.find_first_of(m_symbols + '"', m_extractIndex);
-        if (end == m_extractIndex)
+        m_source = (const char *)mapped;
+        if (m_source != nullptr)
         {
-            m_token = m_extract[m_extractIndex];
-            m_extractIndex = (m_extractIndex + 1 >= m_extract.length()) ? string::npos : m_extractIndex + 1;
+            madvise(mapped, m_size, MADV_SEQUENTIAL);
         }
-        else
+        m_valid = lex();
+    }
+
+    ~Tokenizer()
+    {
+        if (m_source != nullptr)
         {
-            m_token = m_extract.substr(m_extractIndex, end - m_extractIndex);
-            m_extractIndex = end;
+            munmap((void *)m_source, m_size);
         }
     }
 
-    string token()
+    Tokenizer(const Tokenizer &) = delete;
+    Tokenizer &operator=(const Tokenizer &) = delete;
+
+    bool valid() const
     {
-        return m_token;
+        return m_valid;
     }
 
-    TokenType tokenType()
+    bool hasMoreTokens()
     {
-        if (m_symbols.find(m_token[0]) != string::npos)
-        {
-            return TokenType::SYMBOL;
-        }
+        return m_next < m_tokens.size();
+    }
 
-        if (regex_match(m_token, regex("^(class|constructor|function|method|field|static|var|int|char|boolean|void|true|false|null|this|let|do|if|else|while|return)$")))
-        {
-            return TokenType::KEYWORD;
-        }
+    void advance()
+    {
+        m_token = hasMoreTokens() ? &m_tokens[m_next++] : &END;
+    }
 
-        if (regex_match(m_token, regex("^[0-9]+$")))
-        {
-            return TokenType::INT_CONST;
-        }
+    string_view token()
+    {
+        return m_token->text;
+    }
 
-        if (m_token[0] == '"' && m_token.back() == '"')
-        {
-            return TokenType::STRING_CONST;
-        }
+    uint32_t line()
+    {
+        return m_token->line;
+    }
 
-        return TokenType::IDENTIFIER;
+    TokenType tokenType()
+    {
+        return m_token->type;
     }
 
     Keyword keyWord()
     {
-        if (tokenType() == TokenType::KEYWORD)
-        {
-            static const unordered_map<string, Keyword> keywordMap = {
-                {"class", Keyword::CLASS},
-                {"constructor", Keyword::CONSTRUCTOR},
-                {"function", Keyword::FUNCTION},
-                {"method", Keyword::METHOD},
-                {"field", Keyword::FIELD},
-                {"static", Keyword::STATIC},
-                {"var", Keyword::VAR},
-                {"int", Keyword::INT},
-                {"char", Keyword::CHAR},
-                {"boolean", Keyword::BOOLEAN},
-                {"void", Keyword::VOID},
-                {"true", Keyword::TRUE},
-                {"false", Keyword::FALSE},
-                {"null", Keyword::_NULL},
-                {"this", Keyword::THIS},
-                {"let", Keyword::LET},
-                {"do", Keyword::DO},
-                {"if", Keyword::IF},
-                {"else", Keyword::ELSE},
-                {"while", Keyword::WHILE},
-                {"return", Keyword::RETURN},
-            };
-
-            return keywordMap.at(m_token);
-        };
-
-        return Keyword::UNDEFINED;
+        return m_token->keyword;
     }
 
     char symbol()
     {
-        if (tokenType() == TokenType::SYMBOL)
+        if (m_token->type == TokenType::SYMBOL && !m_token->text.empty())
         {
-            return m_token[0];
+            return m_token->text[0];
         }
 
         return 0;
     }
 
-    string identifier()
+    string_view identifier()
     {
-        if (tokenType() == TokenType::IDENTIFIER)
+        if (m_token->type == TokenType::IDENTIFIER)
         {
-            return m_token;
+            return m_token->text;
         }
 
         return "";
@@ -188,51 +191,191 @@ public:
 
     int intVal()
     {
-        if (tokenType() == TokenType::INT_CONST)
-        {
-            return stoi(m_token);
-        }
-
-        return 0;
+        return m_token->intValue;
     }
 
-    string stringVal()
+    string_view stringVal()
     {
-        if (tokenType() == TokenType::STRING_CONST)
+        if (m_token->type == TokenType::STRING_CONST)
         {
-            return m_token.substr(1, m_token.length() - 2);
+            return m_token->text.substr(1, m_token->text.length() - 2);
         }
 
         return "";
     }
 
 private:
-    void skipComments()
+    static const array<CharClass, 256> &charClasses()
     {
-        if (m_extract.rfind("//", 0) == 0)
+        static const array<CharClass, 256> classes = []
         {
-            m_file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-            m_file >> m_extract;
-            skipComments();
-        }
-        else if (m_extract.rfind("/*", 0) == 0)
+            array<CharClass, 256> table{};
+            for (int c = 0; c < 256; c++)
+            {
+                if (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v')
+                {
+                    table[c] = SPACE;
+                }
+                else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_')
+                {
+                    table[c] = LETTER;
+                }
+                else if (c >= '0' && c <= '9')
+                {
+                    table[c] = DIGIT;
+                }
+            }
+            for (char c : string("{}()[].,;+-*&|<>=~"))
+            {
+                table[(uint8_t)c] = SYMBOL;
+            }
+            table['/'] = SLASH;
+            table['"'] = QUOTE;
+            return table;
+        }();
+        return classes;
+    }
+
+    static Keyword keywordOf(string_view word)
+    {
+        static const unordered_map<string_view, Keyword> keywordMap = {
+            {"class", Keyword::CLASS},
+            {"constructor", Keyword::CONSTRUCTOR},
+            {"function", Keyword::FUNCTION},
+            {"method", Keyword::METHOD},
+            {"field", Keyword::FIELD},
+            {"static", Keyword::STATIC},
+            {"var", Keyword::VAR},
+            {"int", Keyword::INT},
+            {"char", Keyword::CHAR},
+            {"boolean", Keyword::BOOLEAN},
+            {"void", Keyword::VOID},
+            {"true", Keyword::TRUE},
+            {"false", Keyword::FALSE},
+            {"null", Keyword::_NULL},
+            {"this", Keyword::THIS},
+            {"let", Keyword::LET},
+            {"do", Keyword::DO},
+            {"if", Keyword::IF},
+            {"else", Keyword::ELSE},
+            {"while", Keyword::WHILE},
+            {"return", Keyword::RETURN},
+        };
+
+        auto keyword = keywordMap.find(word);
+        return keyword == keywordMap.end() ? Keyword::UNDEFINED : keyword->second;
+    }
+
+    bool lex()
+    {
+        const auto &classes = charClasses();
+        const char *begin = m_source;
+        const char *end = begin + m_size;
+        const char *p = begin;
+        uint32_t line = 1;
+        m_tokens.reserve(m_size / 4);
+
+        auto classOf = [&](const char *c)
+        {
+            return c < end ? classes[(uint8_t)*c] : OTHER;
+        };
+        auto push = [&](TokenType type, Keyword keyword, int value, const char *start)
+        {
+            m_tokens.push_back({type, keyword, value, string_view(start, p - start), (uint32_t)(start - begin), line});
+        };
+        auto fail = [&](const string &message)
+        {
+            cerr << "Error: " << m_path << ":" << line << ": " << message << endl;
+            return false;
+        };
+
+        while (p < end)
         {
-            while (m_extract.find("*/") == string::npos)
+            const char *start = p;
+            switch (classes[(uint8_t)*p])
+            {
+            case SPACE:
+                line += *p++ == '\n';
+                break;
+
+            case LETTER:
             {
-                m_file >> m_extract;
+                while (classOf(p) == LETTER || classOf(p) == DIGIT)
+                {
+                    p++;
+                }
+                Keyword keyword = keywordOf(string_view(start, p - start));
+                push(keyword == Keyword::UNDEFINED ? TokenType::IDENTIFIER : TokenType::KEYWORD, keyword, 0, start);
+                break;
             }
 
-            if (m_extract.substr(m_extract.length() - 2) == "*/")
+            case DIGIT:
             {
-                m_file >> m_extract;
+                int value = 0;
+                while (classOf(p) == DIGIT)
+                {
+                    value = value * 10 + (*p++ - '0');
+                    if (value > 32767)
+                    {
+                        return fail("integer constant out of range");
+                    }
+                }
+                push(TokenType::INT_CONST, Keyword::UNDEFINED, value, start);
+                break;
             }
-            else
+
+            case QUOTE:
             {
-                m_extractIndex = m_extract.find("*/") + 2;
+                p++;
+                while (p < end && *p != '"' && *p != '\n')
+                {
+                    p++;
+                }
+                if (p == end || *p != '"')
+                {
+                    return fail("unterminated string constant");
+                }
+                p++;
+                push(TokenType::STRING_CONST, Keyword::UNDEFINED, 0, start);
+                break;
             }
 
-            skipComments();
+            case SLASH:
+                if (p + 1 < end && p[1] == '/')
+                {
+                    while (p < end && *p != '\n')
+                    {
+                        p++;
+                    }
+                    break;
+                }
+                if (p + 1 < end && p[1] == '*')
+                {
+                    p += 2;
+                    while (p + 1 < end && !(p[0] == '*' && p[1] == '/'))
+                    {
+                        line += *p++ == '\n';
+                    }
+                    if (p + 1 >= end)
+                    {
+                        return fail("unterminated comment");
+                    }
+                    p += 2;
+                    break;
+                }
+                [[fallthrough]];
+
+            case SYMBOL:
+                p++;
+                push(TokenType::SYMBOL, Keyword::UNDEFINED, 0, start);
+                break;
+
+            default:
+                return fail(string("unexpected character '") + *p + "'");
+            }
         }
+
+        return true;
     }
 };
 
@@ -247,7 +390,7 @@ enum class IdentifierKind
 
 struct Identifier
 {
-    string type;
+    string_view type;
     IdentifierKind kind;
     int index;
 };
@@ -255,8 +398,8 @@ struct Identifier
 class SymbolTable
 {
 private:
-    unordered_map<string, Identifier> classIdentifiers;
-    unordered_map<string, Identifier> subroutineIdentifiers;
+    unordered_map<string_view, Identifier> classIdentifiers;
+    unordered_map<string_view, Identifier> subroutineIdentifiers;
     int staticCount = 0;
     int fieldCount = 0;
     int argCount = 0;
@@ -270,17 +413,17 @@ public:
         subroutineIdentifiers.clear();
     }
 
-    void define(const string &name, const string &type, IdentifierKind kind)
+    void define(string_view name, string_view type, IdentifierKind kind)
     {
         if (kind == IdentifierKind::STATIC || kind == IdentifierKind::FIELD)
         {
             int index = kind == IdentifierKind::STATIC ? staticCount++ : fieldCount++;
-            classIdentifiers.insert(pair<string, Identifier>{name, Identifier{type, kind, index}});
+            classIdentifiers.insert(pair<string_view, Identifier>{name, Identifier{type, kind, index}});
         }
         else if (kind == IdentifierKind::ARG || kind == IdentifierKind::VAR)
         {
             int index = kind == IdentifierKind::ARG ? argCount++ : localCount++;
-            subroutineIdentifiers.insert(pair<string, Identifier>{name, Identifier{type, kind, index}});
+            subroutineIdentifiers.insert(pair<string_view, Identifier>{name, Identifier{type, kind, index}});
         }
     }
 
@@ -305,7 +448,7 @@ public:
         }
     }
 
-    IdentifierKind kindOf(const string &name)
+    IdentifierKind kindOf(string_view name)
     {
         auto srId = subroutineIdentifiers.find(name);
         if (srId != subroutineIdentifiers.end())
@@ -322,7 +465,7 @@ public:
         return IdentifierKind::NONE;
     }
 
-    string typeOf(const string &name)
+    string_view typeOf(string_view name)
     {
         auto srId = subroutineIdentifiers.find(name);
         if (srId != subroutineIdentifiers.end())
@@ -339,7 +482,7 @@ public:
         return "";
     }
 
-    int indexOf(const string &name)
+    int indexOf(string_view name)
     {
         auto srId = subroutineIdentifiers.find(name);
         if (srId != subroutineIdentifiers.end())
@@ -465,114 +608,252 @@ private:
     }
 };
 
-class CompilationEngine
+// Hands out memory for the syntax tree of one compilation unit by bumping a
+// pointer through large blocks. Nodes are never freed one by one; the blocks
+// are all released together once code generation is done.
+class Arena
+{
+private:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    vector<unique_ptr<char[]>> m_blocks;
+    char *m_position = nullptr;
+    char *m_end = nullptr;
+
+public:
+    Arena() = default;
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    template <typename T>
+    T *make()
+    {
+        static_assert(is_trivially_destructible_v<T>, "arena nodes are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T{};
+    }
+
+    void release()
+    {
+        m_blocks.clear();
+        m_position = nullptr;
+        m_end = nullptr;
+    }
+
+private:
+    void *allocate(size_t size, size_t alignment)
+    {
+        uintptr_t start = ((uintptr_t)m_position + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        if (m_position == nullptr || start + size > (uintptr_t)m_end)
+        {
+            size_t blockSize = max(BLOCK_SIZE, size + alignment);
+            m_blocks.emplace_back(new char[blockSize]);
+            m_position = m_blocks.back().get();
+            m_end = m_position + blockSize;
+            start = ((uintptr_t)m_position + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        }
+
+        m_position = (char *)(start + size);
+        return (void *)start;
+    }
+};
+
+// Syntax tree nodes. Names and constants are views into the mapped source,
+// and sibling nodes are chained through next, so a node is a single arena
+// allocation.
+struct Expression;
+
+struct Call
+{
+    string_view target;
+    string_view method;
+    Expression *arguments;
+    int argumentCount;
+};
+
+enum class ExpressionKind : uint8_t
+{
+    INT_CONST,
+    STRING_CONST,
+    KEYWORD_CONST,
+    VARIABLE,
+    ARRAY_ACCESS,
+    CALL,
+    UNARY,
+    BINARY,
+    SCALE
+};
+
+struct Expression
+{
+    ExpressionKind kind;
+    char op;
+    Keyword keyword;
+    int value;
+    string_view text;
+    Expression *left;
+    Expression *right;
+    Call *call;
+    Expression *next;
+};
+
+enum class StatementKind : uint8_t
+{
+    LET,
+    IF,
+    WHILE,
+    DO,
+    RETURN
+};
+
+struct Statement
+{
+    StatementKind kind;
+    string_view name;
+    Expression *index;
+    Expression *value;
+    Call *call;
+    Statement *body;
+    Statement *otherwise;
+    Statement *next;
+};
+
+struct VariableDec
+{
+    IdentifierKind kind;
+    string_view type;
+    string_view name;
+    VariableDec *next;
+};
+
+struct Subroutine
+{
+    Keyword kind;
+    string_view returnType;
+    string_view name;
+    VariableDec *parameters;
+    VariableDec *locals;
+    Statement *body;
+    Subroutine *next;
+};
+
+struct ClassNode
+{
+    string_view name;
+    VariableDec *variables;
+    Subroutine *subroutines;
+};
+
+template <typename T>
+struct NodeList
+{
+    T *first = nullptr;
+    T **tail = &first;
+
+    void append(T *node)
+    {
+        *tail = node;
+        tail = &node->next;
+    }
+};
+
+// Builds the syntax tree of one class by recursive descent. Expressions keep
+// the language's strict left-to-right evaluation, so a op b op c is parsed as
+// (a op b) op c.
+class Parser
 {
 private:
     Tokenizer *tokenizer;
-    VMWriter *vmWriter;
-    SymbolTable symbolTable;
-    string className;
-    int controlCount = 0;
+    Arena *arena;
 
 public:
-    CompilationEngine(Tokenizer *tokenizer, VMWriter *vmWriter) : tokenizer(tokenizer), vmWriter(vmWriter), symbolTable() {}
+    Parser(Tokenizer *tokenizer, Arena *arena) : tokenizer(tokenizer), arena(arena) {}
 
-    void compileClass()
+    ClassNode *parseClass()
     {
-        if (tokenizer->keyWord() == Keyword::CLASS)
+        if (tokenizer->keyWord() != Keyword::CLASS)
         {
-            tokenizer->advance();
-            className = tokenizer->identifier();
-            tokenizer->advance();
-            tokenizer->advance();
+            return nullptr;
+        }
 
-            while (tokenizer->keyWord() == Keyword::STATIC || tokenizer->keyWord() == Keyword::FIELD)
-            {
-                compileClassVarDec();
-            }
+        auto node = arena->make<ClassNode>();
+        tokenizer->advance();
+        node->name = tokenizer->identifier();
+        tokenizer->advance();
+        tokenizer->advance();
 
-            while (tokenizer->keyWord() == Keyword::CONSTRUCTOR || tokenizer->keyWord() == Keyword::FUNCTION || tokenizer->keyWord() == Keyword::METHOD)
-            {
-                compileSubroutineDec();
-            }
+        NodeList<VariableDec> variables;
+        while (tokenizer->keyWord() == Keyword::STATIC || tokenizer->keyWord() == Keyword::FIELD)
+        {
+            parseClassVarDec(variables);
+        }
+        node->variables = variables.first;
 
-            tokenizer->advance();
+        NodeList<Subroutine> subroutines;
+        while (tokenizer->keyWord() == Keyword::CONSTRUCTOR || tokenizer->keyWord() == Keyword::FUNCTION || tokenizer->keyWord() == Keyword::METHOD)
+        {
+            subroutines.append(parseSubroutineDec());
         }
+        node->subroutines = subroutines.first;
+
+        tokenizer->advance();
+        return node;
     }
 
-    void compileClassVarDec()
+private:
+    void parseClassVarDec(NodeList<VariableDec> &variables)
     {
         auto kind = tokenizer->keyWord() == Keyword::STATIC ? IdentifierKind::STATIC : IdentifierKind::FIELD;
         tokenizer->advance();
         auto type = tokenizer->token();
         tokenizer->advance();
-        auto name = tokenizer->identifier();
-        symbolTable.define(name, type, kind);
+        variables.append(declare(kind, type, tokenizer->identifier()));
         tokenizer->advance();
 
         while (tokenizer->symbol() == ',')
         {
             tokenizer->advance();
-            symbolTable.define(tokenizer->identifier(), type, kind);
+            variables.append(declare(kind, type, tokenizer->identifier()));
             tokenizer->advance();
         }
 
         tokenizer->advance();
     }
 
-    void compileSubroutineDec()
+    Subroutine *parseSubroutineDec()
     {
-        symbolTable.startSubroutine();
-        auto subroutineType = tokenizer->keyWord();
+        auto node = arena->make<Subroutine>();
+        node->kind = tokenizer->keyWord();
         tokenizer->advance();
-        auto returnType = tokenizer->token();
+        node->returnType = tokenizer->token();
         tokenizer->advance();
-        auto functionName = tokenizer->identifier();
+        node->name = tokenizer->identifier();
         tokenizer->advance();
         tokenizer->advance();
 
-        if (subroutineType == Keyword::METHOD)
-        {
-            symbolTable.define("this", className, IdentifierKind::ARG);
-        }
-
-        compileParameterList();
+        node->parameters = parseParameterList();
         tokenizer->advance();
 
         tokenizer->advance();
+        NodeList<VariableDec> locals;
         while (tokenizer->keyWord() == Keyword::VAR)
         {
-            compileVarDec();
-        }
-        auto nLocals = symbolTable.varCount(IdentifierKind::VAR);
-        auto fullFuncName = className + "." + functionName;
-        vmWriter->writeFunction(fullFuncName, nLocals);
-
-        if (subroutineType == Keyword::METHOD)
-        {
-            vmWriter->writePush(Segment::ARG, 0);
-            vmWriter->writePop(Segment::POINTER, 0);
-        }
-        else if (subroutineType == Keyword::CONSTRUCTOR)
-        {
-            vmWriter->writePush(Segment::CONST, symbolTable.varCount(IdentifierKind::FIELD));
-            string alloc = "Memory.alloc";
-            vmWriter->writeCall(alloc, 1);
-            vmWriter->writePop(Segment::POINTER, 0);
+            parseVarDec(locals);
         }
+        node->locals = locals.first;
 
-        compileStatements();
+        node->body = parseStatements();
         tokenizer->advance();
+        return node;
     }
 
-    void compileParameterList()
+    VariableDec *parseParameterList()
     {
+        NodeList<VariableDec> parameters;
         if (isType())
         {
             auto argType = tokenizer->token();
             tokenizer->advance();
-            auto argName = tokenizer->identifier();
-            symbolTable.define(argName, argType, IdentifierKind::ARG);
+            parameters.append(declare(IdentifierKind::ARG, argType, tokenizer->identifier()));
             tokenizer->advance();
 
             while (tokenizer->symbol() == ',')
@@ -580,222 +861,167 @@ public:
                 tokenizer->advance();
                 auto argType = tokenizer->token();
                 tokenizer->advance();
-                auto argName = tokenizer->identifier();
-                symbolTable.define(argName, argType, IdentifierKind::ARG);
+                parameters.append(declare(IdentifierKind::ARG, argType, tokenizer->identifier()));
                 tokenizer->advance();
             }
         }
+
+        return parameters.first;
     }
 
-    void compileVarDec()
+    void parseVarDec(NodeList<VariableDec> &locals)
     {
-        if (tokenizer->keyWord() == Keyword::VAR)
+        tokenizer->advance();
+        auto varType = tokenizer->token();
+        tokenizer->advance();
+        locals.append(declare(IdentifierKind::VAR, varType, tokenizer->identifier()));
+        tokenizer->advance();
+
+        while (tokenizer->symbol() == ',')
         {
             tokenizer->advance();
-            auto varType = tokenizer->token();
-            tokenizer->advance();
-            auto varName = tokenizer->identifier();
-            symbolTable.define(varName, varType, IdentifierKind::VAR);
-            tokenizer->advance();
-
-            while (tokenizer->symbol() == ',')
-            {
-                tokenizer->advance();
-                symbolTable.define(tokenizer->identifier(), varType, IdentifierKind::VAR);
-                tokenizer->advance();
-            }
-
+            locals.append(declare(IdentifierKind::VAR, varType, tokenizer->identifier()));
             tokenizer->advance();
         }
+
+        tokenizer->advance();
     }
 
-    void compileStatements()
+    Statement *parseStatements()
     {
+        NodeList<Statement> statements;
         while (tokenizer->tokenType() == TokenType::KEYWORD)
         {
             switch (tokenizer->keyWord())
             {
             case Keyword::IF:
-                compileIf();
+                statements.append(parseIf());
                 break;
 
             case Keyword::DO:
-                compileDo();
+                statements.append(parseDo());
                 break;
 
             case Keyword::WHILE:
-                compileWhile();
+                statements.append(parseWhile());
                 break;
 
             case Keyword::RETURN:
-                compileReturn();
+                statements.append(parseReturn());
                 break;
 
             case Keyword::LET:
-                compileLet();
+                statements.append(parseLet());
                 break;
 
             default:
-                break;
+                return statements.first;
             }
         }
+
+        return statements.first;
     }
 
-    void compileDo()
+    Statement *parseDo()
     {
-        if (tokenizer->keyWord() == Keyword::DO)
-        {
-            tokenizer->advance();
-            auto subroutineName = tokenizer->identifier();
-            tokenizer->advance();
-            compileSubroutineCall(subroutineName, true);
-            tokenizer->advance();
-        }
+        auto node = statement(StatementKind::DO);
+        tokenizer->advance();
+        auto subroutineName = tokenizer->identifier();
+        tokenizer->advance();
+        node->call = parseSubroutineCall(subroutineName);
+        tokenizer->advance();
+        return node;
     }
 
-    void compileLet()
+    Statement *parseLet()
     {
-        if (tokenizer->keyWord() != Keyword::LET)
-        {
-            return;
-        }
-
+        auto node = statement(StatementKind::LET);
         tokenizer->advance();
-        auto varName = tokenizer->identifier();
+        node->name = tokenizer->identifier();
         tokenizer->advance();
 
         if (tokenizer->symbol() == '[')
         {
             tokenizer->advance();
-            vmWriter->writePush(toSegment(symbolTable.kindOf(varName)), symbolTable.indexOf(varName));
-            compileExpression();
-            vmWriter->writeArithmetic("add");
-            tokenizer->advance();
-            tokenizer->advance();
-            compileExpression();
-            vmWriter->writePop(Segment::TEMP, 0);
-            vmWriter->writePop(Segment::POINTER, 1);
-            vmWriter->writePush(Segment::TEMP, 0);
-            vmWriter->writePop(Segment::THAT, 0);
-        }
-        else
-        {
+            node->index = parseExpression();
             tokenizer->advance();
-            compileExpression();
-            vmWriter->writePop(toSegment(symbolTable.kindOf(varName)), symbolTable.indexOf(varName));
         }
 
         tokenizer->advance();
+        node->value = parseExpression();
+        tokenizer->advance();
+        return node;
     }
 
-    void compileWhile()
+    Statement *parseWhile()
     {
-        if (tokenizer->keyWord() != Keyword::WHILE)
-        {
-            return;
-        }
-
-        controlCount++;
-        auto startLabel = "WHILE_START_" + to_string(controlCount);
-        auto endLabel = "WHILE_END_" + to_string(controlCount);
-        vmWriter->writeLabel(startLabel);
+        auto node = statement(StatementKind::WHILE);
         tokenizer->advance();
         tokenizer->advance();
-        compileExpression();
+        node->value = parseExpression();
         tokenizer->advance();
 
-        vmWriter->writeArithmetic("not");
-        vmWriter->writeIf(endLabel);
-
         tokenizer->advance();
-        compileStatements();
-        vmWriter->writeGoto(startLabel);
-        vmWriter->writeLabel(endLabel);
+        node->body = parseStatements();
         tokenizer->advance();
+        return node;
     }
 
-    void compileReturn()
+    Statement *parseReturn()
     {
-        if (tokenizer->keyWord() != Keyword::RETURN)
-        {
-            return;
-        }
-
+        auto node = statement(StatementKind::RETURN);
         tokenizer->advance();
 
         if (tokenizer->symbol() != ';')
         {
-            compileExpression();
-        }
-        else
-        {
-            vmWriter->writePush(Segment::CONST, 0);
+            node->value = parseExpression();
         }
 
-        vmWriter->writeReturn();
         tokenizer->advance();
+        return node;
     }
 
-    void compileIf()
+    Statement *parseIf()
     {
-        if (tokenizer->keyWord() != Keyword::IF)
-        {
-            return;
-        }
-
-        controlCount++;
-        auto endLabel = "IF_END_" + to_string(controlCount);
-        auto falseLabel = "IF_FALSE_" + to_string(controlCount);
+        auto node = statement(StatementKind::IF);
         tokenizer->advance();
         tokenizer->advance();
-        compileExpression();
+        node->value = parseExpression();
         tokenizer->advance();
-        vmWriter->writeArithmetic("not");
-        vmWriter->writeIf(falseLabel);
 
         tokenizer->advance();
-        compileStatements();
-        vmWriter->writeGoto(endLabel);
-        vmWriter->writeLabel(falseLabel);
+        node->body = parseStatements();
         tokenizer->advance();
 
         if (tokenizer->keyWord() == Keyword::ELSE)
         {
             tokenizer->advance();
             tokenizer->advance();
-            compileStatements();
+            node->otherwise = parseStatements();
             tokenizer->advance();
         }
 
-        vmWriter->writeLabel(endLabel);
+        return node;
     }
 
-    void compileExpression()
+    Expression *parseExpression()
     {
-        compileTerm();
+        auto node = parseTerm();
 
         while (isOp())
         {
-            auto symbol = tokenizer->symbol();
+            auto binary = expression(ExpressionKind::BINARY);
+            binary->op = tokenizer->symbol();
             tokenizer->advance();
-            compileTerm();
-
-            if (symbol == '*')
-            {
-                vmWriter->writeCall("Math.multiply", 2);
-            }
-            else if (symbol == '/')
-            {
-                vmWriter->writeCall("Math.divide", 2);
-            }
-            else
-            {
-                vmWriter->writeArithmetic(toArithmetic(symbol));
-            }
+            binary->left = node;
+            binary->right = parseTerm();
+            node = binary;
         }
+
+        return node;
     }
 
-    void compileTerm()
+    Expression *parseTerm()
     {
         switch (tokenizer->tokenType())
         {
@@ -806,151 +1032,816 @@ public:
             char symbol = tokenizer->symbol();
             if (symbol == '[')
             {
+                auto node = expression(ExpressionKind::ARRAY_ACCESS);
+                node->text = identifier;
                 tokenizer->advance();
-                vmWriter->writePush(toSegment(symbolTable.kindOf(identifier)), symbolTable.indexOf(identifier));
-                compileExpression();
-                vmWriter->writeArithmetic("add");
-                vmWriter->writePop(Segment::POINTER, 1);
-                vmWriter->writePush(Segment::THAT, 0);
+                node->left = parseExpression();
                 tokenizer->advance();
+                return node;
             }
-            else if (symbol == '(' || symbol == '.')
-            {
-                compileSubroutineCall(identifier, false);
-            }
-            else
+
+            if (symbol == '(' || symbol == '.')
             {
-                vmWriter->writePush(toSegment(symbolTable.kindOf(identifier)), symbolTable.indexOf(identifier));
+                auto node = expression(ExpressionKind::CALL);
+                node->call = parseSubroutineCall(identifier);
+                return node;
             }
 
-            break;
+            auto node = expression(ExpressionKind::VARIABLE);
+            node->text = identifier;
+            return node;
         }
 
         case TokenType::STRING_CONST:
         {
-            auto str = tokenizer->stringVal();
-            auto strLen = str.length();
+            auto node = expression(ExpressionKind::STRING_CONST);
+            node->text = tokenizer->stringVal();
+            tokenizer->advance();
+            return node;
+        }
 
-            vmWriter->writePush(Segment::CONST, strLen);
-            vmWriter->writeCall("String.new", 1);
+        case TokenType::SYMBOL:
+        {
+            char symbol = tokenizer->symbol();
+            tokenizer->advance();
 
-            for (auto &chr : str)
+            if (symbol == '-' || symbol == '~')
             {
-                vmWriter->writePush(Segment::CONST, (int)chr);
-                vmWriter->writeCall("String.appendChar", 2);
+                auto node = expression(ExpressionKind::UNARY);
+                node->op = symbol;
+                node->left = parseTerm();
+                return node;
             }
 
+            auto node = parseExpression();
             tokenizer->advance();
-            break;
+            return node;
         }
 
-        case TokenType::SYMBOL:
+        case TokenType::INT_CONST:
         {
-            char symbol = tokenizer->symbol();
+            auto node = expression(ExpressionKind::INT_CONST);
+            node->value = tokenizer->intVal();
             tokenizer->advance();
+            return node;
+        }
 
-            if (symbol == '-')
+        case TokenType::KEYWORD:
+        default:
+        {
+            auto node = expression(ExpressionKind::KEYWORD_CONST);
+            node->keyword = tokenizer->keyWord();
+            tokenizer->advance();
+            return node;
+        }
+        }
+    }
+
+    Call *parseSubroutineCall(string_view target)
+    {
+        auto node = arena->make<Call>();
+        node->target = target;
+
+        if (tokenizer->symbol() == '.')
+        {
+            tokenizer->advance();
+            node->method = tokenizer->identifier();
+            tokenizer->advance();
+        }
+
+        tokenizer->advance();
+        NodeList<Expression> arguments;
+        if (tokenizer->symbol() != ')')
+        {
+            arguments.append(parseExpression());
+            node->argumentCount++;
+        }
+
+        while (tokenizer->symbol() == ',')
+        {
+            tokenizer->advance();
+            arguments.append(parseExpression());
+            node->argumentCount++;
+        }
+        node->arguments = arguments.first;
+
+        tokenizer->advance();
+        return node;
+    }
+
+    VariableDec *declare(IdentifierKind kind, string_view type, string_view name)
+    {
+        auto node = arena->make<VariableDec>();
+        node->kind = kind;
+        node->type = type;
+        node->name = name;
+        return node;
+    }
+
+    Statement *statement(StatementKind kind)
+    {
+        auto node = arena->make<Statement>();
+        node->kind = kind;
+        return node;
+    }
+
+    Expression *expression(ExpressionKind kind)
+    {
+        auto node = arena->make<Expression>();
+        node->kind = kind;
+        return node;
+    }
+
+    bool isOp()
+    {
+        auto symbol = tokenizer->symbol();
+        return symbol == '+' || symbol == '-' || symbol == '*' || symbol == '/' || symbol == '&' || symbol == '|' || symbol == '<' || symbol == '>' || symbol == '=';
+    }
+
+    bool isType()
+    {
+        auto type = tokenizer->keyWord();
+        return type == Keyword::INT || type == Keyword::BOOLEAN || type == Keyword::CHAR || tokenizer->tokenType() == TokenType::IDENTIFIER;
+    }
+};
+
+// Rewrites the expressions of a class before code generation. Constant
+// operands are folded with the VM's 16-bit wraparound, identities such as
+// x + 0, x * 1 and ~~x are dropped, and products with a constant become
+// SCALE nodes, which the generator expands into doublings and additions
+// instead of calling Math.multiply. The VM has no shift instruction, so a
+// division by any constant other than 1 still calls Math.divide. An operand
+// is only discarded when it contains no call.
+class Optimizer
+{
+public:
+    void optimizeClass(ClassNode *node)
+    {
+        for (auto subroutine = node->subroutines; subroutine != nullptr; subroutine = subroutine->next)
+        {
+            optimizeStatements(subroutine->body);
+        }
+    }
+
+private:
+    void optimizeStatements(Statement *node)
+    {
+        for (; node != nullptr; node = node->next)
+        {
+            if (node->index != nullptr)
+            {
+                node->index = optimizeExpression(node->index);
+            }
+            if (node->value != nullptr)
+            {
+                node->value = optimizeExpression(node->value);
+            }
+            if (node->call != nullptr)
             {
+                optimizeCall(node->call);
+            }
 
-                compileTerm();
-                vmWriter->writeArithmetic("neg");
+            optimizeStatements(node->body);
+            optimizeStatements(node->otherwise);
+        }
+    }
+
+    void optimizeCall(Call *node)
+    {
+        Expression **argument = &node->arguments;
+        while (*argument != nullptr)
+        {
+            Expression *next = (*argument)->next;
+            *argument = optimizeExpression(*argument);
+            (*argument)->next = next;
+            argument = &(*argument)->next;
+        }
+    }
+
+    Expression *optimizeExpression(Expression *node)
+    {
+        switch (node->kind)
+        {
+        case ExpressionKind::ARRAY_ACCESS:
+            node->left = optimizeExpression(node->left);
+            return node;
+
+        case ExpressionKind::CALL:
+            optimizeCall(node->call);
+            return node;
+
+        case ExpressionKind::UNARY:
+            return optimizeUnary(node);
+
+        case ExpressionKind::BINARY:
+            return optimizeBinary(node);
+
+        default:
+            return node;
+        }
+    }
+
+    Expression *optimizeUnary(Expression *node)
+    {
+        node->left = optimizeExpression(node->left);
+        Expression *operand = node->left;
+
+        int value;
+        if (constantValue(operand, value))
+        {
+            return constant(node, node->op == '-' ? -value : ~value);
+        }
+
+        if (node->op == '-')
+        {
+            return negate(node, operand);
+        }
+
+        if (operand->kind == ExpressionKind::UNARY && operand->op == '~')
+        {
+            return operand->left;
+        }
+
+        return node;
+    }
+
+    Expression *optimizeBinary(Expression *node)
+    {
+        node->left = optimizeExpression(node->left);
+        node->right = optimizeExpression(node->right);
+        Expression *left = node->left;
+        Expression *right = node->right;
+
+        int a = 0, b = 0;
+        bool leftConstant = constantValue(left, a);
+        bool rightConstant = constantValue(right, b);
+        if (leftConstant && rightConstant)
+        {
+            int result;
+            if (fold(node->op, a, b, result))
+            {
+                return constant(node, result);
+            }
+
+            return node;
+        }
+
+        switch (node->op)
+        {
+        case '+':
+        case '|':
+            if (rightConstant && b == 0)
+            {
+                return left;
             }
-            else if (symbol == '~')
+            if (leftConstant && a == 0)
             {
-                compileTerm();
-                vmWriter->writeArithmetic("not");
+                return right;
             }
-            else
+            break;
+
+        case '-':
+            if (rightConstant && b == 0)
             {
-                compileExpression();
-                tokenizer->advance();
+                return left;
             }
+            if (leftConstant && a == 0)
+            {
+                return negate(node, right);
+            }
+            break;
 
+        case '&':
+            if (rightConstant && b == -1)
+            {
+                return left;
+            }
+            if (leftConstant && a == -1)
+            {
+                return right;
+            }
+            if ((rightConstant && b == 0 && isPure(left)) || (leftConstant && a == 0 && isPure(right)))
+            {
+                return constant(node, 0);
+            }
+            break;
+
+        case '*':
+            if (leftConstant || rightConstant)
+            {
+                return scale(node, leftConstant ? right : left, leftConstant ? a : b);
+            }
+            break;
+
+        case '/':
+            if (rightConstant && b == 1)
+            {
+                return left;
+            }
             break;
         }
 
-        case TokenType::INT_CONST:
+        return node;
+    }
+
+    Expression *scale(Expression *node, Expression *operand, int factor)
+    {
+        if (factor == 1)
         {
-            vmWriter->writePush(Segment::CONST, tokenizer->intVal());
-            tokenizer->advance();
-            break;
+            return operand;
         }
 
-        case TokenType::KEYWORD:
+        if (factor == -1)
+        {
+            return negate(node, operand);
+        }
+
+        if (factor == 0)
+        {
+            return isPure(operand) ? constant(node, 0) : node;
+        }
+
+        if (operand->kind == ExpressionKind::SCALE)
+        {
+            return scale(node, operand->left, wrap(operand->value * factor));
+        }
+
+        node->kind = ExpressionKind::SCALE;
+        node->left = operand;
+        node->right = nullptr;
+        node->value = factor;
+        return node;
+    }
+
+    Expression *negate(Expression *node, Expression *operand)
+    {
+        if (operand->kind == ExpressionKind::UNARY && operand->op == '-')
+        {
+            return operand->left;
+        }
+
+        if (operand->kind == ExpressionKind::SCALE)
+        {
+            operand->value = wrap(-operand->value);
+            return operand;
+        }
+
+        node->kind = ExpressionKind::UNARY;
+        node->op = '-';
+        node->left = operand;
+        node->right = nullptr;
+        return node;
+    }
+
+    Expression *constant(Expression *node, int value)
+    {
+        node->kind = ExpressionKind::INT_CONST;
+        node->value = wrap(value);
+        node->left = nullptr;
+        node->right = nullptr;
+        return node;
+    }
+
+    static bool fold(char op, int a, int b, int &result)
+    {
+        switch (op)
+        {
+        case '+':
+            result = a + b;
+            return true;
+
+        case '-':
+            result = a - b;
+            return true;
+
+        case '*':
+            result = a * b;
+            return true;
+
+        case '/':
+            // Math.divide returns 0 for a zero divisor and cannot negate
+            // -32768, so those are left to run.
+            if (b == 0 || a == -32768 || b == -32768)
+            {
+                return false;
+            }
+            result = a / b;
+            return true;
+
+        case '&':
+            result = a & b;
+            return true;
+
+        case '|':
+            result = a | b;
+            return true;
+
+        case '<':
+            result = a < b ? -1 : 0;
+            return true;
+
+        case '>':
+            result = a > b ? -1 : 0;
+            return true;
+
+        case '=':
+            result = a == b ? -1 : 0;
+            return true;
+
+        default:
+            return false;
+        }
+    }
+
+    static bool constantValue(const Expression *node, int &value)
+    {
+        if (node->kind == ExpressionKind::INT_CONST)
+        {
+            value = node->value;
+            return true;
+        }
+
+        if (node->kind == ExpressionKind::KEYWORD_CONST && (node->keyword == Keyword::TRUE || node->keyword == Keyword::FALSE || node->keyword == Keyword::_NULL))
+        {
+            value = node->keyword == Keyword::TRUE ? -1 : 0;
+            return true;
+        }
+
+        return false;
+    }
+
+    static bool isPure(const Expression *node)
+    {
+        switch (node->kind)
+        {
+        case ExpressionKind::CALL:
+            return false;
+
+        case ExpressionKind::ARRAY_ACCESS:
+        case ExpressionKind::UNARY:
+        case ExpressionKind::SCALE:
+            return isPure(node->left);
+
+        case ExpressionKind::BINARY:
+            return isPure(node->left) && isPure(node->right);
+
+        default:
+            return true;
+        }
+    }
+
+    static int wrap(int value)
+    {
+        return (int16_t)(uint16_t)value;
+    }
+};
+
+// Walks the syntax tree of a class and writes its VM code, resolving names
+// through the symbol table as declarations are reached.
+class CodeGenerator
+{
+private:
+    VMWriter *vmWriter;
+    SymbolTable symbolTable;
+    string_view className;
+    int controlCount = 0;
+
+public:
+    CodeGenerator(VMWriter *vmWriter) : vmWriter(vmWriter), symbolTable() {}
+
+    void generateClass(const ClassNode *node)
+    {
+        className = node->name;
+        for (auto variable = node->variables; variable != nullptr; variable = variable->next)
+        {
+            symbolTable.define(variable->name, variable->type, variable->kind);
+        }
+
+        for (auto subroutine = node->subroutines; subroutine != nullptr; subroutine = subroutine->next)
+        {
+            generateSubroutine(subroutine);
+        }
+    }
+
+private:
+    void generateSubroutine(const Subroutine *node)
+    {
+        symbolTable.startSubroutine();
+        if (node->kind == Keyword::METHOD)
+        {
+            symbolTable.define("this", className, IdentifierKind::ARG);
+        }
+
+        for (auto variable = node->parameters; variable != nullptr; variable = variable->next)
+        {
+            symbolTable.define(variable->name, variable->type, variable->kind);
+        }
+        for (auto variable = node->locals; variable != nullptr; variable = variable->next)
+        {
+            symbolTable.define(variable->name, variable->type, variable->kind);
+        }
+
+        auto nLocals = symbolTable.varCount(IdentifierKind::VAR);
+        auto fullFuncName = qualifiedName(className, node->name);
+        vmWriter->writeFunction(fullFuncName, nLocals);
+
+        if (node->kind == Keyword::METHOD)
+        {
+            vmWriter->writePush(Segment::ARG, 0);
+            vmWriter->writePop(Segment::POINTER, 0);
+        }
+        else if (node->kind == Keyword::CONSTRUCTOR)
+        {
+            vmWriter->writePush(Segment::CONST, symbolTable.varCount(IdentifierKind::FIELD));
+            vmWriter->writeCall("Memory.alloc", 1);
+            vmWriter->writePop(Segment::POINTER, 0);
+        }
+
+        generateStatements(node->body);
+    }
+
+    void generateStatements(const Statement *node)
+    {
+        for (; node != nullptr; node = node->next)
+        {
+            switch (node->kind)
+            {
+            case StatementKind::IF:
+                generateIf(node);
+                break;
+
+            case StatementKind::DO:
+                generateCall(node->call, true);
+                break;
+
+            case StatementKind::WHILE:
+                generateWhile(node);
+                break;
+
+            case StatementKind::RETURN:
+                generateReturn(node);
+                break;
+
+            case StatementKind::LET:
+                generateLet(node);
+                break;
+            }
+        }
+    }
+
+    void generateLet(const Statement *node)
+    {
+        if (node->index != nullptr)
+        {
+            pushVariable(node->name);
+            generateExpression(node->index);
+            vmWriter->writeArithmetic("add");
+            generateExpression(node->value);
+            vmWriter->writePop(Segment::TEMP, 0);
+            vmWriter->writePop(Segment::POINTER, 1);
+            vmWriter->writePush(Segment::TEMP, 0);
+            vmWriter->writePop(Segment::THAT, 0);
+        }
+        else
+        {
+            generateExpression(node->value);
+            vmWriter->writePop(toSegment(symbolTable.kindOf(node->name)), symbolTable.indexOf(node->name));
+        }
+    }
+
+    void generateWhile(const Statement *node)
+    {
+        controlCount++;
+        auto startLabel = "WHILE_START_" + to_string(controlCount);
+        auto endLabel = "WHILE_END_" + to_string(controlCount);
+        vmWriter->writeLabel(startLabel);
+        generateExpression(node->value);
+
+        vmWriter->writeArithmetic("not");
+        vmWriter->writeIf(endLabel);
+
+        generateStatements(node->body);
+        vmWriter->writeGoto(startLabel);
+        vmWriter->writeLabel(endLabel);
+    }
+
+    void generateReturn(const Statement *node)
+    {
+        if (node->value != nullptr)
+        {
+            generateExpression(node->value);
+        }
+        else
+        {
+            vmWriter->writePush(Segment::CONST, 0);
+        }
+
+        vmWriter->writeReturn();
+    }
+
+    void generateIf(const Statement *node)
+    {
+        controlCount++;
+        auto endLabel = "IF_END_" + to_string(controlCount);
+        auto falseLabel = "IF_FALSE_" + to_string(controlCount);
+        generateExpression(node->value);
+        vmWriter->writeArithmetic("not");
+        vmWriter->writeIf(falseLabel);
+
+        generateStatements(node->body);
+        vmWriter->writeGoto(endLabel);
+        vmWriter->writeLabel(falseLabel);
+        generateStatements(node->otherwise);
+        vmWriter->writeLabel(endLabel);
+    }
+
+    void generateExpression(const Expression *node)
+    {
+        switch (node->kind)
         {
-            auto keyword = tokenizer->keyWord();
+        case ExpressionKind::INT_CONST:
+            generateConstant(node->value);
+            break;
+
+        case ExpressionKind::STRING_CONST:
+            vmWriter->writePush(Segment::CONST, node->text.length());
+            vmWriter->writeCall("String.new", 1);
+
+            for (auto &chr : node->text)
+            {
+                vmWriter->writePush(Segment::CONST, (int)chr);
+                vmWriter->writeCall("String.appendChar", 2);
+            }
+            break;
 
-            if (keyword == Keyword::TRUE)
+        case ExpressionKind::KEYWORD_CONST:
+            if (node->keyword == Keyword::TRUE)
             {
                 vmWriter->writePush(Segment::CONST, 1);
                 vmWriter->writeArithmetic("neg");
             }
-            else if (keyword == Keyword::FALSE || keyword == Keyword::_NULL)
+            else if (node->keyword == Keyword::FALSE || node->keyword == Keyword::_NULL)
             {
                 vmWriter->writePush(Segment::CONST, 0);
             }
-            else if (keyword == Keyword::THIS)
+            else if (node->keyword == Keyword::THIS)
             {
                 vmWriter->writePush(Segment::POINTER, 0);
             }
+            break;
 
-            tokenizer->advance();
+        case ExpressionKind::VARIABLE:
+            pushVariable(node->text);
+            break;
+
+        case ExpressionKind::ARRAY_ACCESS:
+            pushVariable(node->text);
+            generateExpression(node->left);
+            vmWriter->writeArithmetic("add");
+            vmWriter->writePop(Segment::POINTER, 1);
+            vmWriter->writePush(Segment::THAT, 0);
+            break;
+
+        case ExpressionKind::CALL:
+            generateCall(node->call, false);
+            break;
+
+        case ExpressionKind::UNARY:
+            generateExpression(node->left);
+            vmWriter->writeArithmetic(node->op == '-' ? "neg" : "not");
+            break;
+
+        case ExpressionKind::BINARY:
+            generateExpression(node->left);
+            generateExpression(node->right);
+
+            if (node->op == '*')
+            {
+                vmWriter->writeCall("Math.multiply", 2);
+            }
+            else if (node->op == '/')
+            {
+                vmWriter->writeCall("Math.divide", 2);
+            }
+            else
+            {
+                vmWriter->writeArithmetic(toArithmetic(node->op));
+            }
+            break;
+
+        case ExpressionKind::SCALE:
+            generateScale(node);
             break;
         }
+    }
+
+    void generateConstant(int value)
+    {
+        if (value >= 0)
+        {
+            vmWriter->writePush(Segment::CONST, value);
+        }
+        else if (value == -32768)
+        {
+            vmWriter->writePush(Segment::CONST, 32767);
+            vmWriter->writeArithmetic("not");
+        }
+        else
+        {
+            vmWriter->writePush(Segment::CONST, -value);
+            vmWriter->writeArithmetic("neg");
         }
     }
 
-    int compileExpressionList()
+    // Multiplies by a constant with Horner's rule over its bits: the running
+    // product is doubled for every bit and the operand is added for every set
+    // bit. A variable operand is pushed again where needed; anything else is
+    // evaluated once into temp 1, and temp 2 duplicates the running product.
+    void generateScale(const Expression *node)
     {
-        int nArgs = 0;
+        const Expression *operand = node->left;
+        uint16_t factor = node->value < 0 ? -node->value : node->value;
+        bool variable = operand->kind == ExpressionKind::VARIABLE;
+        auto pushOperand = [&]()
+        {
+            if (variable)
+            {
+                pushVariable(operand->text);
+            }
+            else
+            {
+                vmWriter->writePush(Segment::TEMP, 1);
+            }
+        };
 
-        if (tokenizer->symbol() != ')')
+        if (!variable)
         {
-            compileExpression();
-            nArgs++;
+            generateExpression(operand);
+            vmWriter->writePop(Segment::TEMP, 1);
         }
+        pushOperand();
 
-        while (tokenizer->symbol() == ',')
+        int bit = 15;
+        while (!((factor >> bit) & 1))
         {
-            tokenizer->advance();
-            compileExpression();
-            nArgs++;
+            bit--;
+        }
+
+        bool product = false;
+        for (bit--; bit >= 0; bit--)
+        {
+            if (product)
+            {
+                vmWriter->writePop(Segment::TEMP, 2);
+                vmWriter->writePush(Segment::TEMP, 2);
+                vmWriter->writePush(Segment::TEMP, 2);
+            }
+            else
+            {
+                pushOperand();
+            }
+            vmWriter->writeArithmetic("add");
+            product = true;
+
+            if ((factor >> bit) & 1)
+            {
+                pushOperand();
+                vmWriter->writeArithmetic("add");
+            }
         }
 
-        return nArgs;
+        if (node->value < 0)
+        {
+            vmWriter->writeArithmetic("neg");
+        }
     }
 
-private:
-    void compileSubroutineCall(string subroutineName, bool isVoid)
+    void generateCall(const Call *node, bool isVoid)
     {
-        auto funcName = className + "." + subroutineName;
-        auto hasThisArg = symbolTable.kindOf(subroutineName) != IdentifierKind::NONE;
-        auto symbol = tokenizer->symbol();
+        string funcName;
+        int nArgs = node->argumentCount;
 
-        if (symbol == '.')
+        if (node->method.empty())
         {
-            tokenizer->advance();
-            auto cName = hasThisArg ? symbolTable.typeOf(subroutineName) : subroutineName;
-            funcName = cName + "." + tokenizer->identifier();
-            tokenizer->advance();
+            funcName = qualifiedName(className, node->target);
+            vmWriter->writePush(Segment::POINTER, 0);
+            nArgs++;
         }
-        else
+        else if (symbolTable.kindOf(node->target) != IdentifierKind::NONE)
         {
-            hasThisArg = true;
+            funcName = qualifiedName(symbolTable.typeOf(node->target), node->method);
+            pushVariable(node->target);
+            nArgs++;
         }
-
-        tokenizer->advance();
-        if (hasThisArg && symbol != '.')
+        else
         {
-            vmWriter->writePush(Segment::POINTER, 0);
+            funcName = qualifiedName(node->target, node->method);
         }
-        else if (hasThisArg && symbol == '.')
+
+        for (auto argument = node->arguments; argument != nullptr; argument = argument->next)
         {
-            vmWriter->writePush(toSegment(symbolTable.kindOf(subroutineName)), symbolTable.indexOf(subroutineName));
+            generateExpression(argument);
         }
-        int nArgs = compileExpressionList();
-        if (hasThisArg)
-            nArgs++;
 
         vmWriter->writeCall(funcName, nArgs);
 
@@ -958,8 +1849,18 @@ private:
         {
             vmWriter->writePop(Segment::TEMP, 0);
         }
+    }
 
-        tokenizer->advance();
+    void pushVariable(string_view name)
+    {
+        vmWriter->writePush(toSegment(symbolTable.kindOf(name)), symbolTable.indexOf(name));
+    }
+
+    string qualifiedName(string_view owner, string_view name)
+    {
+        string qualified;
+        qualified.reserve(owner.length() + 1 + name.length());
+        return qualified.append(owner).append(1, '.').append(name);
     }
 
     Segment toSegment(IdentifierKind kind)
@@ -1018,27 +1919,33 @@ private:
             return "";
         }
     }
+};
 
-    bool isOp()
+bool compile(const string &jackFilePath, const string &vmFilePath)
+{
+    Tokenizer tokenizer(jackFilePath);
+    if (!tokenizer.valid())
     {
-        auto symbol = tokenizer->symbol();
-        return symbol == '+' || symbol == '-' || symbol == '*' || symbol == '/' || symbol == '&' || symbol == '|' || symbol == '<' || symbol == '>' || symbol == '=';
+        return false;
     }
 
-    bool isType()
+    Arena arena;
+    Parser parser(&tokenizer, &arena);
+    tokenizer.advance();
+    auto node = parser.parseClass();
+
+    VMWriter vmWriter(vmFilePath);
+    if (node != nullptr)
     {
-        auto type = tokenizer->keyWord();
-        return type == Keyword::INT || type == Keyword::BOOLEAN || type == Keyword::CHAR || tokenizer->tokenType() == TokenType::IDENTIFIER;
+        Optimizer optimizer;
+        optimizer.optimizeClass(node);
+
+        CodeGenerator generator(&vmWriter);
+        generator.generateClass(node);
     }
-};
 
-void compile(const string &jackFilePath, const string &vmFilePath)
-{
-    Tokenizer tokenizer(jackFilePath);
-    VMWriter vmWriter(vmFilePath);
-    CompilationEngine compiler(&tokenizer, &vmWriter);
-    tokenizer.advance();
-    compiler.compileClass();
+    arena.release();
+    return true;
 }
 
 int main(int argc, char **argv)
@@ -1059,7 +1966,10 @@ int main(int argc, char **argv)
             {
                 string jackFilePath = entry.path();
                 string vmFilePath = jackFilePath.substr(0, jackFilePath.find_last_of(".")) + ".vm";
-                compile(jackFilePath, vmFilePath);
+                if (!compile(jackFilePath, vmFilePath))
+                {
+                    return -1;
+                }
             }
         }
     }
@@ -1067,7 +1977,10 @@ int main(int argc, char **argv)
     {
         string jackFilePath = argv[1];
         string vmFilePath = jackFilePath.substr(0, jackFilePath.find_last_of(".")) + ".vm";
-        compile(jackFilePath, vmFilePath);
+        if (!compile(jackFilePath, vmFilePath))
+        {
+            return -1;
+        }
     }
 
     return 0;
@@ -0,0 +1,953 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <iomanip>
+#include <regex>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cmath>
+#include <filesystem>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Finds every .tst script under the given directories, builds what each one
+// loads with the repo's own tools and runs it on a pool of workers. Every
+// test runs in its own copy of its directory under the work directory, so
+// scripts sharing a directory and an output file can run at the same time,
+// and the tree itself is left untouched. Flattened chips are cached in the
+// work directory's netlists directory across runs.
+//
+// The tools are looked up in the tools directory: hack-assembler,
+// vm-translator and compiler build .asm, .hack and .vm files, and cpu-test,
+// vm-test and chip-test run CPU emulator, VM emulator and hardware simulator
+// scripts respectively. VM scripts run a second time with the JIT compiling
+// every function on its first call, so the native code is checked against
+// the same comparison files as the interpreter, and CPU scripts whose
+// program is translated from VM code run again on a program linked from
+// object files and, where they only set and output RAM, as C++ compiled
+// with the C++ compiler given with --cxx, c++ by default. A translated
+// program with a .report.csv file next to it, named after the program, also
+// has its per-function code size report checked against that file. Chip
+// scripts run twice more, event-driven and with the RAM chips flattened and
+// swept on two threads, and scripts of the Hack computer run a second time
+// on chip-test with its RAM built from gates.
+
+struct Test
+{
+    enum Kind
+    {
+        CPU,
+        VM,
+        CHIP
+    };
+
+    // How the program of a CPU script is built from the directory's VM
+    // code: translated to assembly, to object files linked into a .hack
+    // file, or to C++ compiled into a program run in place of the CPU
+    // emulator.
+    enum Backend
+    {
+        ASSEMBLY,
+        OBJECTS,
+        CPP
+    };
+
+    enum Status
+    {
+        PENDING,
+        PASS,
+        FAIL,
+        TIMEOUT,
+        SKIP
+    };
+
+    filesystem::path script;
+    Kind kind = CPU;
+    vector<string> flags;
+    string program;
+    bool translated = false;
+    Backend backend = ASSEMBLY;
+    bool computer = false;
+    Status status = PENDING;
+    string message;
+    double seconds = 0;
+};
+
+struct Options
+{
+    filesystem::path tools;
+    filesystem::path work;
+    filesystem::path os;
+    filesystem::path cxx;
+    vector<filesystem::path> chips;
+    double timeout = 60;
+    bool keep = false;
+};
+
+string kindName(Test::Kind kind)
+{
+    switch (kind)
+    {
+    case Test::CPU:
+        return "cpu";
+
+    case Test::VM:
+        return "vm";
+
+    case Test::CHIP:
+    default:
+        return "chip";
+    }
+}
+
+string backendName(Test::Backend backend)
+{
+    switch (backend)
+    {
+    case Test::OBJECTS:
+        return "objects";
+
+    case Test::CPP:
+        return "c++";
+
+    case Test::ASSEMBLY:
+    default:
+        return "assembly";
+    }
+}
+
+// The script, followed by the flags its runner is given in this pass and
+// the backend building its program, unless that is the assembly one.
+string testName(const Test &test)
+{
+    string name = test.script.string();
+    for (const auto &flag : test.flags)
+    {
+        name += " " + flag;
+    }
+    if (test.backend != Test::ASSEMBLY)
+    {
+        name += " (" + backendName(test.backend) + ")";
+    }
+    return name;
+}
+
+string statusName(Test::Status status)
+{
+    switch (status)
+    {
+    case Test::PASS:
+        return "pass";
+
+    case Test::FAIL:
+        return "fail";
+
+    case Test::TIMEOUT:
+        return "timeout";
+
+    case Test::SKIP:
+        return "skip";
+
+    case Test::PENDING:
+    default:
+        return "pending";
+    }
+}
+
+// Runs a tool with its output appended to the log file, and kills it with
+// SIGALRM once the given number of seconds has passed. Returns the exit
+// status, or -1 if the tool could not be run or was killed.
+int runTool(const vector<string> &args, const filesystem::path &logPath, double seconds, bool &timedOut)
+{
+    vector<char *> argv;
+    for (const auto &arg : args)
+    {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    string log = logPath.string();
+    unsigned int alarmSeconds = max(1.0, ceil(seconds));
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        alarm(alarmSeconds);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0)
+    {
+        return -1;
+    }
+
+    timedOut = WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+bool contains(const filesystem::path &directory, const string &extension)
+{
+    for (const auto &entry : filesystem::directory_iterator(directory))
+    {
+        if (entry.path().extension() == extension)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+string readScript(const filesystem::path &path)
+{
+    ifstream file(path);
+    stringstream buffer;
+    buffer << file.rdbuf();
+    return regex_replace(buffer.str(), regex("//[^\n]*|/\\*[\\s\\S]*?\\*/"), "");
+}
+
+// The arguments that make the C++ translation of a CPU script's program
+// start with the RAM the script sets and print the RAM it outputs: only
+// scripts that set RAM before running and output RAM once at the end can
+// run that way.
+bool cppArguments(const filesystem::path &script, vector<string> &args)
+{
+    string text = readScript(script);
+    smatch match;
+    size_t firstTick = text.find("tick");
+
+    regex setPattern("\\bset\\s+([^\\s,;]+)\\s+([^\\s,;]+)");
+    for (sregex_iterator it(text.begin(), text.end(), setPattern), end; it != end; ++it)
+    {
+        string name = (*it)[1];
+        if (!regex_match(name, match, regex("RAM\\[(\\d+)\\]")) || (size_t)it->position() > firstTick)
+        {
+            return false;
+        }
+        args.push_back(match[1].str() + "=" + (*it)[2].str());
+    }
+
+    if (!regex_search(text, match, regex("\\boutput-list\\s+([^,;]*)")))
+    {
+        return false;
+    }
+    string list = match[1];
+    regex itemPattern("[^\\s]+");
+    for (sregex_iterator it(list.begin(), list.end(), itemPattern), end; it != end; ++it)
+    {
+        string item = it->str();
+        if (!regex_match(item, match, regex("RAM\\[(\\d+)\\](%.*)?")))
+        {
+            return false;
+        }
+        args.push_back(match[1]);
+    }
+
+    regex outputPattern("\\boutput\\s*[,;]");
+    return distance(sregex_iterator(text.begin(), text.end(), outputPattern), sregex_iterator()) == 1;
+}
+
+// Tells the simulator a script is written for from what it loads: a chip
+// other than the Hack computer, a machine language program, or VM code.
+Test classify(const filesystem::path &script)
+{
+    Test test;
+    test.script = script;
+
+    string text = readScript(script);
+    vector<string> loads;
+    regex loadPattern("\\bload\\b\\s*([^\\s,;]*)");
+    for (sregex_iterator it(text.begin(), text.end(), loadPattern), end; it != end; ++it)
+    {
+        loads.push_back((*it)[1]);
+    }
+
+    if (regex_search(text, regex("\\brepeat\\s*\\{|\\bwhile\\b")))
+    {
+        test.status = Test::SKIP;
+        test.message = "interactive script";
+        return test;
+    }
+
+    string first = loads.empty() ? "" : loads[0];
+    string extension = filesystem::path(first).extension().string();
+
+    if (extension == ".hdl" && filesystem::path(first).stem() != "Computer")
+    {
+        test.kind = Test::CHIP;
+    }
+    else if (extension == ".hdl")
+    {
+        test.kind = Test::CPU;
+        test.program = loads.size() > 1 ? loads[1] : "";
+        test.computer = true;
+    }
+    else if (extension == ".hack" || extension == ".asm")
+    {
+        test.kind = Test::CPU;
+        test.program = first;
+    }
+    else
+    {
+        test.kind = Test::VM;
+    }
+
+    // A program that is missing, and cannot be assembled from an .asm file
+    // either, is translated from the directory's VM code.
+    filesystem::path program = script.parent_path() / test.program;
+    test.translated = test.kind == Test::CPU && !test.program.empty() && contains(filesystem::absolute(script).parent_path(), ".vm") &&
+                      !filesystem::exists(program) &&
+                      !(program.extension() == ".hack" && filesystem::exists(filesystem::path(program).replace_extension(".asm")));
+
+    return test;
+}
+
+class Runner
+{
+private:
+    Options m_options;
+    vector<Test> &m_tests;
+    atomic<size_t> m_next{0};
+    mutex m_outputMutex;
+
+public:
+    Runner(const Options &options, vector<Test> &tests) : m_tests(tests)
+    {
+        m_options = options;
+    }
+
+    void run(int jobs)
+    {
+        vector<thread> workers;
+        for (int i = 0; i < jobs; i++)
+        {
+            workers.emplace_back([this]
+                                 { work(); });
+        }
+
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+private:
+    void work()
+    {
+        for (size_t i = m_next++; i < m_tests.size(); i = m_next++)
+        {
+            Test &test = m_tests[i];
+            if (test.status == Test::PENDING)
+            {
+                auto start = chrono::steady_clock::now();
+                runTest(test, m_options.work / to_string(i));
+                chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+                test.seconds = elapsed.count();
+            }
+
+            lock_guard<mutex> lock(m_outputMutex);
+            cout << left << setw(8) << statusName(test.status) << right << setw(10) << fixed << setprecision(1)
+                 << test.seconds * 1000 << " ms  " << testName(test);
+            if (test.status != Test::PASS && !test.message.empty())
+            {
+                cout << ": " << test.message.substr(0, test.message.find('\n'));
+            }
+            cout << endl;
+        }
+    }
+
+    void runTest(Test &test, const filesystem::path &directory)
+    {
+        const map<Test::Kind, string> runners = {{Test::CPU, "cpu-test"}, {Test::VM, "vm-test"}, {Test::CHIP, "chip-test"}};
+        filesystem::path runner = m_options.tools / runners.at(test.kind);
+        if (!filesystem::exists(runner))
+        {
+            test.status = Test::SKIP;
+            test.message = runner.filename().string() + " not found in " + m_options.tools.string();
+            return;
+        }
+
+        filesystem::remove_all(directory);
+        filesystem::create_directories(directory);
+        for (const auto &entry : filesystem::directory_iterator(filesystem::absolute(test.script).parent_path()))
+        {
+            if (entry.is_regular_file())
+            {
+                filesystem::copy_file(entry.path(), directory / entry.path().filename());
+            }
+        }
+
+        filesystem::path log = directory / "test.log";
+        auto deadline = chrono::steady_clock::now() + chrono::duration<double>(m_options.timeout);
+        auto step = [&](const vector<string> &args)
+        {
+            chrono::duration<double> remaining = deadline - chrono::steady_clock::now();
+            bool timedOut = false;
+            int status = runTool(args, log, remaining.count(), timedOut);
+            test.status = timedOut ? Test::TIMEOUT : status == 0 ? Test::PASS : Test::FAIL;
+            return test.status == Test::PASS;
+        };
+
+        // Jack programs are compiled, and link against the OS.
+        bool jack = test.kind == Test::VM && contains(directory, ".jack");
+        bool built = true;
+        if (test.kind == Test::CPU)
+        {
+            built = buildProgram(test, directory, step) && checkReport(test, directory, log);
+        }
+        else if (jack)
+        {
+            built = step({(m_options.tools / "compiler").string(), directory.string()});
+        }
+
+        vector<string> args = {runner.string()};
+        if (jack && !m_options.os.empty())
+        {
+            args.insert(args.end(), {"--lib", (m_options.work / "os").string()});
+        }
+        if (test.kind == Test::CHIP)
+        {
+            for (const auto &chips : m_options.chips)
+            {
+                args.insert(args.end(), {"--lib", chips.string()});
+            }
+            args.insert(args.end(), {"--cache", (m_options.work / "netlists").string()});
+        }
+        args.insert(args.end(), test.flags.begin(), test.flags.end());
+        args.push_back((directory / test.script.filename()).string());
+
+        if (built && test.backend == Test::CPP)
+        {
+            runCpp(test, directory, log, step);
+        }
+        else if (built)
+        {
+            step(args);
+        }
+
+        if (test.status == Test::FAIL)
+        {
+            test.message = failureMessage(log);
+        }
+        else if (test.status == Test::TIMEOUT)
+        {
+            test.message = "timed out after " + to_string((int)m_options.timeout) + " s";
+        }
+
+        if (test.status == Test::PASS && !m_options.keep)
+        {
+            filesystem::remove_all(directory);
+        }
+    }
+
+    // Makes the .hack or .asm file a CPU script loads: a .hack file is
+    // assembled from its .asm file, or translated from the directory's VM
+    // code like an .asm file is.
+    template <typename Step>
+    bool buildProgram(const Test &test, const filesystem::path &directory, Step &step)
+    {
+        filesystem::path program = directory / test.program;
+        if (test.program.empty() || filesystem::exists(program))
+        {
+            return true;
+        }
+
+        filesystem::path assembly = filesystem::path(program).replace_extension(".asm");
+        if (program.extension() == ".hack" && filesystem::exists(assembly))
+        {
+            return step({(m_options.tools / "hack-assembler").string(), assembly.string()});
+        }
+
+        filesystem::path vmFile = filesystem::path(program).replace_extension(".vm");
+        if (!contains(directory, ".vm"))
+        {
+            return true;
+        }
+
+        string source = filesystem::exists(vmFile) ? vmFile.string() : directory.string();
+        if (test.backend == Test::OBJECTS)
+        {
+            return linkProgram(test, directory, source, step);
+        }
+        if (test.backend == Test::CPP)
+        {
+            filesystem::path cpp = filesystem::exists(vmFile) ? filesystem::path(vmFile).replace_extension(".cpp")
+                                                              : directory / (directory.filename().string() + ".cpp");
+            return step({(m_options.tools / "vm-translator").string(), "--cpp", source}) &&
+                   step({m_options.cxx.string(), "-std=c++17", "-O1", "-Wall", "-Wextra", "-Werror", "-o", (directory / "program").string(), cpp.string()});
+        }
+
+        vector<string> args = {(m_options.tools / "vm-translator").string()};
+        if (program.extension() == ".hack")
+        {
+            args.push_back("--hack");
+        }
+        if (filesystem::exists(reportFile(program)))
+        {
+            args.insert(args.end(), {"--report", (directory / "report.csv").string()});
+        }
+        args.push_back(source);
+
+        if (!step(args))
+        {
+            return false;
+        }
+
+        // A directory translates to a file named after the directory.
+        filesystem::path translated = directory / (directory.filename().string() + program.extension().string());
+        if (!filesystem::exists(program) && filesystem::exists(translated))
+        {
+            filesystem::rename(translated, program);
+        }
+        return true;
+    }
+
+    // The code size report expected for a translated program, such as
+    // SimpleFunction.report.csv for SimpleFunction.asm.
+    static filesystem::path reportFile(const filesystem::path &program)
+    {
+        return filesystem::path(program).replace_extension(".report.csv");
+    }
+
+    // Compares the report vm-translator wrote while building the program
+    // with the one expected for it, when there is one.
+    bool checkReport(Test &test, const filesystem::path &directory, const filesystem::path &log)
+    {
+        filesystem::path expected = reportFile(directory / test.program);
+        filesystem::path actual = directory / "report.csv";
+        if (test.backend != Test::ASSEMBLY || !filesystem::exists(expected) || !filesystem::exists(actual))
+        {
+            return true;
+        }
+
+        ifstream expectedFile(expected), actualFile(actual);
+        string expectedLine, actualLine;
+        for (int line = 1; getline(expectedFile, expectedLine); line++)
+        {
+            if (!getline(actualFile, actualLine) || actualLine != expectedLine)
+            {
+                ofstream(log, ios::app) << "FAIL " << test.script.string() << ": report line " << line << " is \""
+                                        << actualLine << "\", expected \"" << expectedLine << "\"" << endl;
+                test.status = Test::FAIL;
+                return false;
+            }
+        }
+        if (getline(actualFile, actualLine))
+        {
+            ofstream(log, ios::app) << "FAIL " << test.script.string() << ": report has an extra line \"" << actualLine << "\"" << endl;
+            test.status = Test::FAIL;
+            return false;
+        }
+        return true;
+    }
+
+    // Runs the compiled C++ program with the RAM the script sets, and
+    // compares the RAM it prints when it halts with the last line of the
+    // comparison file, reporting a difference in the log like the script
+    // runners do.
+    template <typename Step>
+    void runCpp(Test &test, const filesystem::path &directory, const filesystem::path &log, Step &step)
+    {
+        vector<string> args = {(directory / "program").string()};
+        cppArguments(test.script, args);
+        if (!step(args))
+        {
+            return;
+        }
+
+        map<string, string> actual;
+        ifstream output(log);
+        string line;
+        smatch match;
+        while (getline(output, line))
+        {
+            if (regex_match(line, match, regex("(RAM\\[\\d+\\]) = (-?\\d+)")))
+            {
+                actual[match[1]] = match[2];
+            }
+        }
+
+        string script = readScript(test.script);
+        string compareTo = regex_search(script, match, regex("\\bcompare-to\\s+([^\\s,;]+)")) ? match[1].str() : "";
+        ifstream comparison(directory / compareTo);
+        string last;
+        getline(comparison, line);
+        while (getline(comparison, line))
+        {
+            last = line.find('|') == string::npos ? last : line;
+        }
+
+        auto columns = [](const string &row)
+        {
+            vector<string> cells;
+            stringstream stream(row);
+            string cell;
+            while (getline(stream, cell, '|'))
+            {
+                cell.erase(0, cell.find_first_not_of(' '));
+                cell.erase(cell.find_last_not_of(' ') + 1);
+                cells.push_back(cell);
+            }
+            return cells;
+        };
+
+        // The columns follow the output list, whose addresses are the
+        // arguments without a value.
+        vector<string> expected = columns(last);
+        string difference;
+        size_t column = 1;
+        for (size_t i = 1; i < args.size(); i++)
+        {
+            if (args[i].find('=') != string::npos)
+            {
+                continue;
+            }
+
+            string name = "RAM[" + args[i] + "]";
+            if (column >= expected.size())
+            {
+                difference = "cannot read " + compareTo;
+                break;
+            }
+            if (!actual.count(name) || stoi(actual[name]) != stoi(expected[column]))
+            {
+                difference = name + " is " + (actual.count(name) ? actual[name] : "missing") + ", expected " + expected[column];
+                break;
+            }
+            column++;
+        }
+
+        if (!difference.empty())
+        {
+            ofstream(log, ios::app) << "FAIL " << test.script.string() << ": " << difference << endl;
+            test.status = Test::FAIL;
+        }
+    }
+
+    // Translates each .vm file to an object file and links them into a
+    // .hack file, which the copy of the script then loads in place of the
+    // program it names.
+    template <typename Step>
+    bool linkProgram(const Test &test, const filesystem::path &directory, const string &source, Step &step)
+    {
+        string translator = (m_options.tools / "vm-translator").string();
+        filesystem::path linked = filesystem::path(directory / test.program).replace_extension(".hack");
+        if (!step({translator, "--object", source}) || !step({translator, "--link", linked.string(), directory.string()}))
+        {
+            return false;
+        }
+
+        filesystem::path script = directory / test.script.filename();
+        stringstream text;
+        text << ifstream(script).rdbuf();
+        string program = regex_replace(test.program, regex("[^A-Za-z0-9_]"), "\\$&");
+        ofstream(script) << regex_replace(text.str(), regex("\\bload(\\s+)" + program), "load$1" + linked.filename().string());
+        return true;
+    }
+
+    // The reason the script runner gave for failing, with the first error
+    // a tool reported before it, or else the last line of output.
+    static string failureMessage(const filesystem::path &log)
+    {
+        ifstream file(log);
+        string line;
+        string last = "failed without output";
+        string failure;
+        string error;
+
+        while (getline(file, line))
+        {
+            if (!line.empty())
+            {
+                last = line;
+            }
+            if (line.compare(0, 7, "Error: ") == 0 && error.empty())
+            {
+                error = line.substr(7);
+            }
+            if (line.compare(0, 5, "FAIL ") == 0)
+            {
+                failure = line.substr(line.find(": ") == string::npos ? 5 : line.find(": ") + 2);
+            }
+        }
+
+        if (failure.empty())
+        {
+            return error.empty() ? last : error;
+        }
+        return error.empty() ? failure : failure + " (" + error + ")";
+    }
+};
+
+string jsonString(const string &text)
+{
+    string result = "\"";
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            result += '\\';
+            result += c;
+        }
+        else if (c == '\n')
+        {
+            result += "\\n";
+        }
+        else if ((unsigned char)c < 0x20)
+        {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            result += escape;
+        }
+        else
+        {
+            result += c;
+        }
+    }
+    return result + "\"";
+}
+
+void saveSummary(const vector<Test> &tests, const map<Test::Status, int> &counts, double seconds, const string &filename)
+{
+    ofstream file(filename);
+    file << "{\"passed\": " << counts.at(Test::PASS) << ", \"failed\": " << counts.at(Test::FAIL)
+         << ", \"timedOut\": " << counts.at(Test::TIMEOUT) << ", \"skipped\": " << counts.at(Test::SKIP)
+         << ", \"seconds\": " << seconds << ", \"tests\": [";
+
+    for (size_t i = 0; i < tests.size(); i++)
+    {
+        file << (i ? "," : "") << endl
+             << "  {\"script\": " << jsonString(tests[i].script.string()) << ", \"kind\": \"" << kindName(tests[i].kind)
+             << "\", \"flags\": [";
+        for (size_t j = 0; j < tests[i].flags.size(); j++)
+        {
+            file << (j ? ", " : "") << jsonString(tests[i].flags[j]);
+        }
+        file << "], \"backend\": \"" << backendName(tests[i].backend) << "\", \"status\": \"" << statusName(tests[i].status) << "\", \"seconds\": " << tests[i].seconds
+             << ", \"message\": " << jsonString(tests[i].message) << "}";
+    }
+
+    file << endl
+         << "]}" << endl;
+}
+
+// Compiles the OS given with --os once, into the work directory, for the VM
+// scripts that need classes their own directory does not define.
+bool buildOS(const Options &options)
+{
+    filesystem::path directory = options.work / "os";
+    filesystem::remove_all(directory);
+    filesystem::create_directories(directory);
+
+    bool jack = false;
+    for (const auto &entry : filesystem::directory_iterator(options.os))
+    {
+        string extension = entry.path().extension().string();
+        if (extension == ".jack" || extension == ".vm")
+        {
+            filesystem::copy_file(entry.path(), directory / entry.path().filename());
+            jack = jack || extension == ".jack";
+        }
+    }
+
+    bool timedOut = false;
+    return !jack || runTool({(options.tools / "compiler").string(), directory.string()}, options.work / "os.log", options.timeout, timedOut) == 0;
+}
+
+// Looks a program up on the PATH, as the shell does, unless the name is a
+// path. Empty if there is no such program.
+filesystem::path findProgram(const string &name)
+{
+    if (name.find('/') != string::npos)
+    {
+        return filesystem::exists(name) ? filesystem::absolute(name) : filesystem::path();
+    }
+
+    stringstream path(getenv("PATH") ? getenv("PATH") : "");
+    string directory;
+    while (getline(path, directory, ':'))
+    {
+        filesystem::path candidate = filesystem::path(directory.empty() ? "." : directory) / name;
+        if (access(candidate.c_str(), X_OK) == 0)
+        {
+            return candidate;
+        }
+    }
+    return {};
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    options.tools = filesystem::absolute(argv[0]).parent_path();
+    options.work = filesystem::temp_directory_path() / "nand2tetris-regression";
+    int jobs = max(1u, thread::hardware_concurrency());
+    string summaryFilePath;
+    vector<string> paths;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+
+        if (arg == "--jobs" && i + 1 < argc)
+        {
+            jobs = max(1, stoi(argv[++i]));
+        }
+        else if (arg == "--timeout" && i + 1 < argc)
+        {
+            options.timeout = stod(argv[++i]);
+        }
+        else if (arg == "--tools" && i + 1 < argc)
+        {
+            options.tools = filesystem::absolute(argv[++i]);
+        }
+        else if (arg == "--work" && i + 1 < argc)
+        {
+            options.work = filesystem::absolute(argv[++i]);
+        }
+        else if (arg == "--os" && i + 1 < argc)
+        {
+            options.os = filesystem::absolute(argv[++i]);
+        }
+        else if (arg == "--cxx" && i + 1 < argc)
+        {
+            options.cxx = argv[++i];
+        }
+        else if (arg == "--json" && i + 1 < argc)
+        {
+            summaryFilePath = argv[++i];
+        }
+        else if (arg == "--keep")
+        {
+            options.keep = true;
+        }
+        else
+        {
+            paths.push_back(arg);
+        }
+    }
+
+    if (paths.empty())
+    {
+        cout << "Invalid argument: specify directories or .tst files to run" << endl
+             << "Usage: regression [--jobs N] [--timeout seconds] [--tools directory] [--work directory] [--os directory] [--cxx compiler] [--json summary.json] [--keep] <directory|file.tst>..." << endl;
+        return -1;
+    }
+
+    vector<filesystem::path> scripts;
+    for (const auto &path : paths)
+    {
+        if (!filesystem::is_directory(path))
+        {
+            scripts.push_back(path);
+            continue;
+        }
+
+        for (const auto &entry : filesystem::recursive_directory_iterator(path))
+        {
+            if (entry.path().extension() == ".tst")
+            {
+                scripts.push_back(entry.path());
+            }
+        }
+    }
+    sort(scripts.begin(), scripts.end());
+
+    options.cxx = findProgram(options.cxx.empty() ? "c++" : options.cxx.string());
+
+    // Chips use the chips of every directory under test as their parts.
+    vector<Test> tests;
+    for (const auto &script : scripts)
+    {
+        tests.push_back(classify(script));
+        filesystem::path directory = filesystem::absolute(script).parent_path();
+        if (tests.back().kind == Test::CHIP && find(options.chips.begin(), options.chips.end(), directory) == options.chips.end())
+        {
+            options.chips.push_back(directory);
+        }
+    }
+
+    // The extra passes each runnable script of a kind gets, one per set of
+    // flags for its runner.
+    const multimap<Test::Kind, vector<string>> passes = {
+        {Test::VM, {"--jit", "--jit-threshold", "1"}},
+        {Test::CHIP, {"--events"}},
+        {Test::CHIP, {"--threads", "2", "--gate-level"}}};
+
+    for (size_t i = 0, count = tests.size(); i < count; i++)
+    {
+        auto [first, last] = passes.equal_range(tests[i].kind);
+        for (auto pass = first; pass != last && tests[i].status == Test::PENDING; ++pass)
+        {
+            tests.push_back(tests[i]);
+            tests.back().flags = pass->second;
+        }
+
+        if (tests[i].translated && tests[i].status == Test::PENDING)
+        {
+            tests.push_back(tests[i]);
+            tests.back().backend = Test::OBJECTS;
+        }
+
+        vector<string> args;
+        if (tests[i].translated && tests[i].status == Test::PENDING && cppArguments(tests[i].script, args))
+        {
+            tests.push_back(tests[i]);
+            tests.back().backend = Test::CPP;
+            if (options.cxx.empty())
+            {
+                tests.back().status = Test::SKIP;
+                tests.back().message = "no C++ compiler found";
+            }
+        }
+
+        if (tests[i].computer && tests[i].status == Test::PENDING)
+        {
+            tests.push_back(tests[i]);
+            tests.back().kind = Test::CHIP;
+            tests.back().flags = {"--gate-level"};
+        }
+    }
+
+    auto start = chrono::steady_clock::now();
+    filesystem::create_directories(options.work);
+    if (!options.os.empty() && !buildOS(options))
+    {
+        cerr << "Error: cannot compile the OS in " << options.os << endl;
+        return -1;
+    }
+
+    Runner runner(options, tests);
+    runner.run(jobs);
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    map<Test::Status, int> counts = {{Test::PASS, 0}, {Test::FAIL, 0}, {Test::TIMEOUT, 0}, {Test::SKIP, 0}};
+    for (const auto &test : tests)
+    {
+        counts[test.status]++;
+    }
+
+    cout << tests.size() << " scripts in " << elapsed.count() << " s on " << jobs << " workers: " << counts[Test::PASS] << " passed, "
+         << counts[Test::FAIL] << " failed, " << counts[Test::TIMEOUT] << " timed out, " << counts[Test::SKIP] << " skipped" << endl;
+
+    if (!summaryFilePath.empty())
+    {
+        saveSummary(tests, counts, elapsed.count(), summaryFilePath);
+    }
+
+    return counts[Test::FAIL] + counts[Test::TIMEOUT] == 0 ? 0 : -1;
+}